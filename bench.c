@@ -0,0 +1,660 @@
+/*
+ * Vanitygen, vanity bitcoin address generator
+ * Copyright (C) 2026 The Vanitygen contributors
+ *
+ * Vanitygen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Vanitygen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Vanitygen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmarks of the kernels on the search's hot path
+ *
+ * Each benchmark runs for a doubling number of iterations until one
+ * run takes long enough to time, and reports the nanoseconds and
+ * vg_timestamp() cycles per operation.
+ *
+ * The prefix index is private to pattern.c, so it is compiled in
+ * here directly.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/bn.h>
+#include <openssl/ec.h>
+#include <openssl/sha.h>
+#include <openssl/ripemd.h>
+
+#include "pattern.c"
+
+const char *version = VANITYGEN_VERSION;
+
+#define BENCH_BATCH 1024
+#define BENCH_MSG_STRIDE 72
+#define BENCH_MSGS 96
+#define BENCH_TARGETS 4096
+#define BENCH_ADDRS 1024
+
+static double bench_min_time = 0.2;
+static char **bench_filter = NULL;
+static int bench_nfilter = 0;
+
+typedef void (*bench_func_t)(long n);
+
+/* Results land here, so the compiler keeps the work */
+static volatile unsigned char bench_sink;
+
+static BN_CTX *bench_bnctx;
+static const EC_GROUP *bench_group;
+static EC_POINT *bench_ecp, *bench_ecgen;
+static vg_fe_t bench_fe_a, bench_fe_b;
+static vg_ge_t bench_gen, bench_step, bench_symstep, bench_center;
+static vg_ge_t *bench_ge, *bench_table;
+static vg_gej_t bench_gej, *bench_gejs;
+static vg_fe_t *bench_scratch;
+static unsigned char bench_msg[BENCH_MSGS * BENCH_MSG_STRIDE];
+static unsigned char bench_hash[BENCH_MSGS * 20];
+static unsigned long long bench_stage[VG_NSTAGES];
+static char bench_addrs[BENCH_ADDRS][40];
+static pcre *bench_re;
+static pcre_extra *bench_re_extra;
+static const char *bench_prefixes[] = {
+	"1Love", "1Bitcoin", "1abcdef", "1QQQQQQQQ", "111kX", "1zzzzzzzzz",
+};
+static vg_prefix_context_t *bench_vcpp;
+static vg_prefix_snapshot_t *bench_vpsp;
+static BIGNUM *bench_bntargs[BENCH_TARGETS];
+static unsigned char bench_targs[BENCH_TARGETS][25];
+
+static unsigned long long bench_lcg = 0x9e3779b97f4a7c15ULL;
+
+static void
+bench_random(unsigned char *buf, int len)
+{
+	while (len--) {
+		bench_lcg = (bench_lcg * 6364136223846793005ULL) +
+			1442695040888963407ULL;
+		*buf++ = bench_lcg >> 56;
+	}
+}
+
+
+/*
+ * Run func with n doubling until it takes bench_min_time, and return
+ * the final n with the seconds and timestamp ticks it took
+ */
+static long
+bench_time(bench_func_t func, double *secsp, unsigned long long *ticksp)
+{
+	struct timeval start, end;
+	unsigned long long t0;
+	long n;
+
+	for (n = 1; ; n *= 2) {
+		gettimeofday(&start, NULL);
+		t0 = vg_timestamp();
+		func(n);
+		*ticksp = vg_timestamp() - t0;
+		gettimeofday(&end, NULL);
+		*secsp = (end.tv_sec - start.tv_sec) +
+			((end.tv_usec - start.tv_usec) / 1000000.0);
+		if (*secsp >= bench_min_time)
+			return n;
+	}
+}
+
+static void
+bench_report(const char *name, double ns, double cycles)
+{
+#if defined(VG_TIMESTAMP_CYCLES)
+	printf("%-44s %12.2f %12.1f\n", name, ns, cycles);
+#else
+	printf("%-44s %12.2f %12s\n", name, ns, "-");
+	(void) cycles;
+#endif
+	fflush(stdout);
+}
+
+static int
+bench_selected(const char *name)
+{
+	int i;
+
+	if (!bench_nfilter)
+		return 1;
+	for (i = 0; i < bench_nfilter; i++)
+		if (strstr(name, bench_filter[i]))
+			return 1;
+	return 0;
+}
+
+/* Time a benchmark doing ops operations per iteration */
+static void
+bench_run(const char *name, bench_func_t func, long ops)
+{
+	unsigned long long ticks;
+	double secs;
+	long n;
+
+	if (!bench_selected(name))
+		return;
+	n = bench_time(func, &secs, &ticks);
+	bench_report(name, (secs * 1e9) / ((double) n * ops),
+		     (double) ticks / ((double) n * ops));
+}
+
+
+/*
+ * Field and group arithmetic
+ */
+
+static void
+bench_fe_mul(long n)
+{
+	while (n--)
+		vg_fe_mul(&bench_fe_a, &bench_fe_a, &bench_fe_b);
+}
+
+static void
+bench_fe_sqr(long n)
+{
+	while (n--)
+		vg_fe_sqr(&bench_fe_a, &bench_fe_a);
+}
+
+static void
+bench_fe_inv(long n)
+{
+	while (n--)
+		vg_fe_inv(&bench_fe_a, &bench_fe_a);
+}
+
+static void
+bench_ec_point_add(long n)
+{
+	while (n--)
+		EC_POINT_add(bench_group, bench_ecp, bench_ecp, bench_ecgen,
+			     bench_bnctx);
+}
+
+static void
+bench_gej_add_ge(long n)
+{
+	while (n--)
+		vg_gej_add_ge(&bench_gej, &bench_gej, &bench_gen);
+}
+
+static void
+bench_ge_set_all_gej(long n)
+{
+	while (n--)
+		vg_ge_set_all_gej(bench_ge, bench_gejs, BENCH_BATCH,
+				  bench_scratch);
+}
+
+static void
+bench_ge_add_batch(long n)
+{
+	while (n--)
+		vg_ge_add_batch(bench_ge, BENCH_BATCH, &bench_step,
+				bench_scratch);
+}
+
+static void
+bench_ge_add_batch_sym(long n)
+{
+	while (n--)
+		vg_ge_add_batch_sym(bench_ge, &bench_center, bench_table,
+				    BENCH_BATCH / 2, &bench_symstep,
+				    bench_scratch);
+}
+
+static int
+bench_ec_init(void)
+{
+	EC_KEY *pkey;
+	BIGNUM *bn;
+	int i;
+
+	pkey = vg_exec_context_new_key();
+	bn = BN_new();
+	if (!pkey || !bn)
+		return 0;
+	bench_group = EC_KEY_get0_group(pkey);
+	bench_ecp = EC_POINT_dup(EC_GROUP_get0_generator(bench_group),
+				 bench_group);
+	bench_ecgen = EC_POINT_dup(EC_GROUP_get0_generator(bench_group),
+				   bench_group);
+	bench_ge = (vg_ge_t *) malloc((BENCH_BATCH + 1) * sizeof(*bench_ge));
+	bench_gejs = (vg_gej_t *) malloc(BENCH_BATCH * sizeof(*bench_gejs));
+	bench_table = (vg_ge_t *)
+		malloc((BENCH_BATCH / 2) * sizeof(*bench_table));
+	bench_scratch = (vg_fe_t *)
+		malloc((BENCH_BATCH + 9) * sizeof(*bench_scratch));
+	if (!bench_ecp || !bench_ecgen || !bench_ge || !bench_gejs ||
+	    !bench_table || !bench_scratch)
+		return 0;
+
+	vg_fe_set_int(&bench_fe_a, 12345);
+	vg_fe_set_int(&bench_fe_b, 67890);
+	vg_ge_set_generator(&bench_gen);
+	vg_gej_set_ge(&bench_gej, &bench_gen);
+
+	/* G..BENCH_BATCH*G, and the steps past them */
+	vg_gej_set_ge(&bench_gejs[0], &bench_gen);
+	for (i = 1; i < BENCH_BATCH; i++)
+		vg_gej_add_ge(&bench_gejs[i], &bench_gejs[i-1], &bench_gen);
+	vg_ge_set_all_gej(bench_table, bench_gejs, BENCH_BATCH / 2,
+			  bench_scratch);
+	vg_ge_set_all_gej(bench_ge, bench_gejs, BENCH_BATCH, bench_scratch);
+
+	BN_set_word(bn, BENCH_BATCH + 1);
+	EC_POINT_mul(bench_group, bench_ecp, bn, NULL, NULL, bench_bnctx);
+	vg_ge_set_ecpoint(&bench_step, bench_group, bench_ecp, bench_bnctx);
+	bench_symstep = bench_step;
+	BN_set_word(bn, 1000003);
+	EC_POINT_mul(bench_group, bench_ecp, bn, NULL, NULL, bench_bnctx);
+	vg_ge_set_ecpoint(&bench_center, bench_group, bench_ecp, bench_bnctx);
+	BN_free(bn);
+	return 1;
+}
+
+
+/*
+ * Hashing
+ */
+
+static void
+bench_sha256(long n)
+{
+	unsigned char out[32];
+
+	while (n--)
+		SHA256(bench_msg, 33, out);
+	bench_sink ^= out[0];
+}
+
+static void
+bench_ripemd160(long n)
+{
+	unsigned char out[20];
+
+	while (n--)
+		RIPEMD160(bench_msg, 32, out);
+	bench_sink ^= out[0];
+}
+
+static void
+bench_hash160_33(long n)
+{
+	while (n--)
+		vg_hash160_33(bench_hash, bench_msg);
+}
+
+static void
+bench_hash160_65(long n)
+{
+	while (n--)
+		vg_hash160_65(bench_hash, bench_msg);
+}
+
+static void
+bench_hash160_batch_33(long n)
+{
+	while (n--)
+		vg_hash160_batch(bench_hash, bench_msg, BENCH_MSG_STRIDE,
+				 33, BENCH_MSGS);
+}
+
+static void
+bench_hash160_batch_65(long n)
+{
+	while (n--)
+		vg_hash160_batch(bench_hash, bench_msg, BENCH_MSG_STRIDE,
+				 65, BENCH_MSGS);
+}
+
+/*
+ * Time the multi-buffer hash160 of the current backends, then split
+ * it into SHA-256 and RIPEMD-160 with the stage timers
+ */
+static void
+bench_hash_backend(const char *sha256, bench_func_t func, int len)
+{
+	char name[64];
+	unsigned long long ticks;
+	double secs, ns_per_tick;
+	long n;
+
+	snprintf(name, sizeof(name), "hash160 x%d (%s/%s, %d bytes)",
+		 BENCH_MSGS, sha256, vg_hash_ripemd160_backend_name(), len);
+	bench_run(name, func, BENCH_MSGS);
+
+	snprintf(name, sizeof(name), "sha256 x%d (%s, %d bytes)",
+		 BENCH_MSGS, sha256, len);
+	if (!bench_selected(name))
+		return;
+	vg_stage_ticks = bench_stage;
+	memset(bench_stage, 0, sizeof(bench_stage));
+	n = bench_time(func, &secs, &ticks);
+	vg_stage_ticks = NULL;
+
+	/* The stage counters summed over every doubling of n */
+	n = (2 * n) - 1;
+	ns_per_tick = (secs * 1e9) / ticks;
+	bench_report(name,
+		     (bench_stage[VG_STAGE_SHA256] * ns_per_tick) /
+		     ((double) n * BENCH_MSGS),
+		     (double) bench_stage[VG_STAGE_SHA256] /
+		     ((double) n * BENCH_MSGS));
+	snprintf(name, sizeof(name), "ripemd160 x%d (%s)",
+		 BENCH_MSGS, vg_hash_ripemd160_backend_name());
+	bench_report(name,
+		     (bench_stage[VG_STAGE_RIPEMD160] * ns_per_tick) /
+		     ((double) n * BENCH_MSGS),
+		     (double) bench_stage[VG_STAGE_RIPEMD160] /
+		     ((double) n * BENCH_MSGS));
+}
+
+
+/*
+ * Address encoding and matching
+ */
+
+static void
+bench_b58_encode_check(long n)
+{
+	unsigned char buf[21];
+	char addr[64];
+
+	memset(buf, 0, sizeof(buf));
+	memcpy(buf + 1, bench_hash, 20);
+	while (n--) {
+		buf[20] = n;
+		vg_b58_encode_check(buf, sizeof(buf), addr);
+	}
+	bench_sink ^= addr[1];
+}
+
+static void
+bench_get_prefix_ranges(long n)
+{
+	BIGNUM *ranges[4];
+	int i;
+
+	while (n--) {
+		for (i = 0;
+		     i < (int) (sizeof(bench_prefixes) /
+				sizeof(bench_prefixes[0]));
+		     i++) {
+			memset(ranges, 0, sizeof(ranges));
+			if (!get_prefix_ranges(0, bench_prefixes[i], ranges,
+					       bench_bnctx))
+				free_ranges(ranges);
+		}
+	}
+}
+
+static void
+bench_prefix_avl_search(long n)
+{
+	int i;
+
+	while (n--)
+		for (i = 0; i < BENCH_TARGETS; i++)
+			if (vg_prefix_avl_search(&bench_vcpp->vcp_avlroot,
+						 bench_bntargs[i]))
+				bench_sink++;
+}
+
+static void
+bench_prefix_snapshot_search(long n)
+{
+	int i;
+
+	while (n--)
+		for (i = 0; i < BENCH_TARGETS; i++)
+			bench_sink += vg_prefix_snapshot_search(
+				bench_vpsp, bench_targs[i]);
+}
+
+/*
+ * Prefix lookups in indexes of 1 to max random ranges, of the width
+ * of a 9 to 10 character prefix.  The targets are random, so nearly
+ * all of them miss, as in a search.
+ */
+static int
+bench_prefix_index(long max)
+{
+	unsigned char low[25], high[25];
+	BIGNUM *bnlow, *bnhigh;
+	char name[64];
+	long size, count;
+	int i;
+
+	if (!bench_selected("vg_prefix_avl_search") &&
+	    !bench_selected("vg_prefix_snapshot_search"))
+		return 1;
+
+	bench_vcpp = (vg_prefix_context_t *)
+		vg_prefix_context_new(0, 128, 0);
+	for (i = 0; i < BENCH_TARGETS; i++) {
+		bench_targs[i][0] = 0;
+		bench_random(&bench_targs[i][1], 24);
+		bench_bntargs[i] = BN_bin2bn(bench_targs[i], 25, NULL);
+	}
+
+	memset(low, 0, sizeof(low));
+	memset(high, 0xff, sizeof(high));
+	high[0] = 0;
+	for (size = 1, count = 0; size <= max; size *= 10) {
+		for (; count < size; count++) {
+			bench_random(&low[1], 9);
+			memcpy(&high[1], &low[1], 9);
+			bnlow = BN_bin2bn(low, 25, NULL);
+			bnhigh = BN_bin2bn(high, 25, NULL);
+			if (!bnlow || !bnhigh ||
+			    !vg_prefix_add(&bench_vcpp->vcp_avlroot, "bench",
+					   bnlow, bnhigh))
+				return 0;
+		}
+		bench_vcpp->base.vc_npatterns = count;
+
+		snprintf(name, sizeof(name), "vg_prefix_avl_search (%ld)",
+			 size);
+		bench_run(name, bench_prefix_avl_search, BENCH_TARGETS);
+
+		snprintf(name, sizeof(name),
+			 "vg_prefix_snapshot_search (%ld)", size);
+		if (bench_selected(name)) {
+			bench_vpsp = (vg_prefix_snapshot_t *)
+				vg_prefix_context_build_snapshot(
+					&bench_vcpp->base);
+			if (!bench_vpsp)
+				return 0;
+			bench_run(name, bench_prefix_snapshot_search,
+				  BENCH_TARGETS);
+			vg_snapshot_free(&bench_vpsp->base);
+			bench_vpsp = NULL;
+		}
+	}
+
+	vg_context_free(&bench_vcpp->base);
+	for (i = 0; i < BENCH_TARGETS; i++)
+		BN_free(bench_bntargs[i]);
+	return 1;
+}
+
+static void
+bench_pcre_exec(long n)
+{
+	int i, re_vec[9];
+
+	while (n--)
+		for (i = 0; i < BENCH_ADDRS; i++)
+			if (pcre_exec(bench_re, bench_re_extra,
+				      bench_addrs[i], 34, 0, 0, re_vec,
+				      sizeof(re_vec) / sizeof(re_vec[0])) > 0)
+				bench_sink++;
+}
+
+/* Regular expressions on a set of random addresses */
+static int
+bench_regex(void)
+{
+	static const char *regexes[] = {
+		"^1[Bb]itcoin", "^1[a-z]{6}", "xyz$", "[0-9]{6}",
+	};
+	unsigned char buf[21];
+	const char *errptr;
+	char name[64];
+	int i, erroffset;
+
+	buf[0] = 0;
+	for (i = 0; i < BENCH_ADDRS; i++) {
+		bench_random(&buf[1], 20);
+		vg_b58_encode_check(buf, sizeof(buf), bench_addrs[i]);
+	}
+
+	for (i = 0; i < (int) (sizeof(regexes) / sizeof(regexes[0])); i++) {
+		snprintf(name, sizeof(name), "pcre_exec (%s)", regexes[i]);
+		if (!bench_selected(name))
+			continue;
+		bench_re = pcre_compile(regexes[i], 0, &errptr, &erroffset,
+					NULL);
+		if (!bench_re) {
+			fprintf(stderr, "Regex error: %s\n", errptr);
+			return 0;
+		}
+		bench_re_extra = pcre_study(bench_re, 0, &errptr);
+		bench_run(name, bench_pcre_exec, BENCH_ADDRS);
+		if (bench_re_extra)
+			pcre_free(bench_re_extra);
+		pcre_free(bench_re);
+	}
+	return 1;
+}
+
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr,
+"Vanitygen bench %s (" OPENSSL_VERSION_TEXT ")\n"
+"Usage: %s [-T <seconds>] [-p <prefixes>] [<name>...]\n"
+"Times the kernels of the address search, or only those with a name\n"
+"containing one of <name>.\n"
+"\n"
+"Options:\n"
+"-T <seconds>  Minimum run time of each benchmark (Default: 0.2)\n"
+"-p <prefixes> Size of the largest prefix index timed (Default: 10000000)\n",
+		version, name);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const char *sha256_backends[] = {
+		"avx512", "sha-ni", "avx2", "openssl",
+	};
+	static const char *fe_backends[] = {
+		"scalar", "ifma",
+	};
+	char name[64];
+	long max_prefixes = 10000000;
+	int i, opt;
+
+	while ((opt = getopt(argc, argv, "T:p:h?")) != -1) {
+		switch (opt) {
+		case 'T':
+			bench_min_time = atof(optarg);
+			if (bench_min_time <= 0.0) {
+				fprintf(stderr,
+					"Invalid run time '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'p':
+			max_prefixes = atol(optarg);
+			if (max_prefixes <= 0) {
+				fprintf(stderr,
+					"Invalid prefix count '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	bench_filter = &argv[optind];
+	bench_nfilter = argc - optind;
+
+	bench_bnctx = BN_CTX_new();
+	if (!bench_bnctx || !bench_ec_init()) {
+		fprintf(stderr, "ERROR: out of memory?\n");
+		return 1;
+	}
+	vg_hash_init(NULL);
+	vg_fe_init(NULL);
+	for (i = 0; i < BENCH_MSGS; i++)
+		bench_random(bench_msg + (i * BENCH_MSG_STRIDE),
+			     BENCH_MSG_STRIDE);
+
+	printf("%-44s %12s %12s\n", "Benchmark", "ns/op", "cycles/op");
+
+	bench_run("vg_fe_mul", bench_fe_mul, 1);
+	bench_run("vg_fe_sqr", bench_fe_sqr, 1);
+	bench_run("vg_fe_inv", bench_fe_inv, 1);
+	bench_run("EC_POINT_add", bench_ec_point_add, 1);
+	bench_run("vg_gej_add_ge", bench_gej_add_ge, 1);
+	bench_run("vg_ge_set_all_gej (per point)", bench_ge_set_all_gej,
+		  BENCH_BATCH);
+	bench_run("vg_ge_add_batch (per point)", bench_ge_add_batch,
+		  BENCH_BATCH);
+	for (i = 0; i < (int) (sizeof(fe_backends) / sizeof(fe_backends[0]));
+	     i++) {
+		if (!vg_fe_init(fe_backends[i]))
+			continue;
+		snprintf(name, sizeof(name),
+			 "vg_ge_add_batch_sym (%s, per point)", fe_backends[i]);
+		bench_run(name, bench_ge_add_batch_sym, BENCH_BATCH + 1);
+	}
+	vg_fe_init(NULL);
+
+	bench_run("SHA256 (openssl, 33 bytes)", bench_sha256, 1);
+	bench_run("RIPEMD160 (openssl, 32 bytes)", bench_ripemd160, 1);
+	bench_run("vg_hash160_33", bench_hash160_33, 1);
+	bench_run("vg_hash160_65", bench_hash160_65, 1);
+	for (i = 0;
+	     i < (int) (sizeof(sha256_backends) / sizeof(sha256_backends[0]));
+	     i++) {
+		if (!vg_hash_init(sha256_backends[i]))
+			continue;
+		bench_hash_backend(sha256_backends[i],
+				   bench_hash160_batch_33, 33);
+		bench_hash_backend(sha256_backends[i],
+				   bench_hash160_batch_65, 65);
+	}
+	vg_hash_init(NULL);
+
+	bench_run("vg_b58_encode_check", bench_b58_encode_check, 1);
+	bench_run("get_prefix_ranges", bench_get_prefix_ranges,
+		  sizeof(bench_prefixes) / sizeof(bench_prefixes[0]));
+	if (!bench_prefix_index(max_prefixes) || !bench_regex()) {
+		fprintf(stderr, "ERROR: benchmark setup failed\n");
+		return 1;
+	}
+	return 0;
+}
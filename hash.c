@@ -0,0 +1,1042 @@
+/*
+ * Vanitygen, vanity bitcoin address generator
+ * Copyright (C) 2026 The Vanitygen contributors
+ *
+ * Vanitygen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Vanitygen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Vanitygen.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * The SHA extensions rounds follow the sample code in Intel's "Intel
+ * SHA Extensions" paper (Gulley et al., 2013), and RIPEMD-160 the
+ * specification by Dobbertin, Bosselaers and Preneel.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <openssl/sha.h>
+
+#include "pattern.h"
+#include "util.h"
+#include "hash.h"
+
+/*
+ * Hash160 (RIPEMD-160 of SHA-256) of the fixed-length buffers hashed by
+ * the search loop: 33 and 65 byte public keys, and the 37 and 69 byte
+ * 1-of-1 multisig scripts built around them.
+ *
+ * The input length is a compile-time constant in each entry point, so
+ * the SHA-256 padding and length words fold into constants.  The
+ * SHA-256 blocks go straight to OpenSSL's block function, which has
+ * SHA extension and AVX2 implementations, skipping the generic
+ * buffering of SHA256().  The RIPEMD-160 message block is built
+ * straight from the SHA-256 state, and since all but its first eight
+ * words are constant, its compression function is inlined here.
+ */
+
+#define ROTL32(x, n)	(((x) << (n)) | ((x) >> (32 - (n))))
+
+/*
+ * The round sequence is written once, over the RMD_ADD, RMD_ROTL,
+ * RMD_K and RMD_F1..RMD_F5 operations, which each backend defines
+ * for its word type before expanding RIPEMD160_ROUNDS.
+ */
+#define RMD_STEP(a, b, c, d, e, f, x, k, r) do {			\
+		(a) = RMD_ADD(RMD_ROTL(RMD_ADD(RMD_ADD(a, f(b, c, d)),	\
+					       RMD_ADD(x, RMD_K(k))),	\
+				       r),				\
+			      e);					\
+		(c) = RMD_ROTL(c, 10);					\
+	} while (0)
+
+#define R11(a, b, c, d, e, x, r)					\
+	RMD_STEP(a, b, c, d, e, RMD_F1, x, 0, r)
+#define R21(a, b, c, d, e, x, r)					\
+	RMD_STEP(a, b, c, d, e, RMD_F2, x, 0x5a827999, r)
+#define R31(a, b, c, d, e, x, r)					\
+	RMD_STEP(a, b, c, d, e, RMD_F3, x, 0x6ed9eba1, r)
+#define R41(a, b, c, d, e, x, r)					\
+	RMD_STEP(a, b, c, d, e, RMD_F4, x, 0x8f1bbcdc, r)
+#define R51(a, b, c, d, e, x, r)					\
+	RMD_STEP(a, b, c, d, e, RMD_F5, x, 0xa953fd4e, r)
+#define R12(a, b, c, d, e, x, r)					\
+	RMD_STEP(a, b, c, d, e, RMD_F5, x, 0x50a28be6, r)
+#define R22(a, b, c, d, e, x, r)					\
+	RMD_STEP(a, b, c, d, e, RMD_F4, x, 0x5c4dd124, r)
+#define R32(a, b, c, d, e, x, r)					\
+	RMD_STEP(a, b, c, d, e, RMD_F3, x, 0x6d703ef3, r)
+#define R42(a, b, c, d, e, x, r)					\
+	RMD_STEP(a, b, c, d, e, RMD_F2, x, 0x7a6d76e9, r)
+#define R52(a, b, c, d, e, x, r)					\
+	RMD_STEP(a, b, c, d, e, RMD_F1, x, 0, r)
+
+/* One RIPEMD-160 block over state s[5] and message w[16] of type V */
+#define RIPEMD160_ROUNDS(V) do {					\
+		V a1 = s[0], b1 = s[1], c1 = s[2], d1 = s[3], e1 = s[4];\
+		V a2 = s[0], b2 = s[1], c2 = s[2], d2 = s[3], e2 = s[4];\
+		V t;							\
+									\
+		R11(a1, b1, c1, d1, e1, w[0], 11);			\
+		R12(a2, b2, c2, d2, e2, w[5], 8);			\
+		R11(e1, a1, b1, c1, d1, w[1], 14);			\
+		R12(e2, a2, b2, c2, d2, w[14], 9);			\
+		R11(d1, e1, a1, b1, c1, w[2], 15);			\
+		R12(d2, e2, a2, b2, c2, w[7], 9);			\
+		R11(c1, d1, e1, a1, b1, w[3], 12);			\
+		R12(c2, d2, e2, a2, b2, w[0], 11);			\
+		R11(b1, c1, d1, e1, a1, w[4], 5);			\
+		R12(b2, c2, d2, e2, a2, w[9], 13);			\
+		R11(a1, b1, c1, d1, e1, w[5], 8);			\
+		R12(a2, b2, c2, d2, e2, w[2], 15);			\
+		R11(e1, a1, b1, c1, d1, w[6], 7);			\
+		R12(e2, a2, b2, c2, d2, w[11], 15);			\
+		R11(d1, e1, a1, b1, c1, w[7], 9);			\
+		R12(d2, e2, a2, b2, c2, w[4], 5);			\
+		R11(c1, d1, e1, a1, b1, w[8], 11);			\
+		R12(c2, d2, e2, a2, b2, w[13], 7);			\
+		R11(b1, c1, d1, e1, a1, w[9], 13);			\
+		R12(b2, c2, d2, e2, a2, w[6], 7);			\
+		R11(a1, b1, c1, d1, e1, w[10], 14);			\
+		R12(a2, b2, c2, d2, e2, w[15], 8);			\
+		R11(e1, a1, b1, c1, d1, w[11], 15);			\
+		R12(e2, a2, b2, c2, d2, w[8], 11);			\
+		R11(d1, e1, a1, b1, c1, w[12], 6);			\
+		R12(d2, e2, a2, b2, c2, w[1], 14);			\
+		R11(c1, d1, e1, a1, b1, w[13], 7);			\
+		R12(c2, d2, e2, a2, b2, w[10], 14);			\
+		R11(b1, c1, d1, e1, a1, w[14], 9);			\
+		R12(b2, c2, d2, e2, a2, w[3], 12);			\
+		R11(a1, b1, c1, d1, e1, w[15], 8);			\
+		R12(a2, b2, c2, d2, e2, w[12], 6);			\
+									\
+		R21(e1, a1, b1, c1, d1, w[7], 7);			\
+		R22(e2, a2, b2, c2, d2, w[6], 9);			\
+		R21(d1, e1, a1, b1, c1, w[4], 6);			\
+		R22(d2, e2, a2, b2, c2, w[11], 13);			\
+		R21(c1, d1, e1, a1, b1, w[13], 8);			\
+		R22(c2, d2, e2, a2, b2, w[3], 15);			\
+		R21(b1, c1, d1, e1, a1, w[1], 13);			\
+		R22(b2, c2, d2, e2, a2, w[7], 7);			\
+		R21(a1, b1, c1, d1, e1, w[10], 11);			\
+		R22(a2, b2, c2, d2, e2, w[0], 12);			\
+		R21(e1, a1, b1, c1, d1, w[6], 9);			\
+		R22(e2, a2, b2, c2, d2, w[13], 8);			\
+		R21(d1, e1, a1, b1, c1, w[15], 7);			\
+		R22(d2, e2, a2, b2, c2, w[5], 9);			\
+		R21(c1, d1, e1, a1, b1, w[3], 15);			\
+		R22(c2, d2, e2, a2, b2, w[10], 11);			\
+		R21(b1, c1, d1, e1, a1, w[12], 7);			\
+		R22(b2, c2, d2, e2, a2, w[14], 7);			\
+		R21(a1, b1, c1, d1, e1, w[0], 12);			\
+		R22(a2, b2, c2, d2, e2, w[15], 7);			\
+		R21(e1, a1, b1, c1, d1, w[9], 15);			\
+		R22(e2, a2, b2, c2, d2, w[8], 12);			\
+		R21(d1, e1, a1, b1, c1, w[5], 9);			\
+		R22(d2, e2, a2, b2, c2, w[12], 7);			\
+		R21(c1, d1, e1, a1, b1, w[2], 11);			\
+		R22(c2, d2, e2, a2, b2, w[4], 6);			\
+		R21(b1, c1, d1, e1, a1, w[14], 7);			\
+		R22(b2, c2, d2, e2, a2, w[9], 15);			\
+		R21(a1, b1, c1, d1, e1, w[11], 13);			\
+		R22(a2, b2, c2, d2, e2, w[1], 13);			\
+		R21(e1, a1, b1, c1, d1, w[8], 12);			\
+		R22(e2, a2, b2, c2, d2, w[2], 11);			\
+									\
+		R31(d1, e1, a1, b1, c1, w[3], 11);			\
+		R32(d2, e2, a2, b2, c2, w[15], 9);			\
+		R31(c1, d1, e1, a1, b1, w[10], 13);			\
+		R32(c2, d2, e2, a2, b2, w[5], 7);			\
+		R31(b1, c1, d1, e1, a1, w[14], 6);			\
+		R32(b2, c2, d2, e2, a2, w[1], 15);			\
+		R31(a1, b1, c1, d1, e1, w[4], 7);			\
+		R32(a2, b2, c2, d2, e2, w[3], 11);			\
+		R31(e1, a1, b1, c1, d1, w[9], 14);			\
+		R32(e2, a2, b2, c2, d2, w[7], 8);			\
+		R31(d1, e1, a1, b1, c1, w[15], 9);			\
+		R32(d2, e2, a2, b2, c2, w[14], 6);			\
+		R31(c1, d1, e1, a1, b1, w[8], 13);			\
+		R32(c2, d2, e2, a2, b2, w[6], 6);			\
+		R31(b1, c1, d1, e1, a1, w[1], 15);			\
+		R32(b2, c2, d2, e2, a2, w[9], 14);			\
+		R31(a1, b1, c1, d1, e1, w[2], 14);			\
+		R32(a2, b2, c2, d2, e2, w[11], 12);			\
+		R31(e1, a1, b1, c1, d1, w[7], 8);			\
+		R32(e2, a2, b2, c2, d2, w[8], 13);			\
+		R31(d1, e1, a1, b1, c1, w[0], 13);			\
+		R32(d2, e2, a2, b2, c2, w[12], 5);			\
+		R31(c1, d1, e1, a1, b1, w[6], 6);			\
+		R32(c2, d2, e2, a2, b2, w[2], 14);			\
+		R31(b1, c1, d1, e1, a1, w[13], 5);			\
+		R32(b2, c2, d2, e2, a2, w[10], 13);			\
+		R31(a1, b1, c1, d1, e1, w[11], 12);			\
+		R32(a2, b2, c2, d2, e2, w[0], 13);			\
+		R31(e1, a1, b1, c1, d1, w[5], 7);			\
+		R32(e2, a2, b2, c2, d2, w[4], 7);			\
+		R31(d1, e1, a1, b1, c1, w[12], 5);			\
+		R32(d2, e2, a2, b2, c2, w[13], 5);			\
+									\
+		R41(c1, d1, e1, a1, b1, w[1], 11);			\
+		R42(c2, d2, e2, a2, b2, w[8], 15);			\
+		R41(b1, c1, d1, e1, a1, w[9], 12);			\
+		R42(b2, c2, d2, e2, a2, w[6], 5);			\
+		R41(a1, b1, c1, d1, e1, w[11], 14);			\
+		R42(a2, b2, c2, d2, e2, w[4], 8);			\
+		R41(e1, a1, b1, c1, d1, w[10], 15);			\
+		R42(e2, a2, b2, c2, d2, w[1], 11);			\
+		R41(d1, e1, a1, b1, c1, w[0], 14);			\
+		R42(d2, e2, a2, b2, c2, w[3], 14);			\
+		R41(c1, d1, e1, a1, b1, w[8], 15);			\
+		R42(c2, d2, e2, a2, b2, w[11], 14);			\
+		R41(b1, c1, d1, e1, a1, w[12], 9);			\
+		R42(b2, c2, d2, e2, a2, w[15], 6);			\
+		R41(a1, b1, c1, d1, e1, w[4], 8);			\
+		R42(a2, b2, c2, d2, e2, w[0], 14);			\
+		R41(e1, a1, b1, c1, d1, w[13], 9);			\
+		R42(e2, a2, b2, c2, d2, w[5], 6);			\
+		R41(d1, e1, a1, b1, c1, w[3], 14);			\
+		R42(d2, e2, a2, b2, c2, w[12], 9);			\
+		R41(c1, d1, e1, a1, b1, w[7], 5);			\
+		R42(c2, d2, e2, a2, b2, w[2], 12);			\
+		R41(b1, c1, d1, e1, a1, w[15], 6);			\
+		R42(b2, c2, d2, e2, a2, w[13], 9);			\
+		R41(a1, b1, c1, d1, e1, w[14], 8);			\
+		R42(a2, b2, c2, d2, e2, w[9], 12);			\
+		R41(e1, a1, b1, c1, d1, w[5], 6);			\
+		R42(e2, a2, b2, c2, d2, w[7], 5);			\
+		R41(d1, e1, a1, b1, c1, w[6], 5);			\
+		R42(d2, e2, a2, b2, c2, w[10], 15);			\
+		R41(c1, d1, e1, a1, b1, w[2], 12);			\
+		R42(c2, d2, e2, a2, b2, w[14], 8);			\
+									\
+		R51(b1, c1, d1, e1, a1, w[4], 9);			\
+		R52(b2, c2, d2, e2, a2, w[12], 8);			\
+		R51(a1, b1, c1, d1, e1, w[0], 15);			\
+		R52(a2, b2, c2, d2, e2, w[15], 5);			\
+		R51(e1, a1, b1, c1, d1, w[5], 5);			\
+		R52(e2, a2, b2, c2, d2, w[10], 12);			\
+		R51(d1, e1, a1, b1, c1, w[9], 11);			\
+		R52(d2, e2, a2, b2, c2, w[4], 9);			\
+		R51(c1, d1, e1, a1, b1, w[7], 6);			\
+		R52(c2, d2, e2, a2, b2, w[1], 12);			\
+		R51(b1, c1, d1, e1, a1, w[12], 8);			\
+		R52(b2, c2, d2, e2, a2, w[5], 5);			\
+		R51(a1, b1, c1, d1, e1, w[2], 13);			\
+		R52(a2, b2, c2, d2, e2, w[8], 14);			\
+		R51(e1, a1, b1, c1, d1, w[10], 12);			\
+		R52(e2, a2, b2, c2, d2, w[7], 6);			\
+		R51(d1, e1, a1, b1, c1, w[14], 5);			\
+		R52(d2, e2, a2, b2, c2, w[6], 8);			\
+		R51(c1, d1, e1, a1, b1, w[1], 12);			\
+		R52(c2, d2, e2, a2, b2, w[2], 13);			\
+		R51(b1, c1, d1, e1, a1, w[3], 13);			\
+		R52(b2, c2, d2, e2, a2, w[13], 6);			\
+		R51(a1, b1, c1, d1, e1, w[8], 14);			\
+		R52(a2, b2, c2, d2, e2, w[14], 5);			\
+		R51(e1, a1, b1, c1, d1, w[11], 11);			\
+		R52(e2, a2, b2, c2, d2, w[0], 15);			\
+		R51(d1, e1, a1, b1, c1, w[6], 8);			\
+		R52(d2, e2, a2, b2, c2, w[3], 13);			\
+		R51(c1, d1, e1, a1, b1, w[15], 5);			\
+		R52(c2, d2, e2, a2, b2, w[9], 11);			\
+		R51(b1, c1, d1, e1, a1, w[13], 6);			\
+		R52(b2, c2, d2, e2, a2, w[11], 11);			\
+									\
+		t = s[0];						\
+		s[0] = RMD_ADD(RMD_ADD(s[1], c1), d2);			\
+		s[1] = RMD_ADD(RMD_ADD(s[2], d1), e2);			\
+		s[2] = RMD_ADD(RMD_ADD(s[3], e1), a2);			\
+		s[3] = RMD_ADD(RMD_ADD(s[4], a1), b2);			\
+		s[4] = RMD_ADD(RMD_ADD(t, b1), c2);			\
+	} while (0)
+
+static const uint32_t ripemd160_init[5] = {
+	0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0,
+};
+
+#define RMD_ADD(x, y)	((x) + (y))
+#define RMD_ROTL(x, n)	ROTL32(x, n)
+#define RMD_K(k)	(k)
+#define RMD_F1(x, y, z)	((x) ^ (y) ^ (z))
+#define RMD_F2(x, y, z)	(((x) & (y)) | (~(x) & (z)))
+#define RMD_F3(x, y, z)	(((x) | ~(y)) ^ (z))
+#define RMD_F4(x, y, z)	(((x) & (z)) | ((y) & ~(z)))
+#define RMD_F5(x, y, z)	((x) ^ ((y) | ~(z)))
+
+/* One RIPEMD-160 block, both lines of the compression function */
+static INLINE void
+ripemd160_transform(uint32_t *s, const uint32_t *w)
+{
+	RIPEMD160_ROUNDS(uint32_t);
+}
+
+#undef RMD_ADD
+#undef RMD_ROTL
+#undef RMD_K
+#undef RMD_F1
+#undef RMD_F2
+#undef RMD_F3
+#undef RMD_F4
+#undef RMD_F5
+
+static INLINE uint32_t
+bswap32(uint32_t x)
+{
+	return (x >> 24) | ((x >> 8) & 0xff00) |
+		((x << 8) & 0xff0000) | (x << 24);
+}
+
+/* RIPEMD-160 of a SHA-256 digest given as state words */
+static INLINE void
+ripemd160_digest(unsigned char *out, const uint32_t *sha)
+{
+	uint32_t w[16], r[5];
+	int i;
+
+	/* The 32-byte message fits a single padded block */
+	for (i = 0; i < 8; i++)
+		w[i] = bswap32(sha[i]);
+	w[8] = 0x80;
+	for (i = 9; i < 16; i++)
+		w[i] = 0;
+	w[14] = 256;
+	memcpy(r, ripemd160_init, sizeof(r));
+	ripemd160_transform(r, w);
+
+	for (i = 0; i < 5; i++) {
+		out[(4 * i) + 0] = r[i];
+		out[(4 * i) + 1] = r[i] >> 8;
+		out[(4 * i) + 2] = r[i] >> 16;
+		out[(4 * i) + 3] = r[i] >> 24;
+	}
+}
+
+/*
+ * Common body of the fixed-length entry points.  len must leave room
+ * for the padding in the last block (len % 64 < 56).
+ */
+static INLINE void
+hash160_fixed(unsigned char *out, const unsigned char *in, const int len)
+{
+	SHA256_CTX sha;
+	unsigned char blk[64];
+	uint32_t st[8];
+	int i, off, rem;
+
+	SHA256_Init(&sha);
+	for (off = 0; (off + 64) <= len; off += 64)
+		SHA256_Transform(&sha, in + off);
+
+	/* Final block: tail bytes, 0x80 terminator and bit length */
+	rem = len - off;
+	memcpy(blk, in + off, rem);
+	blk[rem] = 0x80;
+	memset(blk + rem + 1, 0, 64 - rem - 1);
+	blk[62] = (len * 8) >> 8;
+	blk[63] = len * 8;
+	SHA256_Transform(&sha, blk);
+
+	for (i = 0; i < 8; i++)
+		st[i] = sha.h[i];
+	ripemd160_digest(out, st);
+}
+
+void
+vg_hash160_33(unsigned char *out, const unsigned char *in)
+{
+	hash160_fixed(out, in, 33);
+}
+
+void
+vg_hash160_37(unsigned char *out, const unsigned char *in)
+{
+	hash160_fixed(out, in, 37);
+}
+
+void
+vg_hash160_65(unsigned char *out, const unsigned char *in)
+{
+	hash160_fixed(out, in, 65);
+}
+
+void
+vg_hash160_69(unsigned char *out, const unsigned char *in)
+{
+	hash160_fixed(out, in, 69);
+}
+
+/* Select the entry point for a buffer length, NULL if there is none */
+vg_hash160_func_t
+vg_hash160_get_func(int len)
+{
+	switch (len) {
+	case 33: return vg_hash160_33;
+	case 37: return vg_hash160_37;
+	case 65: return vg_hash160_65;
+	case 69: return vg_hash160_69;
+	default: return NULL;
+	}
+}
+
+
+/*
+ * Batched hash160
+ *
+ * The search loop hands over whole arrays of serialized keys, and the
+ * SHA-256 stage runs several messages at once on the widest backend
+ * the CPU supports: 16 lanes of AVX-512, two interleaved SHA extension
+ * streams, or 8 lanes of AVX2.  OpenSSL's block function is the
+ * fallback.  The RIPEMD-160 stage likewise runs 16 or 8 lanes of
+ * AVX-512 or AVX2 over the SHA-256 states, falling back to the scalar
+ * transform above.  The backends are picked once by vg_hash_init().
+ */
+
+#define VG_HASH_LANES	16
+#define VG_HASH_BLKMAX	128
+
+typedef void (*sha256_batch_func_t)(uint32_t (*st)[8],
+				    const unsigned char *in, int stride,
+				    int len, int n);
+typedef void (*ripemd160_batch_func_t)(unsigned char *out,
+				       uint32_t (*st)[8], int n);
+
+static const uint32_t sha256_init[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+/*
+ * Copy a message into blk with SHA-256 padding, returning the number
+ * of 64-byte blocks.  len must not exceed VG_HASH_BLKMAX - 9.
+ */
+static INLINE int
+sha256_pad(unsigned char *blk, const unsigned char *in, int len)
+{
+	int nblk = ((len + 8) / 64) + 1;
+
+	memcpy(blk, in, len);
+	blk[len] = 0x80;
+	memset(blk + len + 1, 0, (nblk * 64) - len - 1);
+	blk[(nblk * 64) - 2] = (len * 8) >> 8;
+	blk[(nblk * 64) - 1] = len * 8;
+	return nblk;
+}
+
+static INLINE uint32_t
+load_be32(const unsigned char *p)
+{
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+		((uint32_t) p[2] << 8) | (uint32_t) p[3];
+}
+
+static void
+ripemd160_batch_scalar(unsigned char *out, uint32_t (*st)[8], int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		ripemd160_digest(out + (20 * i), st[i]);
+}
+
+static void
+sha256_batch_openssl(uint32_t (*st)[8], const unsigned char *in, int stride,
+		     int len, int n)
+{
+	SHA256_CTX sha;
+	unsigned char blk[VG_HASH_BLKMAX];
+	int i, j, b, nblk;
+
+	for (i = 0; i < n; i++) {
+		nblk = sha256_pad(blk, in + (i * stride), len);
+		SHA256_Init(&sha);
+		for (b = 0; b < nblk; b++)
+			SHA256_Transform(&sha, blk + (64 * b));
+		for (j = 0; j < 8; j++)
+			st[i][j] = sha.h[j];
+	}
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define VG_HASH_X86
+#include <immintrin.h>
+
+/*
+ * SHA extensions, two independent streams interleaved so that the
+ * latency of sha256rnds2 is hidden.
+ */
+
+#define SHANI_QROUND(s0, s1, m, r) do {					\
+		__m128i t_ = _mm_add_epi32(m,				\
+			_mm_loadu_si128((const __m128i *)		\
+					(sha256_k + (4 * (r)))));	\
+		s1 = _mm_sha256rnds2_epu32(s1, s0, t_);			\
+		t_ = _mm_shuffle_epi32(t_, 0x0e);			\
+		s0 = _mm_sha256rnds2_epu32(s0, s1, t_);			\
+	} while (0)
+
+/* Message words for rounds 4r..4r+3 from the previous four groups */
+#define SHANI_SCHED(m, r)						\
+	m[(r) & 3] = _mm_sha256msg2_epu32(				\
+		_mm_add_epi32(						\
+			_mm_sha256msg1_epu32(m[(r) & 3],		\
+					     m[((r) + 1) & 3]),		\
+			_mm_alignr_epi8(m[((r) + 3) & 3],		\
+					m[((r) + 2) & 3], 4)),		\
+		m[((r) + 3) & 3])
+
+#define SHANI_STEP(r) do {						\
+		if ((r) >= 4) {						\
+			SHANI_SCHED(ma, r);				\
+			SHANI_SCHED(mb, r);				\
+		}							\
+		SHANI_QROUND(s0a, s1a, ma[(r) & 3], r);			\
+		SHANI_QROUND(s0b, s1b, mb[(r) & 3], r);			\
+	} while (0)
+
+__attribute__((target("sha,sse4.1")))
+static void
+sha256_shani_x2(uint32_t (*st)[8], const unsigned char *blka,
+		const unsigned char *blkb, int nblk)
+{
+	const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+					    0x0405060700010203ULL);
+	__m128i s0a, s1a, s0b, s1b, t, u, sa0, sa1, sb0, sb1;
+	__m128i ma[4], mb[4];
+	int b, j;
+
+	/* ABEF / CDGH register layout */
+	t = _mm_loadu_si128((const __m128i *) &sha256_init[0]);
+	u = _mm_loadu_si128((const __m128i *) &sha256_init[4]);
+	t = _mm_shuffle_epi32(t, 0xb1);
+	u = _mm_shuffle_epi32(u, 0x1b);
+	s0a = s0b = _mm_alignr_epi8(t, u, 8);
+	s1a = s1b = _mm_blend_epi16(u, t, 0xf0);
+
+	for (b = 0; b < nblk; b++) {
+		sa0 = s0a; sa1 = s1a;
+		sb0 = s0b; sb1 = s1b;
+		for (j = 0; j < 4; j++) {
+			ma[j] = _mm_shuffle_epi8(
+				_mm_loadu_si128((const __m128i *)
+						(blka + (64 * b) + (16 * j))),
+				mask);
+			mb[j] = _mm_shuffle_epi8(
+				_mm_loadu_si128((const __m128i *)
+						(blkb + (64 * b) + (16 * j))),
+				mask);
+		}
+
+		SHANI_STEP(0); SHANI_STEP(1); SHANI_STEP(2); SHANI_STEP(3);
+		SHANI_STEP(4); SHANI_STEP(5); SHANI_STEP(6); SHANI_STEP(7);
+		SHANI_STEP(8); SHANI_STEP(9); SHANI_STEP(10); SHANI_STEP(11);
+		SHANI_STEP(12); SHANI_STEP(13); SHANI_STEP(14); SHANI_STEP(15);
+
+		s0a = _mm_add_epi32(s0a, sa0); s1a = _mm_add_epi32(s1a, sa1);
+		s0b = _mm_add_epi32(s0b, sb0); s1b = _mm_add_epi32(s1b, sb1);
+	}
+
+	/* Back to A..H order */
+	t = _mm_shuffle_epi32(s0a, 0x1b);
+	u = _mm_shuffle_epi32(s1a, 0xb1);
+	_mm_storeu_si128((__m128i *) &st[0][0], _mm_blend_epi16(t, u, 0xf0));
+	_mm_storeu_si128((__m128i *) &st[0][4], _mm_alignr_epi8(u, t, 8));
+	t = _mm_shuffle_epi32(s0b, 0x1b);
+	u = _mm_shuffle_epi32(s1b, 0xb1);
+	_mm_storeu_si128((__m128i *) &st[1][0], _mm_blend_epi16(t, u, 0xf0));
+	_mm_storeu_si128((__m128i *) &st[1][4], _mm_alignr_epi8(u, t, 8));
+}
+
+__attribute__((target("sha,sse4.1")))
+static void
+sha256_batch_shani(uint32_t (*st)[8], const unsigned char *in, int stride,
+		   int len, int n)
+{
+	unsigned char blk[2][VG_HASH_BLKMAX];
+	uint32_t tmp[2][8];
+	int i, nblk;
+
+	for (i = 0; i < n; i += 2) {
+		nblk = sha256_pad(blk[0], in + (i * stride), len);
+		if ((i + 1) < n) {
+			sha256_pad(blk[1], in + ((i + 1) * stride), len);
+			sha256_shani_x2(st + i, blk[0], blk[1], nblk);
+		} else {
+			sha256_shani_x2(tmp, blk[0], blk[0], nblk);
+			memcpy(st[i], tmp[0], sizeof(tmp[0]));
+		}
+	}
+}
+
+/*
+ * Lane-parallel SHA-256 over AVX2 and AVX-512 registers.  Message
+ * word j of every lane is gathered into one vector, and the round
+ * function is written once over the vector type's operations.
+ */
+
+#define SHA256_VROUNDS(V, ADD, XOR, AND, OR, ROR, SHR, SET1, CH, MAJ)	\
+	do {								\
+		V a_ = s[0], b_ = s[1], c_ = s[2], d_ = s[3];		\
+		V e_ = s[4], f_ = s[5], g_ = s[6], h_ = s[7];		\
+		V t1_, t2_;						\
+		int i_;							\
+		for (i_ = 0; i_ < 64; i_++) {				\
+			if (i_ >= 16) {					\
+				V x_ = w[(i_ + 14) & 15];		\
+				V y_ = w[(i_ + 1) & 15];		\
+				w[i_ & 15] = ADD(ADD(w[i_ & 15],	\
+					w[(i_ + 9) & 15]),		\
+					ADD(XOR(XOR(ROR(x_, 17),	\
+						    ROR(x_, 19)),	\
+						SHR(x_, 10)),		\
+					    XOR(XOR(ROR(y_, 7),		\
+						    ROR(y_, 18)),	\
+						SHR(y_, 3))));		\
+			}						\
+			t1_ = ADD(ADD(h_, XOR(XOR(ROR(e_, 6),		\
+						  ROR(e_, 11)),		\
+					      ROR(e_, 25))),		\
+				  ADD(ADD(CH(e_, f_, g_),		\
+					  SET1(sha256_k[i_])),		\
+				      w[i_ & 15]));			\
+			t2_ = ADD(XOR(XOR(ROR(a_, 2), ROR(a_, 13)),	\
+				      ROR(a_, 22)),			\
+				  MAJ(a_, b_, c_));			\
+			h_ = g_; g_ = f_; f_ = e_;			\
+			e_ = ADD(d_, t1_);				\
+			d_ = c_; c_ = b_; b_ = a_;			\
+			a_ = ADD(t1_, t2_);				\
+		}							\
+		s[0] = ADD(s[0], a_); s[1] = ADD(s[1], b_);		\
+		s[2] = ADD(s[2], c_); s[3] = ADD(s[3], d_);		\
+		s[4] = ADD(s[4], e_); s[5] = ADD(s[5], f_);		\
+		s[6] = ADD(s[6], g_); s[7] = ADD(s[7], h_);		\
+	} while (0)
+
+#define AVX2_ROR(x, n)							\
+	_mm256_or_si256(_mm256_srli_epi32(x, n),			\
+			_mm256_slli_epi32(x, 32 - (n)))
+#define AVX2_CH(x, y, z)						\
+	_mm256_xor_si256(z, _mm256_and_si256(x, _mm256_xor_si256(y, z)))
+#define AVX2_MAJ(x, y, z)						\
+	_mm256_or_si256(_mm256_and_si256(x, y),				\
+			_mm256_and_si256(z, _mm256_or_si256(x, y)))
+#define AVX2_SET1(k)	_mm256_set1_epi32((int) (k))
+
+__attribute__((target("avx2")))
+static void
+sha256_batch_avx2(uint32_t (*st)[8], const unsigned char *in, int stride,
+		  int len, int n)
+{
+	unsigned char blk[8][VG_HASH_BLKMAX];
+	uint32_t out[8][8];
+	__m256i s[8], w[16];
+	int i, j, l, b, nblk = 0;
+
+	for (i = 0; i < n; i += 8) {
+		for (l = 0; l < 8; l++)
+			nblk = sha256_pad(blk[l],
+					  in + ((((i + l) < n) ? (i + l) : i) *
+						stride),
+					  len);
+
+		for (j = 0; j < 8; j++)
+			s[j] = AVX2_SET1(sha256_init[j]);
+		for (b = 0; b < nblk; b++) {
+			for (j = 0; j < 16; j++)
+				w[j] = _mm256_setr_epi32(
+				    load_be32(blk[0] + (64 * b) + (4 * j)),
+				    load_be32(blk[1] + (64 * b) + (4 * j)),
+				    load_be32(blk[2] + (64 * b) + (4 * j)),
+				    load_be32(blk[3] + (64 * b) + (4 * j)),
+				    load_be32(blk[4] + (64 * b) + (4 * j)),
+				    load_be32(blk[5] + (64 * b) + (4 * j)),
+				    load_be32(blk[6] + (64 * b) + (4 * j)),
+				    load_be32(blk[7] + (64 * b) + (4 * j)));
+			SHA256_VROUNDS(__m256i, _mm256_add_epi32,
+				       _mm256_xor_si256, _mm256_and_si256,
+				       _mm256_or_si256, AVX2_ROR,
+				       _mm256_srli_epi32, AVX2_SET1,
+				       AVX2_CH, AVX2_MAJ);
+		}
+
+		for (j = 0; j < 8; j++)
+			_mm256_storeu_si256((__m256i *) out[j], s[j]);
+		for (l = 0; (l < 8) && ((i + l) < n); l++)
+			for (j = 0; j < 8; j++)
+				st[i + l][j] = out[j][l];
+	}
+}
+
+#define AVX512_CH(x, y, z)	_mm512_ternarylogic_epi32(x, y, z, 0xca)
+#define AVX512_MAJ(x, y, z)	_mm512_ternarylogic_epi32(x, y, z, 0xe8)
+#define AVX512_SET1(k)		_mm512_set1_epi32((int) (k))
+
+__attribute__((target("avx512f")))
+static void
+sha256_batch_avx512(uint32_t (*st)[8], const unsigned char *in, int stride,
+		    int len, int n)
+{
+	unsigned char blk[16][VG_HASH_BLKMAX];
+	uint32_t out[8][16];
+	__m512i s[8], w[16], idx;
+	int i, j, l, b, nblk = 0;
+
+	/* Lane l reads its words from blk[l] */
+	idx = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7,
+				8, 9, 10, 11, 12, 13, 14, 15);
+	idx = _mm512_mullo_epi32(idx, _mm512_set1_epi32(VG_HASH_BLKMAX));
+
+	for (i = 0; i < n; i += 16) {
+		for (l = 0; l < 16; l++)
+			nblk = sha256_pad(blk[l],
+					  in + ((((i + l) < n) ? (i + l) : i) *
+						stride),
+					  len);
+
+		for (j = 0; j < 8; j++)
+			s[j] = AVX512_SET1(sha256_init[j]);
+		for (b = 0; b < nblk; b++) {
+			for (j = 0; j < 16; j++) {
+				w[j] = _mm512_i32gather_epi32(
+					idx, blk[0] + (64 * b) + (4 * j), 1);
+				/* Byte swap each 32-bit word */
+				w[j] = _mm512_or_si512(
+				    _mm512_or_si512(
+					_mm512_slli_epi32(w[j], 24),
+					_mm512_srli_epi32(w[j], 24)),
+				    _mm512_or_si512(
+					_mm512_and_si512(
+					    _mm512_slli_epi32(w[j], 8),
+					    _mm512_set1_epi32(0x00ff0000)),
+					_mm512_and_si512(
+					    _mm512_srli_epi32(w[j], 8),
+					    _mm512_set1_epi32(0x0000ff00))));
+			}
+			SHA256_VROUNDS(__m512i, _mm512_add_epi32,
+				       _mm512_xor_si512, _mm512_and_si512,
+				       _mm512_or_si512, _mm512_ror_epi32,
+				       _mm512_srli_epi32, AVX512_SET1,
+				       AVX512_CH, AVX512_MAJ);
+		}
+
+		for (j = 0; j < 8; j++)
+			_mm512_storeu_si512((void *) out[j], s[j]);
+		for (l = 0; (l < 16) && ((i + l) < n); l++)
+			for (j = 0; j < 8; j++)
+				st[i + l][j] = out[j][l];
+	}
+}
+
+/*
+ * Lane-parallel RIPEMD-160 of SHA-256 states, one lane per message.
+ * Message words 8..15 are the constant padding of a 32-byte input.
+ */
+
+#define RMD_ADD(x, y)	_mm256_add_epi32(x, y)
+#define RMD_ROTL(x, n)							\
+	_mm256_or_si256(_mm256_slli_epi32(x, n),			\
+			_mm256_srli_epi32(x, 32 - (n)))
+#define RMD_K(k)	_mm256_set1_epi32((int) (k))
+#define RMD_F1(x, y, z)	_mm256_xor_si256(_mm256_xor_si256(x, y), z)
+#define RMD_F2(x, y, z)							\
+	_mm256_xor_si256(z, _mm256_and_si256(x, _mm256_xor_si256(y, z)))
+#define RMD_F3(x, y, z)							\
+	_mm256_xor_si256(_mm256_or_si256(x, _mm256_xor_si256(y, ones)), z)
+#define RMD_F4(x, y, z)							\
+	_mm256_or_si256(_mm256_and_si256(x, z), _mm256_andnot_si256(z, y))
+#define RMD_F5(x, y, z)							\
+	_mm256_xor_si256(x, _mm256_or_si256(y, _mm256_xor_si256(z, ones)))
+
+__attribute__((target("avx2")))
+static void
+ripemd160_batch_avx2(unsigned char *out, uint32_t (*st)[8], int n)
+{
+	const __m256i bswap = _mm256_setr_epi8(
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	const __m256i ones = _mm256_set1_epi32(-1);
+	uint32_t res[5][8];
+	__m256i s[5], w[16], idx;
+	int i, j, l;
+
+	for (i = 0; i < n; i += 8) {
+		/* Lanes past the end repeat the first message */
+		idx = _mm256_setr_epi32(
+			0, ((i + 1) < n) ? 8 : 0, ((i + 2) < n) ? 16 : 0,
+			((i + 3) < n) ? 24 : 0, ((i + 4) < n) ? 32 : 0,
+			((i + 5) < n) ? 40 : 0, ((i + 6) < n) ? 48 : 0,
+			((i + 7) < n) ? 56 : 0);
+		for (j = 0; j < 8; j++)
+			w[j] = _mm256_shuffle_epi8(
+				_mm256_i32gather_epi32((const int *) &st[i][j],
+						       idx, 4),
+				bswap);
+		w[8] = _mm256_set1_epi32(0x80);
+		for (j = 9; j < 16; j++)
+			w[j] = _mm256_setzero_si256();
+		w[14] = _mm256_set1_epi32(256);
+		for (j = 0; j < 5; j++)
+			s[j] = _mm256_set1_epi32((int) ripemd160_init[j]);
+
+		RIPEMD160_ROUNDS(__m256i);
+
+		for (j = 0; j < 5; j++)
+			_mm256_storeu_si256((__m256i *) res[j], s[j]);
+		for (l = 0; (l < 8) && ((i + l) < n); l++)
+			for (j = 0; j < 5; j++)
+				memcpy(out + (20 * (i + l)) + (4 * j),
+				       &res[j][l], 4);
+	}
+}
+
+#undef RMD_ADD
+#undef RMD_ROTL
+#undef RMD_K
+#undef RMD_F1
+#undef RMD_F2
+#undef RMD_F3
+#undef RMD_F4
+#undef RMD_F5
+
+#define RMD_ADD(x, y)	_mm512_add_epi32(x, y)
+#define RMD_ROTL(x, n)	_mm512_rol_epi32(x, n)
+#define RMD_K(k)	_mm512_set1_epi32((int) (k))
+#define RMD_F1(x, y, z)	_mm512_ternarylogic_epi32(x, y, z, 0x96)
+#define RMD_F2(x, y, z)	_mm512_ternarylogic_epi32(x, y, z, 0xca)
+#define RMD_F3(x, y, z)	_mm512_ternarylogic_epi32(x, y, z, 0x59)
+#define RMD_F4(x, y, z)	_mm512_ternarylogic_epi32(x, y, z, 0xe4)
+#define RMD_F5(x, y, z)	_mm512_ternarylogic_epi32(x, y, z, 0x2d)
+
+__attribute__((target("avx512f,avx512bw")))
+static void
+ripemd160_batch_avx512(unsigned char *out, uint32_t (*st)[8], int n)
+{
+	const __m512i bswap = _mm512_set4_epi32(0x0c0d0e0f, 0x08090a0b,
+						0x04050607, 0x00010203);
+	uint32_t res[5][16];
+	__m512i s[5], w[16], idx;
+	__mmask16 live;
+	int i, j, l;
+
+	/* Lane l reads word j of st[i + l] */
+	idx = _mm512_setr_epi32(0, 8, 16, 24, 32, 40, 48, 56,
+				64, 72, 80, 88, 96, 104, 112, 120);
+	for (i = 0; i < n; i += 16) {
+		/* Lanes past the end repeat the first message */
+		live = (__mmask16) (((n - i) >= 16) ?
+				    0xffff : ((1U << (n - i)) - 1));
+		for (j = 0; j < 8; j++)
+			w[j] = _mm512_shuffle_epi8(
+				_mm512_mask_i32gather_epi32(
+					_mm512_set1_epi32((int) st[i][j]),
+					live, idx, &st[i][j], 4),
+				bswap);
+		w[8] = _mm512_set1_epi32(0x80);
+		for (j = 9; j < 16; j++)
+			w[j] = _mm512_setzero_si512();
+		w[14] = _mm512_set1_epi32(256);
+		for (j = 0; j < 5; j++)
+			s[j] = _mm512_set1_epi32((int) ripemd160_init[j]);
+
+		RIPEMD160_ROUNDS(__m512i);
+
+		for (j = 0; j < 5; j++)
+			_mm512_storeu_si512((void *) res[j], s[j]);
+		for (l = 0; (l < 16) && ((i + l) < n); l++)
+			for (j = 0; j < 5; j++)
+				memcpy(out + (20 * (i + l)) + (4 * j),
+				       &res[j][l], 4);
+	}
+}
+
+#undef RMD_ADD
+#undef RMD_ROTL
+#undef RMD_K
+#undef RMD_F1
+#undef RMD_F2
+#undef RMD_F3
+#undef RMD_F4
+#undef RMD_F5
+#endif /* defined(__GNUC__) && defined(__x86_64__) */
+
+static const struct {
+	const char		*name;
+	unsigned int		features;
+	sha256_batch_func_t	func;
+} vg_sha256_backends[] = {
+#if defined(VG_HASH_X86)
+	{ "avx512", VG_CPU_AVX512F, sha256_batch_avx512 },
+	{ "sha-ni", VG_CPU_SHA | VG_CPU_SSE41, sha256_batch_shani },
+	{ "avx2", VG_CPU_AVX2, sha256_batch_avx2 },
+#endif
+	{ "openssl", 0, sha256_batch_openssl },
+};
+
+static const struct {
+	const char		*name;
+	unsigned int		features;
+	ripemd160_batch_func_t	func;
+} vg_ripemd160_backends[] = {
+#if defined(VG_HASH_X86)
+	{ "avx512", VG_CPU_AVX512F | VG_CPU_AVX512BW, ripemd160_batch_avx512 },
+	{ "avx2", VG_CPU_AVX2, ripemd160_batch_avx2 },
+#endif
+	{ "scalar", 0, ripemd160_batch_scalar },
+};
+
+static sha256_batch_func_t vg_sha256_batch = sha256_batch_openssl;
+static const char *vg_sha256_name = "openssl";
+static ripemd160_batch_func_t vg_ripemd160_batch = ripemd160_batch_scalar;
+static const char *vg_ripemd160_name = "scalar";
+
+/*
+ * Select the SHA-256 backend, by name if one is given, otherwise the
+ * first one in order of preference that the CPU supports, and the
+ * widest supported RIPEMD-160 backend.  Returns 0 if the named
+ * backend is unknown or unsupported.
+ */
+int
+vg_hash_init(const char *name)
+{
+	unsigned int features = vg_cpu_features();
+	int i;
+
+	for (i = 0;
+	     i < (int) (sizeof(vg_sha256_backends) /
+			sizeof(vg_sha256_backends[0]));
+	     i++) {
+		if (name && strcmp(name, vg_sha256_backends[i].name))
+			continue;
+		if ((features & vg_sha256_backends[i].features) !=
+		    vg_sha256_backends[i].features)
+			continue;
+		vg_sha256_batch = vg_sha256_backends[i].func;
+		vg_sha256_name = vg_sha256_backends[i].name;
+		break;
+	}
+	if (i == (int) (sizeof(vg_sha256_backends) /
+			sizeof(vg_sha256_backends[0])))
+		return 0;
+
+	for (i = 0; ; i++) {
+		if ((features & vg_ripemd160_backends[i].features) ==
+		    vg_ripemd160_backends[i].features)
+			break;
+	}
+	vg_ripemd160_batch = vg_ripemd160_backends[i].func;
+	vg_ripemd160_name = vg_ripemd160_backends[i].name;
+	return 1;
+}
+
+const char *
+vg_hash_backend_name(void)
+{
+	return vg_sha256_name;
+}
+
+const char *
+vg_hash_ripemd160_backend_name(void)
+{
+	return vg_ripemd160_name;
+}
+
+/*
+ * hash160 of n messages of len bytes, stride bytes apart, with the
+ * 20-byte digests written contiguously to out.
+ */
+void
+vg_hash160_batch(unsigned char *out, const unsigned char *in, int stride,
+		 int len, int n)
+{
+	uint32_t st[VG_HASH_LANES][8];
+	unsigned long long t0, t1;
+	int i, m;
+
+	if (vg_stage_ticks) {
+		/* Benchmarking: split the time between the two hashes */
+		for (i = 0; i < n; i += VG_HASH_LANES) {
+			m = n - i;
+			if (m > VG_HASH_LANES)
+				m = VG_HASH_LANES;
+			t0 = vg_timestamp();
+			vg_sha256_batch(st, in + (i * stride), stride, len, m);
+			t1 = vg_timestamp();
+			vg_ripemd160_batch(out + (20 * i), st, m);
+			vg_stage_ticks[VG_STAGE_SHA256] += t1 - t0;
+			vg_stage_ticks[VG_STAGE_RIPEMD160] +=
+				vg_timestamp() - t1;
+		}
+		return;
+	}
+
+	for (i = 0; i < n; i += VG_HASH_LANES) {
+		m = n - i;
+		if (m > VG_HASH_LANES)
+			m = VG_HASH_LANES;
+		vg_sha256_batch(st, in + (i * stride), stride, len, m);
+		vg_ripemd160_batch(out + (20 * i), st, m);
+	}
+}
+
+/*
+ * Four-byte check codes, the leading bytes of SHA256(SHA256(m)), of
+ * n messages of len bytes, stride bytes apart, written contiguously
+ * to out.  The inner digests go back through the batched SHA-256 as
+ * 32-byte messages.
+ */
+void
+vg_checksum_batch(unsigned char *out, const unsigned char *in, int stride,
+		  int len, int n)
+{
+	uint32_t st[VG_HASH_LANES][8];
+	unsigned char dig[VG_HASH_LANES * 32];
+	int i, j, l, m;
+
+	for (i = 0; i < n; i += VG_HASH_LANES) {
+		m = n - i;
+		if (m > VG_HASH_LANES)
+			m = VG_HASH_LANES;
+		vg_sha256_batch(st, in + (i * stride), stride, len, m);
+		for (l = 0; l < m; l++)
+			for (j = 0; j < 8; j++) {
+				dig[(32 * l) + (4 * j)] = st[l][j] >> 24;
+				dig[(32 * l) + (4 * j) + 1] = st[l][j] >> 16;
+				dig[(32 * l) + (4 * j) + 2] = st[l][j] >> 8;
+				dig[(32 * l) + (4 * j) + 3] = st[l][j];
+			}
+		vg_sha256_batch(st, dig, 32, 32, m);
+		for (l = 0; l < m; l++) {
+			out[(4 * (i + l))] = st[l][0] >> 24;
+			out[(4 * (i + l)) + 1] = st[l][0] >> 16;
+			out[(4 * (i + l)) + 2] = st[l][0] >> 8;
+			out[(4 * (i + l)) + 3] = st[l][0];
+		}
+	}
+}
@@ -0,0 +1,44 @@
+/*
+ * Vanitygen, vanity bitcoin address generator
+ * Copyright (C) 2026 The Vanitygen contributors
+ *
+ * Vanitygen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Vanitygen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Vanitygen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined (__VG_HASH_H__)
+#define __VG_HASH_H__
+
+/*
+ * Fixed-length hash160 routines, out receives the 20-byte
+ * RIPEMD160(SHA256(in)) digest.
+ */
+typedef void (*vg_hash160_func_t)(unsigned char *out, const unsigned char *in);
+
+extern void vg_hash160_33(unsigned char *out, const unsigned char *in);
+extern void vg_hash160_37(unsigned char *out, const unsigned char *in);
+extern void vg_hash160_65(unsigned char *out, const unsigned char *in);
+extern void vg_hash160_69(unsigned char *out, const unsigned char *in);
+
+extern vg_hash160_func_t vg_hash160_get_func(int len);
+
+/* Batched hash160, on the backends chosen by vg_hash_init() */
+extern int vg_hash_init(const char *name);
+extern const char *vg_hash_backend_name(void);
+extern const char *vg_hash_ripemd160_backend_name(void);
+extern void vg_hash160_batch(unsigned char *out, const unsigned char *in,
+			     int stride, int len, int n);
+extern void vg_checksum_batch(unsigned char *out, const unsigned char *in,
+			      int stride, int len, int n);
+
+#endif /* !defined (__VG_HASH_H__) */
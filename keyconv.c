@@ -108,6 +108,7 @@ main(int argc, char **argv)
 		dumpbn(EC_KEY_get0_private_key(pkey));
 		vg_encode_address(EC_KEY_get0_public_key(pkey),
 				  EC_KEY_get0_group(pkey),
+				  EC_KEY_get_conv_form(pkey),
 				  addrtype, ecprot);
 		printf("Address: %s\n", ecprot);
 		vg_encode_privkey(pkey, privtype, ecprot);
@@ -208,6 +209,10 @@ main(int argc, char **argv)
 	}
 
 	else if (pass_in) {
+		if (EC_KEY_get_conv_form(pkey) == POINT_CONVERSION_COMPRESSED)
+			fprintf(stderr,
+				"WARNING: Protkey does not record the "
+				"compressed public key flag\n");
 		res = vg_protect_encode_privkey(ecprot, pkey, privtype,
 						parameter_group, pass_in);
 
@@ -219,6 +224,7 @@ main(int argc, char **argv)
 
 		vg_encode_address(EC_KEY_get0_public_key(pkey),
 				  EC_KEY_get0_group(pkey),
+				  EC_KEY_get_conv_form(pkey),
 				  addrtype, pwbuf);
 		printf("Address: %s\n", pwbuf);
 		printf("Protkey: %s\n", ecprot);
@@ -227,6 +233,7 @@ main(int argc, char **argv)
 	else {
 		vg_encode_address(EC_KEY_get0_public_key(pkey),
 				  EC_KEY_get0_group(pkey),
+				  EC_KEY_get_conv_form(pkey),
 				  addrtype, ecprot);
 		printf("Address: %s\n", ecprot);
 		vg_encode_privkey(pkey, privtype, ecprot);
@@ -1437,9 +1437,8 @@ vg_ocl_gethash_check(vg_ocl_context_t *vocp, int slot)
 {
 	vg_exec_context_t *vxcp = &vocp->base;
 	vg_context_t *vcp = vocp->base.vxc_vc;
-	vg_test_func_t test_func = vcp->vc_test;
 	unsigned char *ocl_hashes_out;
-	int i, res = 0, round;
+	int res, round, base_delta;
 
 	ocl_hashes_out = (unsigned char *)
 		vg_ocl_map_arg_buffer(vocp, slot, 0, 0);
@@ -1453,15 +1452,10 @@ vg_ocl_gethash_check(vg_ocl_context_t *vocp, int slot)
 
 	round = vocp->voc_ocl_cols * vocp->voc_ocl_rows;
 
-	for (i = 0; i < round; i++, vxcp->vxc_delta++) {
-		memcpy(&vxcp->vxc_binres[1],
-		       ocl_hashes_out + (20*i),
-		       20);
-
-		res = test_func(vxcp);
-		if (res)
-			break;
-	}
+	base_delta = vxcp->vxc_delta;
+	res = vcp->vc_test_batch(vxcp, ocl_hashes_out, round, base_delta);
+	if (!res)
+		vxcp->vxc_delta = base_delta + round;
 
 	vg_ocl_unmap_arg_buffer(vocp, slot, 0, ocl_hashes_out);
 	return res;
@@ -1919,9 +1913,6 @@ vg_opencl_loop(vg_exec_context_t *arg)
 
 	int slot, nslots;
 	int slot_busy = 0, slot_done = 0, halt = 0;
-	int c = 0, output_interval = 1000;
-
-	struct timeval tvstart;
 
 	pkey = vxcp->vxc_key;
 	pgroup = EC_KEY_get0_group(pkey);
@@ -2007,9 +1998,16 @@ vg_opencl_loop(vg_exec_context_t *arg)
 			   vg_opencl_thread, vocp))
 		goto enomem;
 
-	gettimeofday(&tvstart, NULL);
+	/* Pick up the current pattern store snapshot */
+	vg_exec_context_yield(vxcp);
 
 l_rekey:
+	/*
+	 * Patterns may be removed by other threads at any time, so
+	 * note the generation before the targets are written out.
+	 */
+	pattern_generation = vcp->vc_pattern_generation;
+
 	if (vocp->voc_rekey_func) {
 		switch (vocp->voc_rekey_func(vocp)) {
 		case 1:
@@ -2021,12 +2019,8 @@ l_rekey:
 		}
 	}
 
-	vg_exec_context_upgrade_lock(vxcp);
-
-	pattern_generation = vcp->vc_pattern_generation;
-
 	/* Generate a new random private key */
-	EC_KEY_generate_key(pkey);
+	vg_exec_context_generate_key(vxcp);
 	npoints = 0;
 
 	/* Determine rekey interval */
@@ -2041,8 +2035,6 @@ l_rekey:
 
 	EC_POINT_copy(ppbase[0], EC_KEY_get0_public_key(pkey));
 
-	vg_exec_context_downgrade_lock(vxcp);
-
 	if (vcp->vc_pubkey_base) {
 		EC_POINT_add(pgroup,
 			     ppbase[0],
@@ -2108,12 +2100,7 @@ l_rekey:
 				break;
 			}
 
-			c += round;
-			if (!halt && (c >= output_interval)) {
-				output_interval =
-					vg_output_timing(vcp, c, &tvstart);
-				c = 0;
-			}
+			vg_exec_context_count(vxcp, round);
 			vg_exec_context_yield(vxcp);
 
 			/* If the patterns changed, reload it to the GPU */
@@ -2244,7 +2231,6 @@ l_rekey:
 	vg_ocl_free_args(vocp);
 	vocp->voc_halt = 0;
 	vocp->voc_ocl_slot = -1;
-	vg_context_thread_exit(vcp);
 	return NULL;
 }
 
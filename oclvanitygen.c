@@ -44,7 +44,8 @@ usage(const char *name)
 "address and associated private key.  The private key may be stored in a safe\n"
 "location or imported into a bitcoin client to spend any balance received on\n"
 "the address.\n"
-"By default, <pattern> is interpreted as an exact prefix.\n"
+"By default, <pattern> is interpreted as an exact prefix, in which a\n"
+"[...] set of characters matches any one of them.\n"
 "By default, if no device is specified, and the system has exactly one OpenCL\n"
 "device, it will be selected automatically, otherwise if the system has\n"
 "multiple OpenCL devices and no device is specified, an error will be\n"
@@ -328,6 +329,8 @@ main(int argc, char **argv)
 	} else {
 		vcp = vg_prefix_context_new(addrtype, privtype,
 					    caseinsensitive);
+		/* The device matches prefixes as ranges only */
+		vg_prefix_context_set_expand_classes(vcp, 1);
 	}
 
 	vcp->vc_verbose = verbose;
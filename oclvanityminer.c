@@ -923,6 +923,8 @@ main(int argc, char **argv)
 	curl_easy_init();
 
 	vcp = vg_prefix_context_new(0, 128, 0);
+	/* The device matches prefixes as ranges only */
+	vg_prefix_context_set_expand_classes(vcp, 1);
 
 	vcp->vc_verbose = verbose;
 
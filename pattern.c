@@ -25,6 +25,7 @@
 
 #include <openssl/sha.h>
 #include <openssl/ripemd.h>
+#include <openssl/rand.h>
 #include <openssl/bn.h>
 #include <openssl/ec.h>
 #include <openssl/obj_mac.h>
@@ -33,6 +34,8 @@
 
 #include "pattern.h"
 #include "util.h"
+#include "hash.h"
+#include "secp256k1.h"
 #include "avl.h"
 
 
@@ -142,9 +145,162 @@ vg_exec_context_downgrade_lock(vg_exec_context_t *vxcp)
 	pthread_mutex_unlock(&vg_thread_lock);
 }
 
+
+/*
+ * Pattern store snapshots
+ *
+ * Worker threads test candidates against an immutable snapshot of
+ * the pattern store, and only pick up a newer one at batch boundaries
+ * in vg_exec_context_yield().  The store itself is changed under
+ * vg_pattern_lock, after which a new snapshot is published under a
+ * new epoch.  The snapshot it replaces is retired with that epoch,
+ * and freed once every thread has picked up the new one.
+ */
+
+static pthread_mutex_t vg_pattern_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define VG_NUMA_MAX 8
+
+typedef void (*vg_snapshot_free_func_t)(vg_snapshot_t *);
+typedef vg_snapshot_t *(*vg_snapshot_clone_func_t)(vg_snapshot_t *);
+
+struct _vg_snapshot_s {
+	vg_snapshot_t			*vs_next;
+	unsigned long			vs_epoch;
+	vg_snapshot_free_func_t		vs_free;
+	vg_snapshot_clone_func_t	vs_clone;
+	vg_snapshot_t			*vs_replica[VG_NUMA_MAX];
+};
+
+static void
+vg_snapshot_init(vg_snapshot_t *vsp, vg_snapshot_free_func_t freefunc,
+		 vg_snapshot_clone_func_t clonefunc)
+{
+	memset(vsp, 0, sizeof(*vsp));
+	vsp->vs_free = freefunc;
+	vsp->vs_clone = clonefunc;
+}
+
+static void
+vg_snapshot_free(vg_snapshot_t *vsp)
+{
+	int i;
+
+	for (i = 0; i < VG_NUMA_MAX; i++) {
+		if (vsp->vs_replica[i])
+			vsp->vs_replica[i]->vs_free(vsp->vs_replica[i]);
+	}
+	vsp->vs_free(vsp);
+}
+
+/*
+ * Point vxcp at the current snapshot, or at its copy for the thread's
+ * NUMA node, making the copy if needed.  The copy is made by a thread
+ * pinned to the node, so first-touch placement puts it in the node's
+ * local memory.
+ *
+ * Must be called with vg_thread_lock held, and vxcp on vc_threads.
+ * The lock is dropped while copying: vxc_epoch keeps its old value
+ * until the copy is installed, so the snapshot cannot be freed in the
+ * meantime.  If another thread on the node installed a copy first,
+ * ours is discarded.
+ */
+static void
+vg_exec_context_snapshot(vg_exec_context_t *vxcp)
+{
+	vg_context_t *vcp = vxcp->vxc_vc;
+	vg_snapshot_t *vsp, *copyp;
+	unsigned long epoch;
+	int node = vxcp->vxc_numa_node;
+
+	vsp = vcp->vc_snapshot;
+	epoch = vcp->vc_epoch;
+	if (vsp && (node >= 0) && (node < VG_NUMA_MAX) && vsp->vs_clone) {
+		if (!vsp->vs_replica[node]) {
+			pthread_mutex_unlock(&vg_thread_lock);
+			copyp = vsp->vs_clone(vsp);
+			pthread_mutex_lock(&vg_thread_lock);
+			if (copyp && vsp->vs_replica[node])
+				copyp->vs_free(copyp);
+			else if (copyp)
+				vsp->vs_replica[node] = copyp;
+		}
+		if (vsp->vs_replica[node])
+			vsp = vsp->vs_replica[node];
+	}
+	vxcp->vxc_snapshot = vsp;
+	vxcp->vxc_epoch = epoch;
+}
+
+/* Must be called with vg_pattern_lock held */
+static void
+vg_context_publish(vg_context_t *vcp)
+{
+	vg_exec_context_t *tp;
+	vg_snapshot_t *vsp, *deadp, **pprev;
+	unsigned long oldest;
+
+	vsp = vcp->vc_build_snapshot(vcp);
+	if (!vsp) {
+		/*
+		 * Matches are always confirmed against the store
+		 * itself, so a stale snapshot only costs rechecks.
+		 */
+		fprintf(stderr, "WARNING: could not publish patterns\n");
+		return;
+	}
+
+	pthread_mutex_lock(&vg_thread_lock);
+	vg_store_epoch(&vcp->vc_epoch, vcp->vc_epoch + 1);
+	if (vcp->vc_snapshot) {
+		vcp->vc_snapshot->vs_epoch = vcp->vc_epoch;
+		vcp->vc_snapshot->vs_next = vcp->vc_retired;
+		vcp->vc_retired = vcp->vc_snapshot;
+	}
+	vcp->vc_snapshot = vsp;
+
+	/* Detach the retired snapshots no thread can still be using */
+	oldest = vcp->vc_epoch;
+	for (tp = vcp->vc_threads; tp != NULL; tp = tp->vxc_next) {
+		if (tp->vxc_epoch < oldest)
+			oldest = tp->vxc_epoch;
+	}
+	for (pprev = &vcp->vc_retired;
+	     (*pprev != NULL) && ((*pprev)->vs_epoch > oldest);
+	     pprev = &(*pprev)->vs_next);
+	deadp = *pprev;
+	*pprev = NULL;
+	pthread_mutex_unlock(&vg_thread_lock);
+
+	while (deadp) {
+		vsp = deadp;
+		deadp = vsp->vs_next;
+		vg_snapshot_free(vsp);
+	}
+}
+
+static void
+vg_context_free_snapshots(vg_context_t *vcp)
+{
+	vg_snapshot_t *vsp;
+
+	if (vcp->vc_snapshot) {
+		vcp->vc_snapshot->vs_next = vcp->vc_retired;
+		vcp->vc_retired = vcp->vc_snapshot;
+		vcp->vc_snapshot = NULL;
+	}
+	while (vcp->vc_retired) {
+		vsp = vcp->vc_retired;
+		vcp->vc_retired = vsp->vs_next;
+		vg_snapshot_free(vsp);
+	}
+}
+
 int
 vg_exec_context_init(vg_context_t *vcp, vg_exec_context_t *vxcp)
 {
+	int res;
+
 	pthread_mutex_lock(&vg_thread_lock);
 
 	memset(vxcp, 0, sizeof(*vxcp));
@@ -162,14 +318,31 @@ vg_exec_context_init(vg_context_t *vcp, vg_exec_context_t *vxcp)
 	assert(vxcp->vxc_bnctx);
 	vxcp->vxc_key = vg_exec_context_new_key();
 	assert(vxcp->vxc_key);
-	EC_KEY_precompute_mult(vxcp->vxc_key, vxcp->vxc_bnctx);
+
+	/* The first context sets up the shared key generation table */
+	res = vg_ecmult_gen_init(vcp->vc_gen_table_file);
+	assert(res);
+
+	/*
+	 * Seed the context's own key generator while holding the lock,
+	 * OpenSSL's RNG is not safe to call from several threads.
+	 */
+	res = RAND_bytes(vxcp->vxc_rng_key, sizeof(vxcp->vxc_rng_key));
+	assert(res == 1);
+	vxcp->vxc_rng_count = 0;
+	vxcp->vxc_unit = VG_UNIT_NONE;
 
 	vxcp->vxc_lockmode = 0;
 	vxcp->vxc_stop = 0;
 
+	vxcp->vxc_numa_node = -1;
+	if (vcp->vc_numa_replicas)
+		vxcp->vxc_numa_node = vg_numa_node_self();
+
 	vxcp->vxc_next = vcp->vc_threads;
 	vcp->vc_threads = vxcp;
 	__vg_exec_context_yield(vxcp);
+	vg_exec_context_snapshot(vxcp);
 	pthread_mutex_unlock(&vg_thread_lock);
 	return 1;
 }
@@ -192,6 +365,7 @@ vg_exec_context_del(vg_exec_context_t *vxcp)
 
 	assert(tp == vxcp);
 	*pprev = tp->vxc_next;
+	vxcp->vxc_vc->vc_timing_exited += vxcp->vxc_work;
 
 	if (tp->vxc_stop)
 		pthread_cond_signal(&vg_thread_upcond);
@@ -219,20 +393,256 @@ vg_exec_context_yield(vg_exec_context_t *vxcp)
 	}
 
 	assert(vxcp->vxc_lockmode == 1);
+
+	/* Pick up a pattern store snapshot published since the last batch */
+	if (vxcp->vxc_epoch != vg_load_epoch(&vxcp->vxc_vc->vc_epoch)) {
+		pthread_mutex_lock(&vg_thread_lock);
+		vg_exec_context_snapshot(vxcp);
+		pthread_mutex_unlock(&vg_thread_lock);
+	}
 }
 
+/* Cube root of unity mod n, lambda (x, y) = (beta x, y) */
+static const char *vg_secp256k1_lambda =
+	"5363AD4CC05C30E0A5261C028812645A122E22EA20816678DF02967C1B23BD72";
+
 void
 vg_exec_context_consolidate_key(vg_exec_context_t *vxcp)
 {
-	if (vxcp->vxc_delta) {
-		BN_clear(&vxcp->vxc_bntmp);
+	BIGNUM *bnorder, *bnlambda, *bnkey;
+	int i;
+
+	/* Encoding of the public key that was hashed */
+	EC_KEY_set_conv_form(vxcp->vxc_key, vxcp->vxc_compressed ?
+			     POINT_CONVERSION_COMPRESSED :
+			     POINT_CONVERSION_UNCOMPRESSED);
+
+	if (!vxcp->vxc_delta && !vxcp->vxc_variant)
+		return;
+
+	BN_CTX_start(vxcp->vxc_bnctx);
+	bnorder = BN_CTX_get(vxcp->vxc_bnctx);
+	EC_GROUP_get_order(EC_KEY_get0_group(vxcp->vxc_key),
+			   bnorder, vxcp->vxc_bnctx);
+
+	BN_clear(&vxcp->vxc_bntmp);
+	if (vxcp->vxc_delta >= 0) {
 		BN_set_word(&vxcp->vxc_bntmp, vxcp->vxc_delta);
 		BN_add(&vxcp->vxc_bntmp2,
 		       EC_KEY_get0_private_key(vxcp->vxc_key),
 		       &vxcp->vxc_bntmp);
-		vg_set_privkey(&vxcp->vxc_bntmp2, vxcp->vxc_key);
-		vxcp->vxc_delta = 0;
+	} else {
+		/* Symmetric stepping visits keys below the base */
+		BN_set_word(&vxcp->vxc_bntmp, -vxcp->vxc_delta);
+		BN_sub(&vxcp->vxc_bntmp2,
+		       EC_KEY_get0_private_key(vxcp->vxc_key),
+		       &vxcp->vxc_bntmp);
+	}
+
+	/* Wrap around the group order in either direction */
+	BN_nnmod(&vxcp->vxc_bntmp, &vxcp->vxc_bntmp2, bnorder,
+		 vxcp->vxc_bnctx);
+	bnkey = &vxcp->vxc_bntmp;
+
+	/*
+	 * The matching point may be a negation and/or endomorphism
+	 * image of the stepped point.  Variant v is
+	 * (-1)^(v & 1) * lambda^(v >> 1) times the stepped key.
+	 */
+	if (vxcp->vxc_variant >> 1) {
+		bnlambda = BN_CTX_get(vxcp->vxc_bnctx);
+		BN_hex2bn(&bnlambda, vg_secp256k1_lambda);
+		for (i = 0; i < (vxcp->vxc_variant >> 1); i++)
+			BN_mod_mul(bnkey, bnkey, bnlambda, bnorder,
+				   vxcp->vxc_bnctx);
+	}
+	if (vxcp->vxc_variant & 1) {
+		BN_sub(&vxcp->vxc_bntmp2, bnorder, bnkey);
+		bnkey = &vxcp->vxc_bntmp2;
+	}
+
+	vg_ecmult_gen_key(vxcp->vxc_key, bnkey, vxcp->vxc_bnctx);
+	assert(EC_KEY_check_key(vxcp->vxc_key));
+	BN_CTX_end(vxcp->vxc_bnctx);
+	vxcp->vxc_delta = 0;
+	vxcp->vxc_variant = 0;
+}
+
+/*
+ * Per-context random bytes, SHA-256 in counter mode under the key
+ * seeded by vg_exec_context_init().  The key is replaced after each
+ * call so earlier output can not be recovered from the state.  Only
+ * touches the context, so it needs no locking.
+ */
+static void
+vg_exec_context_rng_bytes(vg_exec_context_t *vxcp, unsigned char *out,
+			  size_t len)
+{
+	SHA256_CTX sha;
+	unsigned char blk[32], ctr[9];
+	size_t n;
+	int i;
+
+	for (; len; len -= n, out += n) {
+		ctr[0] = 0;
+		for (i = 0; i < 8; i++)
+			ctr[i + 1] = vxcp->vxc_rng_count >> (8 * i);
+		vxcp->vxc_rng_count++;
+		SHA256_Init(&sha);
+		SHA256_Update(&sha, vxcp->vxc_rng_key,
+			      sizeof(vxcp->vxc_rng_key));
+		SHA256_Update(&sha, ctr, sizeof(ctr));
+		SHA256_Final(blk, &sha);
+		n = (len < sizeof(blk)) ? len : sizeof(blk);
+		memcpy(out, blk, n);
 	}
+
+	ctr[0] = 1;
+	SHA256_Init(&sha);
+	SHA256_Update(&sha, vxcp->vxc_rng_key, sizeof(vxcp->vxc_rng_key));
+	SHA256_Update(&sha, ctr, sizeof(ctr));
+	SHA256_Final(vxcp->vxc_rng_key, &sha);
+	OPENSSL_cleanse(blk, sizeof(blk));
+	OPENSSL_cleanse(&sha, sizeof(sha));
+}
+
+/*
+ * With a master seed, the generator is rekeyed for each run with
+ * SHA-256(seed, worker, unit, run), so the key of any run can be
+ * derived again from those values alone.  Workers sharing a seed
+ * search disjoint keys as long as their indexes differ, and a
+ * found key does not reveal the seed or the other keys.
+ */
+static void
+vg_exec_context_seed_run(vg_exec_context_t *vxcp)
+{
+	vg_context_t *vcp = vxcp->vxc_vc;
+	unsigned long long ids[3];
+	unsigned char buf[24];
+	SHA256_CTX sha;
+	int i, j;
+
+	ids[0] = vcp->vc_worker;
+	ids[1] = vxcp->vxc_unit;
+	ids[2] = vxcp->vxc_run;
+	for (i = 0; i < 3; i++)
+		for (j = 0; j < 8; j++)
+			buf[(8 * i) + j] = ids[i] >> (8 * j);
+
+	SHA256_Init(&sha);
+	SHA256_Update(&sha, vcp->vc_seed, sizeof(vcp->vc_seed));
+	SHA256_Update(&sha, buf, sizeof(buf));
+	SHA256_Final(vxcp->vxc_rng_key, &sha);
+	vxcp->vxc_rng_count = 0;
+	OPENSSL_cleanse(&sha, sizeof(sha));
+}
+
+/*
+ * Units are numbered in the order contexts first generate a key, so
+ * contexts that only test keys do not take one.  A resumed search
+ * continues each unit from its checkpointed run.
+ */
+static void
+vg_exec_context_take_unit(vg_exec_context_t *vxcp)
+{
+	vg_context_t *vcp = vxcp->vxc_vc;
+
+	pthread_mutex_lock(&vg_thread_lock);
+	vxcp->vxc_unit = vcp->vc_nunits++;
+	if (vxcp->vxc_unit < vcp->vc_nresume)
+		vxcp->vxc_nextrun = vcp->vc_resume_runs[vxcp->vxc_unit];
+	vxcp->vxc_resume_run = vxcp->vxc_nextrun;
+	pthread_mutex_unlock(&vg_thread_lock);
+}
+
+/*
+ * Replace the context's key with a new random one, computing the
+ * public key with the shared table.  Uses only per-context state,
+ * so no lock is needed.
+ */
+int
+vg_exec_context_generate_key(vg_exec_context_t *vxcp)
+{
+	BIGNUM *bnorder, *bnkey;
+	unsigned char buf[32];
+	int res = 0;
+
+	if (vxcp->vxc_unit == VG_UNIT_NONE)
+		vg_exec_context_take_unit(vxcp);
+	vxcp->vxc_run = vxcp->vxc_nextrun++;
+	if (vxcp->vxc_vc->vc_seeded)
+		vg_exec_context_seed_run(vxcp);
+
+	BN_CTX_start(vxcp->vxc_bnctx);
+	bnorder = BN_CTX_get(vxcp->vxc_bnctx);
+	bnkey = BN_CTX_get(vxcp->vxc_bnctx);
+	if (!bnkey ||
+	    !EC_GROUP_get_order(EC_KEY_get0_group(vxcp->vxc_key),
+				bnorder, vxcp->vxc_bnctx))
+		goto out;
+
+	/* Rejection sampling from [1, n-1] */
+	do {
+		vg_exec_context_rng_bytes(vxcp, buf, sizeof(buf));
+		if (!BN_bin2bn(buf, sizeof(buf), bnkey))
+			goto out;
+	} while (BN_is_zero(bnkey) || (BN_cmp(bnkey, bnorder) >= 0));
+
+	res = vg_ecmult_gen_key(vxcp->vxc_key, bnkey, vxcp->vxc_bnctx);
+out:
+	OPENSSL_cleanse(buf, sizeof(buf));
+	BN_clear(bnkey);
+	BN_CTX_end(vxcp->vxc_bnctx);
+	return res;
+}
+
+/*
+ * Rebuild a key from the origin of a match, as printed with a
+ * seeded key schedule: worker:unit:run:delta:variant:compressed
+ */
+int
+vg_exec_context_replay(vg_exec_context_t *vxcp, const char *origin)
+{
+	vg_context_t *vcp = vxcp->vxc_vc;
+	unsigned long worker, unit;
+	unsigned long long run;
+	int delta, variant, compressed;
+
+	if ((sscanf(origin, "%lu:%lu:%llu:%d:%d:%d", &worker, &unit, &run,
+		    &delta, &variant, &compressed) != 6) ||
+	    (variant < 0) || (variant >= vcp->vc_variants) ||
+	    (compressed < 0) || (compressed > 1))
+		return 0;
+
+	vcp->vc_worker = worker;
+	vxcp->vxc_unit = unit;
+	vxcp->vxc_nextrun = run;
+	if (!vg_exec_context_generate_key(vxcp))
+		return 0;
+	vxcp->vxc_delta = delta;
+	vxcp->vxc_variant = variant;
+	vxcp->vxc_compressed = compressed;
+	vg_exec_context_consolidate_key(vxcp);
+	return 1;
+}
+
+/*
+ * With a seeded key schedule, note where a match came from for the
+ * output method, in the form taken by vg_exec_context_replay().
+ * Called with vg_pattern_lock held, before the key is consolidated.
+ */
+static void
+vg_exec_context_note_origin(vg_exec_context_t *vxcp)
+{
+	vg_context_t *vcp = vxcp->vxc_vc;
+
+	vcp->vc_match_origin[0] = '\0';
+	if (vcp->vc_seeded)
+		snprintf(vcp->vc_match_origin, sizeof(vcp->vc_match_origin),
+			 "%lu:%lu:%llu:%d:%d:%d",
+			 vcp->vc_worker, vxcp->vxc_unit, vxcp->vxc_run,
+			 vxcp->vxc_delta, vxcp->vxc_variant,
+			 vxcp->vxc_compressed);
 }
 
 void
@@ -241,6 +651,7 @@ vg_exec_context_calc_address(vg_exec_context_t *vxcp)
 	EC_POINT *pubkey;
 	const EC_GROUP *pgroup;
 	unsigned char eckey_buf[96], hash1[32], hash2[20];
+	vg_hash160_func_t hash160;
 	int len;
 
 	vg_exec_context_consolidate_key(vxcp);
@@ -256,141 +667,178 @@ vg_exec_context_calc_address(vg_exec_context_t *vxcp)
 	}
 	len = EC_POINT_point2oct(pgroup,
 				 pubkey,
-				 POINT_CONVERSION_UNCOMPRESSED,
+				 EC_KEY_get_conv_form(vxcp->vxc_key),
 				 eckey_buf,
 				 sizeof(eckey_buf),
 				 vxcp->vxc_bnctx);
-	SHA256(eckey_buf, len, hash1);
-	RIPEMD160(hash1, sizeof(hash1), hash2);
+	hash160 = vg_hash160_get_func(len);
+	if (hash160) {
+		hash160(hash2, eckey_buf);
+	} else {
+		SHA256(eckey_buf, len, hash1);
+		RIPEMD160(hash1, sizeof(hash1), hash2);
+	}
 	memcpy(&vxcp->vxc_binres[1],
 	       hash2, 20);
 	EC_POINT_free(pubkey);
 }
 
+/*
+ * Rate reporting
+ *
+ * Each execution context counts the keys it has checked in its own
+ * cache line, written only by its thread with relaxed atomic stores.
+ * A reporter thread wakes up on a fixed timer, sums the counters,
+ * keeps an exponentially weighted average of the rate, and drives
+ * vc_output_timing.  It also writes the periodic checkpoints, and
+ * the one requested by a signal before stopping the search.
+ */
+
 enum {
-	timing_hist_size = 5
+	timing_interval_ms = 500,
+	timing_ewma_ms = 2000,
+	checkpoint_interval_s = 60,
 };
 
-typedef struct _timing_info_s {
-	struct _timing_info_s	*ti_next;
-	pthread_t		ti_thread;
-	unsigned long		ti_last_rate;
-
-	unsigned long long	ti_hist_time[timing_hist_size];
-	unsigned long		ti_hist_work[timing_hist_size];
-	int			ti_hist_last;
-} timing_info_t;
-
 static pthread_mutex_t timing_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timing_cond = PTHREAD_COND_INITIALIZER;
 
-int
-vg_output_timing(vg_context_t *vcp, int cycle, struct timeval *last)
-{
-	pthread_t me;
-	struct timeval tvnow, tv;
-	timing_info_t *tip, *mytip;
-	unsigned long long rate, myrate = 0, mytime, total, sincelast;
-	int p, i;
-
-	/* Compute the rate */
-	gettimeofday(&tvnow, NULL);
-	timersub(&tvnow, last, &tv);
-	memcpy(last, &tvnow, sizeof(*last));
-	mytime = tv.tv_usec + (1000000ULL * tv.tv_sec);
-	if (!mytime)
-		mytime = 1;
-	rate = 0;
+void
+vg_exec_context_count(vg_exec_context_t *vxcp, unsigned long long work)
+{
+	vg_store_relaxed(&vxcp->vxc_work,
+			 vg_load_relaxed(&vxcp->vxc_work) + work);
+}
 
-	pthread_mutex_lock(&timing_mutex);
-	me = pthread_self();
-	for (tip = vcp->vc_timing_head, mytip = NULL;
-	     tip != NULL; tip = tip->ti_next) {
-		if (pthread_equal(tip->ti_thread, me)) {
-			mytip = tip;
-			p = ((tip->ti_hist_last + 1) % timing_hist_size);
-			tip->ti_hist_time[p] = mytime;
-			tip->ti_hist_work[p] = cycle;
-			tip->ti_hist_last = p;
-
-			mytime = 0;
-			myrate = 0;
-			for (i = 0; i < timing_hist_size; i++) {
-				mytime += tip->ti_hist_time[i];
-				myrate += tip->ti_hist_work[i];
-			}
-			myrate = (myrate * 1000000) / mytime;
-			tip->ti_last_rate = myrate;
-			rate += myrate;
-
-		} else
-			rate += tip->ti_last_rate;
-	}
-	if (!mytip) {
-		mytip = (timing_info_t *) malloc(sizeof(*tip));
-		mytip->ti_next = vcp->vc_timing_head;
-		mytip->ti_thread = me;
-		vcp->vc_timing_head = mytip;
-		mytip->ti_hist_last = 0;
-		mytip->ti_hist_time[0] = mytime;
-		mytip->ti_hist_work[0] = cycle;
-		for (i = 1; i < timing_hist_size; i++) {
-			mytip->ti_hist_time[i] = 1;
-			mytip->ti_hist_work[i] = 0;
-		}
-		myrate = ((unsigned long long)cycle * 1000000) / mytime;
-		mytip->ti_last_rate = myrate;
-		rate += myrate;
-	}
-
-	vcp->vc_timing_total += cycle;
-	if (vcp->vc_timing_prevfound != vcp->vc_found) {
-		vcp->vc_timing_prevfound = vcp->vc_found;
-		vcp->vc_timing_sincelast = 0;
-	}
-	vcp->vc_timing_sincelast += cycle;
-
-	if (mytip != vcp->vc_timing_head) {
-		pthread_mutex_unlock(&timing_mutex);
-		return myrate;
-	}
-	total = vcp->vc_timing_total;
-	sincelast = vcp->vc_timing_sincelast;
-	pthread_mutex_unlock(&timing_mutex);
+static unsigned long long
+vg_context_count_work(vg_context_t *vcp)
+{
+	vg_exec_context_t *tp;
+	unsigned long long total;
 
-	vcp->vc_output_timing(vcp, sincelast, rate, total);
-	return myrate;
+	pthread_mutex_lock(&vg_thread_lock);
+	total = vcp->vc_timing_exited;
+	for (tp = vcp->vc_threads; tp != NULL; tp = tp->vxc_next)
+		total += vg_load_relaxed(&tp->vxc_work);
+	pthread_mutex_unlock(&vg_thread_lock);
+	return total;
 }
 
-void
-vg_context_thread_exit(vg_context_t *vcp)
+static void *
+vg_timing_thread(void *arg)
 {
-	timing_info_t *tip, **ptip;
-	pthread_t me;
+	vg_context_t *vcp = (vg_context_t *) arg;
+	struct timeval tvnow, tvlast, tvcheck, tv;
+	struct timespec ts;
+	unsigned long long total, prevtotal, sincelast, elapsed;
+	double rate = 0.0, sample, weight;
 
 	pthread_mutex_lock(&timing_mutex);
-	me = pthread_self();
-	for (ptip = &vcp->vc_timing_head, tip = *ptip;
-	     tip != NULL;
-	     ptip = &tip->ti_next, tip = *ptip) {
-		if (!pthread_equal(tip->ti_thread, me))
+	gettimeofday(&tvlast, NULL);
+	tvcheck = tvlast;
+	prevtotal = vg_context_count_work(vcp);
+	while (!vcp->vc_timing_stop) {
+		tv.tv_sec = tvlast.tv_sec + (timing_interval_ms / 1000);
+		tv.tv_usec = tvlast.tv_usec +
+			((timing_interval_ms % 1000) * 1000);
+		if (tv.tv_usec >= 1000000) {
+			tv.tv_sec++;
+			tv.tv_usec -= 1000000;
+		}
+		ts.tv_sec = tv.tv_sec;
+		ts.tv_nsec = tv.tv_usec * 1000;
+		pthread_cond_timedwait(&timing_cond, &timing_mutex, &ts);
+		if (vcp->vc_timing_stop)
+			break;
+
+		gettimeofday(&tvnow, NULL);
+		timersub(&tvnow, &tvlast, &tv);
+		elapsed = tv.tv_usec + (1000000ULL * tv.tv_sec);
+		if (elapsed < (timing_interval_ms * 1000ULL))
+			continue;
+		memcpy(&tvlast, &tvnow, sizeof(tvlast));
+
+		total = vg_context_count_work(vcp);
+		if (total == prevtotal)
+			goto checkpoint;
+
+		/* Exponentially weighted, by the time each sample covers */
+		sample = ((double) (total - prevtotal) * 1000000.0) / elapsed;
+		if (rate == 0.0)
+			rate = sample;
+		else {
+			weight = 1.0 - exp(-(elapsed / 1000.0) /
+					   timing_ewma_ms);
+			rate += weight * (sample - rate);
+		}
+
+		vcp->vc_timing_total += (total - prevtotal);
+		if (vcp->vc_timing_prevfound != vcp->vc_found) {
+			vcp->vc_timing_prevfound = vcp->vc_found;
+			vcp->vc_timing_sincelast = 0;
+		}
+		vcp->vc_timing_sincelast += (total - prevtotal);
+		prevtotal = total;
+		sincelast = vcp->vc_timing_sincelast;
+		total = vcp->vc_timing_total;
+
+		pthread_mutex_unlock(&timing_mutex);
+		vcp->vc_output_timing(vcp, sincelast,
+				      (unsigned long long) rate, total);
+		pthread_mutex_lock(&timing_mutex);
+
+	checkpoint:
+		if (!vcp->vc_checkpoint_file ||
+		    (!vcp->vc_checkpoint_request &&
+		     ((tvnow.tv_sec - tvcheck.tv_sec) < checkpoint_interval_s)))
 			continue;
-		*ptip = tip->ti_next;
-		free(tip);
-		break;
+		tvcheck = tvnow;
+		total = vcp->vc_timing_total;
+		sincelast = vcp->vc_timing_sincelast;
+		pthread_mutex_unlock(&timing_mutex);
+		vg_context_write_checkpoint(vcp, total, sincelast);
+		pthread_mutex_lock(&timing_mutex);
+		if (vcp->vc_checkpoint_request) {
+			fprintf(stderr, "\nCheckpoint written to %s\n",
+				vcp->vc_checkpoint_file);
+			vcp->vc_halt = 1;
+			break;
+		}
 	}
 	pthread_mutex_unlock(&timing_mutex);
-
+	return NULL;
 }
 
-static void
-vg_timing_info_free(vg_context_t *vcp)
+int
+vg_context_start_timing(vg_context_t *vcp)
 {
-	timing_info_t *tp;
-	while (vcp->vc_timing_head != NULL) {
-		tp = vcp->vc_timing_head;
-		vcp->vc_timing_head = tp->ti_next;
-		free(tp);
+	int res;
+
+	if (vcp->vc_timing_active)
+		return 0;
+	vcp->vc_timing_stop = 0;
+	res = pthread_create((pthread_t *) &vcp->vc_timing_thread, NULL,
+			     vg_timing_thread, vcp);
+	if (res) {
+		fprintf(stderr,
+			"ERROR: could not create reporter thread: %d\n", res);
+		return -1;
 	}
+	vcp->vc_timing_active = 1;
+	return 0;
+}
+
+void
+vg_context_stop_timing(vg_context_t *vcp)
+{
+	if (!vcp->vc_timing_active)
+		return;
+	pthread_mutex_lock(&timing_mutex);
+	vcp->vc_timing_stop = 1;
+	pthread_cond_broadcast(&timing_cond);
+	pthread_mutex_unlock(&timing_mutex);
+	pthread_join((pthread_t) vcp->vc_timing_thread, NULL);
+	vcp->vc_timing_active = 0;
 }
 
 void
@@ -530,10 +978,12 @@ vg_output_match_console(vg_context_t *vcp, EC_KEY *pkey, const char *pattern)
 	assert(EC_KEY_check_key(pkey));
 	vg_encode_address(ppnt,
 			  EC_KEY_get0_group(pkey),
+			  EC_KEY_get_conv_form(pkey),
 			  vcp->vc_pubkeytype, addr_buf);
 	if (isscript)
 		vg_encode_script_address(ppnt,
 					 EC_KEY_get0_group(pkey),
+					 EC_KEY_get_conv_form(pkey),
 					 vcp->vc_addrtype, addr2_buf);
 
 	if (vcp->vc_key_protect_pass) {
@@ -579,6 +1029,8 @@ vg_output_match_console(vg_context_t *vcp, EC_KEY *pkey, const char *pattern)
 		printf("Address: %s\n"
 		       "%s: %s\n",
 		       addr_buf, keytype, privkey_buf);
+		if (vcp->vc_match_origin[0])
+			printf("Origin: %s\n", vcp->vc_match_origin);
 	}
 
 	if (vcp->vc_result_file) {
@@ -597,6 +1049,9 @@ vg_output_match_console(vg_context_t *vcp, EC_KEY *pkey, const char *pattern)
 				"Address: %s\n"
 				"%s: %s\n",
 				addr_buf, keytype, privkey_buf);
+			if (vcp->vc_match_origin[0])
+				fprintf(fp, "Origin: %s\n",
+					vcp->vc_match_origin);
 			fclose(fp);
 		}
 	}
@@ -608,7 +1063,8 @@ vg_output_match_console(vg_context_t *vcp, EC_KEY *pkey, const char *pattern)
 void
 vg_context_free(vg_context_t *vcp)
 {
-	vg_timing_info_free(vcp);
+	vg_context_stop_timing(vcp);
+	vg_context_free_snapshots(vcp);
 	vcp->vc_free(vcp);
 }
 
@@ -616,23 +1072,37 @@ int
 vg_context_add_patterns(vg_context_t *vcp,
 			const char ** const patterns, int npatterns)
 {
+	int res;
+
+	pthread_mutex_lock(&vg_pattern_lock);
 	vcp->vc_pattern_generation++;
-	return vcp->vc_add_patterns(vcp, patterns, npatterns);
+	res = vcp->vc_add_patterns(vcp, patterns, npatterns);
+	vg_context_publish(vcp);
+	pthread_mutex_unlock(&vg_pattern_lock);
+	return res;
 }
 
 void
 vg_context_clear_all_patterns(vg_context_t *vcp)
 {
+	pthread_mutex_lock(&vg_pattern_lock);
 	vcp->vc_clear_all_patterns(vcp);
 	vcp->vc_pattern_generation++;
+	vg_context_publish(vcp);
+	pthread_mutex_unlock(&vg_pattern_lock);
 }
 
 int
 vg_context_hash160_sort(vg_context_t *vcp, void *buf)
 {
+	int res;
+
 	if (!vcp->vc_hash160_sort)
 		return 0;
-	return vcp->vc_hash160_sort(vcp, buf);
+	pthread_mutex_lock(&vg_pattern_lock);
+	res = vcp->vc_hash160_sort(vcp, buf);
+	pthread_mutex_unlock(&vg_pattern_lock);
+	return res;
 }
 
 int
@@ -654,7 +1124,7 @@ vg_context_start_threads(vg_context_t *vcp)
 		}
 		vxcp->vxc_thread_active = 1;
 	}
-	return 0;
+	return vg_context_start_timing(vcp);
 }
 
 void
@@ -676,6 +1146,7 @@ vg_context_wait_for_completion(vg_context_t *vcp)
 		pthread_join((pthread_t) vxcp->vxc_pthread, NULL);
 		vxcp->vxc_thread_active = 0;
 	}
+	vg_context_stop_timing(vcp);
 }
 
 
@@ -961,6 +1432,7 @@ typedef struct _vg_prefix_s {
 	avl_item_t		vp_item;
 	struct _vg_prefix_s	*vp_sibling;
 	const char		*vp_pattern;
+	int			vp_caseinsensitive;
 	BIGNUM			*vp_low;
 	BIGNUM			*vp_high;
 } vg_prefix_t;
@@ -1050,6 +1522,7 @@ vg_prefix_add(avl_root_t *rootp, const char *pattern, BIGNUM *low, BIGNUM *high)
 		avl_item_init(&vp->vp_item);
 		vp->vp_sibling = NULL;
 		vp->vp_pattern = pattern;
+		vp->vp_caseinsensitive = 0;
 		vp->vp_low = low;
 		vp->vp_high = high;
 		vp2 = vg_prefix_avl_insert(rootp, vp);
@@ -1133,364 +1606,1543 @@ vg_prefix_range_sum(vg_prefix_t *vp, BIGNUM *result, BIGNUM *tmp1)
 }
 
 
-typedef struct _prefix_case_iter_s {
-	char	ci_prefix[32];
-	char	ci_case_map[32];
-	char	ci_nbits;
-	int	ci_value;
-} prefix_case_iter_t;
+/*
+ * Prefixes with character classes.  Each position of the prefix is a
+ * character, or a [...] set of them, and when case-insensitive, a
+ * letter also stands for its other case.  A set may hold ranges such
+ * as [a-k], which take the base58 characters between their ends, but
+ * any other character in it must be base58, or have a base58 other
+ * case when case-insensitive.  A position is kept as a mask of the
+ * base58 digits it accepts.
+ */
 
-static const unsigned char b58_case_map[256] = {
-	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-	0, 1, 1, 1, 1, 1, 1, 1, 1, 2, 1, 1, 0, 1, 1, 2,
-	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0,
-	0, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, 1, 2, 1, 1, 0,
-	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0,
-};
+#define VG_PREFIX_CLASS_LEN	32
 
-static int
-prefix_case_iter_init(prefix_case_iter_t *cip, const char *pfx)
+/* Mask of the base58 digits a character stands for */
+static uint64_t
+vg_class_char_mask(int ch, int caseinsensitive)
 {
-	int i;
+	uint64_t mask = 0;
+	int c;
+
+	c = vg_b58_reverse_map[ch & 0xff];
+	if (c != -1)
+		mask |= (uint64_t) 1 << c;
+	if (caseinsensitive &&
+	    (((ch | 0x20) >= 'a') && ((ch | 0x20) <= 'z'))) {
+		c = vg_b58_reverse_map[ch ^ 0x20];
+		if (c != -1)
+			mask |= (uint64_t) 1 << c;
+	}
+	return mask;
+}
 
-	cip->ci_nbits = 0;
-	cip->ci_value = 0;
-	for (i = 0; pfx[i]; i++) {
-		if (i > sizeof(cip->ci_prefix))
-			return 0;
-		if (!b58_case_map[(int)pfx[i]]) {
-			/* Character isn't case-swappable, ignore it */
-			cip->ci_prefix[i] = pfx[i];
+/*
+ * Parse the positions of a prefix or suffix, of kind, into masks.
+ * Returns the number of positions, -1 for an invalid pattern, or -2
+ * if it has more than maxlen of them.
+ */
+static int
+vg_parse_classes(const char *pfx, int caseinsensitive, uint64_t *masks,
+		 int maxlen, const char *kind)
+{
+	const unsigned char *p;
+	uint64_t mask, m;
+	int len, c, lo, hi;
+
+	for (p = (const unsigned char *) pfx, len = 0; *p; p++, len++) {
+		if (len >= maxlen)
+			return -2;
+		if (*p != '[') {
+			mask = vg_class_char_mask(*p, caseinsensitive);
+			if (!mask) {
+				fprintf(stderr,
+					"Invalid character '%c' in %s '%s'\n",
+					*p, kind, pfx);
+				return -1;
+			}
+			masks[len] = mask;
 			continue;
 		}
-		if (b58_case_map[(int)pfx[i]] == 2) {
-			/* Character invalid, but valid in swapped case */
-			cip->ci_prefix[i] = pfx[i] ^ 0x20;
-			continue;
+
+		mask = 0;
+		for (p++; *p != ']'; p++) {
+			if (!*p) {
+				fprintf(stderr,
+					"Unterminated '[' in %s '%s'\n",
+					kind, pfx);
+				return -1;
+			}
+			lo = hi = *p;
+			if ((p[1] == '-') && p[2] && (p[2] != ']')) {
+				hi = p[2];
+				p += 2;
+				if (hi < lo) {
+					fprintf(stderr,
+						"Invalid range '%c-%c' in "
+						"%s '%s'\n",
+						lo, hi, kind, pfx);
+					return -1;
+				}
+			}
+			m = 0;
+			for (c = lo; c <= hi; c++)
+				m |= vg_class_char_mask(c, caseinsensitive);
+			if (!m && (lo == hi)) {
+				fprintf(stderr,
+					"Invalid character '%c' in a set of "
+					"%s '%s'\n",
+					lo, kind, pfx);
+				return -1;
+			}
+			if (!m) {
+				fprintf(stderr,
+					"No base58 character in range "
+					"'%c-%c' of %s '%s'\n",
+					lo, hi, kind, pfx);
+				return -1;
+			}
+			mask |= m;
+		}
+		if (!mask) {
+			fprintf(stderr, "Empty set in %s '%s'\n", kind, pfx);
+			return -1;
 		}
-		/* Character is case-swappable */
-		cip->ci_prefix[i] = pfx[i] | 0x20;
-		cip->ci_case_map[(int)cip->ci_nbits] = i;
-		cip->ci_nbits++;
+		masks[len] = mask;
 	}
-	cip->ci_prefix[i] = '\0';
-	return 1;
+	return len;
 }
 
 static int
-prefix_case_iter_next(prefix_case_iter_t *cip)
+vg_prefix_mask_count(uint64_t mask)
 {
-	unsigned long val, max, mask;
-	int i, nbits;
-
-	nbits = cip->ci_nbits;
-	max = (1UL << nbits) - 1;
-	val = cip->ci_value + 1;
-	if (val > max)
-		return 0;
-
-	for (i = 0, mask = 1; i < nbits; i++, mask <<= 1) {
-		if (val & mask)
-			cip->ci_prefix[(int)cip->ci_case_map[i]] &= 0xdf;
-		else
-			cip->ci_prefix[(int)cip->ci_case_map[i]] |= 0x20;
-	}
-	cip->ci_value = val;
-	return 1;
+	int n;
+	for (n = 0; mask; n++)
+		mask &= mask - 1;
+	return n;
 }
 
-
-typedef struct _vg_prefix_context_s {
-	vg_context_t		base;
-	avl_root_t		vcp_avlroot;
-	BIGNUM			vcp_difficulty;
-	int			vcp_caseinsensitive;
-} vg_prefix_context_t;
-
-void
-vg_prefix_context_set_case_insensitive(vg_context_t *vcp, int caseinsensitive)
+static int
+vg_prefix_mask_first(uint64_t mask)
 {
-	((vg_prefix_context_t *) vcp)->vcp_caseinsensitive = caseinsensitive;
+	int d;
+	for (d = 0; !(mask & 1); d++)
+		mask >>= 1;
+	return d;
 }
 
+/*
+ * Iterator over the plain prefixes of a class prefix, for those
+ * matched as ranges
+ */
+typedef struct _prefix_class_iter_s {
+	char		ci_prefix[VG_PREFIX_CLASS_LEN + 1];
+	uint64_t	ci_masks[VG_PREFIX_CLASS_LEN];
+	int		ci_len;
+} prefix_class_iter_t;
+
 static void
-vg_prefix_context_clear_all_patterns(vg_context_t *vcp)
+prefix_class_iter_init(prefix_class_iter_t *cip, const uint64_t *masks,
+		       int len)
 {
-	vg_prefix_context_t *vcpp = (vg_prefix_context_t *) vcp;
-	vg_prefix_t *vp;
-	unsigned long npfx_left = 0;
+	int i;
 
-	while (!avl_root_empty(&vcpp->vcp_avlroot)) {
-		vp = avl_item_entry(vcpp->vcp_avlroot.ar_root,
-				    vg_prefix_t, vp_item);
-		vg_prefix_delete(&vcpp->vcp_avlroot, vp);
-		npfx_left++;
+	cip->ci_len = len;
+	for (i = 0; i < len; i++) {
+		cip->ci_masks[i] = masks[i];
+		cip->ci_prefix[i] =
+			vg_b58_alphabet[vg_prefix_mask_first(masks[i])];
 	}
-
-	assert(npfx_left == vcpp->base.vc_npatterns);
-	vcpp->base.vc_npatterns = 0;
-	vcpp->base.vc_npatterns_start = 0;
-	vcpp->base.vc_found = 0;
-	BN_clear(&vcpp->vcp_difficulty);
+	cip->ci_prefix[len] = '\0';
 }
 
-static void
-vg_prefix_context_free(vg_context_t *vcp)
+static int
+prefix_class_iter_next(prefix_class_iter_t *cip)
 {
-	vg_prefix_context_t *vcpp = (vg_prefix_context_t *) vcp;
-	vg_prefix_context_clear_all_patterns(vcp);
-	BN_clear_free(&vcpp->vcp_difficulty);
-	free(vcpp);
+	uint64_t rest;
+	int i, d;
+
+	for (i = cip->ci_len - 1; i >= 0; i--) {
+		d = vg_b58_reverse_map[(int) cip->ci_prefix[i]];
+		rest = cip->ci_masks[i] & ~(((uint64_t) 2 << d) - 1);
+		if (rest) {
+			cip->ci_prefix[i] =
+				vg_b58_alphabet[vg_prefix_mask_first(rest)];
+			return 1;
+		}
+		cip->ci_prefix[i] =
+			vg_b58_alphabet[vg_prefix_mask_first(
+						cip->ci_masks[i])];
+	}
+	return 0;
 }
 
+/*
+ * Prefix matched by its leading digits rather than as ranges, kept
+ * in the context's table in the order of its masks.  The ranges of
+ * its first few positions, as pairs of leading keys, make a filter.
+ */
+typedef struct _vg_prefix_class_s {
+	struct _vg_prefix_class_s	*vpc_next;
+	const char		*vpc_pattern;
+	int			vpc_caseinsensitive;
+	int			vpc_len;
+	int			vpc_nspans;
+	unsigned long		vpc_index;
+	BIGNUM			*vpc_size;
+	uint64_t		*vpc_spans;
+	uint64_t		vpc_masks[VG_PREFIX_CLASS_LEN];
+} vg_prefix_class_t;
+
 static void
-vg_prefix_context_next_difficulty(vg_prefix_context_t *vcpp,
-				  BIGNUM *bntmp, BIGNUM *bntmp2, BN_CTX *bnctx)
+vg_prefix_class_free(vg_prefix_class_t *vpcp)
 {
-	char *dbuf;
+	if (vpcp->vpc_size)
+		BN_free(vpcp->vpc_size);
+	if (vpcp->vpc_spans)
+		free(vpcp->vpc_spans);
+	free(vpcp);
+}
 
-	BN_clear(bntmp);
-	BN_set_bit(bntmp, 192);
-	BN_div(bntmp2, NULL, bntmp, &vcpp->vcp_difficulty, bnctx);
+static int
+vg_prefix_class_cmp(const void *a, const void *b)
+{
+	const vg_prefix_class_t *vpca = *(const vg_prefix_class_t **) a;
+	const vg_prefix_class_t *vpcb = *(const vg_prefix_class_t **) b;
+	int i;
 
-	dbuf = BN_bn2dec(bntmp2);
-	if (vcpp->base.vc_verbose > 0) {
-		if (vcpp->base.vc_npatterns > 1)
-			fprintf(stderr,
-				"Next match difficulty: %s (%ld prefixes)\n",
-				dbuf, vcpp->base.vc_npatterns);
-		else
-			fprintf(stderr, "Difficulty: %s\n", dbuf);
+	for (i = 0; (i < vpca->vpc_len) && (i < vpcb->vpc_len); i++) {
+		if (vpca->vpc_masks[i] != vpcb->vpc_masks[i])
+			return (vpca->vpc_masks[i] < vpcb->vpc_masks[i]) ?
+				-1 : 1;
 	}
-	vcpp->base.vc_chance = atof(dbuf);
-	OPENSSL_free(dbuf);
+	return vpca->vpc_len - vpcb->vpc_len;
 }
 
+/* Whether the address string matches the prefix */
 static int
-vg_prefix_context_add_patterns(vg_context_t *vcp,
-			       const char ** const patterns, int npatterns)
+vg_prefix_class_match(const vg_prefix_class_t *vpcp, const char *addr)
 {
-	vg_prefix_context_t *vcpp = (vg_prefix_context_t *) vcp;
-	prefix_case_iter_t caseiter;
-	vg_prefix_t *vp, *vp2;
-	BN_CTX *bnctx;
-	BIGNUM bntmp, bntmp2, bntmp3;
-	BIGNUM *ranges[4];
-	int ret = 0;
-	int i, impossible = 0;
-	int case_impossible;
-	unsigned long npfx;
-	char *dbuf;
+	int i, c;
 
-	bnctx = BN_CTX_new();
-	BN_init(&bntmp);
-	BN_init(&bntmp2);
-	BN_init(&bntmp3);
+	for (i = 0; i < vpcp->vpc_len; i++) {
+		c = vg_b58_reverse_map[(int)(unsigned char) addr[i]];
+		if ((c == -1) || !(vpcp->vpc_masks[i] & ((uint64_t) 1 << c)))
+			return 0;
+	}
+	return 1;
+}
 
-	npfx = 0;
-	for (i = 0; i < npatterns; i++) {
-		if (!vcpp->vcp_caseinsensitive) {
-			vp = NULL;
-			ret = get_prefix_ranges(vcpp->base.vc_addrtype,
-						patterns[i],
-						ranges, bnctx);
-			if (!ret) {
-				vp = vg_prefix_add_ranges(&vcpp->vcp_avlroot,
-							  patterns[i],
-							  ranges, NULL);
-			}
+typedef struct _vg_prefix_context_s {
+	vg_context_t		base;
+	avl_root_t		vcp_avlroot;
+	BIGNUM			vcp_difficulty;
+	int			vcp_caseinsensitive;
+	int			vcp_index_shape;
+	int			vcp_expand_classes;
+	vg_prefix_class_t	**vcp_classes;
+	unsigned long		vcp_nclasses;
+	unsigned long		vcp_classes_alloc;
+} vg_prefix_context_t;
 
-		} else {
-			/* Case-enumerate the prefix */
-			if (!prefix_case_iter_init(&caseiter, patterns[i])) {
-				fprintf(stderr,
-					"Prefix '%s' is too long\n",
-					patterns[i]);
-				continue;
-			}
+void
+vg_prefix_context_set_case_insensitive(vg_context_t *vcp, int caseinsensitive)
+{
+	((vg_prefix_context_t *) vcp)->vcp_caseinsensitive = caseinsensitive;
+}
 
-			if (caseiter.ci_nbits > 16) {
-				fprintf(stderr,
-					"WARNING: Prefix '%s' has "
-					"2^%d case-varied derivatives\n",
-					patterns[i], caseiter.ci_nbits);
-			}
+void
+vg_prefix_context_set_expand_classes(vg_context_t *vcp, int expand)
+{
+	((vg_prefix_context_t *) vcp)->vcp_expand_classes = expand;
+}
 
-			case_impossible = 0;
-			vp = NULL;
-			do {
-				ret = get_prefix_ranges(vcpp->base.vc_addrtype,
-							caseiter.ci_prefix,
-							ranges, bnctx);
-				if (ret == -2) {
-					case_impossible++;
-					ret = 0;
-					continue;
-				}
-				if (ret)
-					break;
-				vp2 = vg_prefix_add_ranges(&vcpp->vcp_avlroot,
-							   patterns[i],
-							   ranges,
-							   vp);
-				if (!vp2) {
-					ret = -1;
-					break;
-				}
-				if (!vp)
-					vp = vp2;
+static int
+vg_prefix_context_empty(vg_prefix_context_t *vcpp)
+{
+	return avl_root_empty(&vcpp->vcp_avlroot) && !vcpp->vcp_nclasses;
+}
 
-			} while (prefix_case_iter_next(&caseiter));
+/*
+ * Prefix snapshot: the ranges of the prefix tree in order, as
+ * 25-byte big-endian values comparable with the address directly.
+ *
+ * Lookups search the leading 8 bytes of the low bounds.  Only a target
+ * that shares its leading 8 bytes with a bound, or falls in a range,
+ * needs the full bounds.
+ *
+ * Up to VG_PREFIX_RADIX_MIN ranges, the leading keys are stored in
+ * Eytzinger (breadth-first) order, so the first levels of the search
+ * share a few cache lines and the nodes of later levels can be
+ * prefetched ahead.
+ *
+ * Larger sets are split by the top bits of the address after the
+ * version byte instead.  A directory of 2^16 to 2^24 buckets gives the
+ * ranges starting in each bucket, leaving a search of about one range.
+ * In front of it, a bitmap with a bit per finer bucket marks those
+ * that any range touches, so most targets are rejected by one load.
+ * Both are sized from the range count.
+ *
+ * Prefixes with classes are kept as a trie of digit masks instead,
+ * matched against the leading digits of the address.  The children of
+ * a node are in a list, and each node also has the union of its
+ * children's masks.  Finding the digits takes a division, so a bitmap
+ * of the buckets the ranges of their first few positions touch goes
+ * in front, sized like the one of the ranges.
+ */
 
-			if (!vp && case_impossible)
-				ret = -2;
+#define VG_PREFIX_RADIX_MIN	(1 << 14)
+#define VG_PREFIX_DIR_MIN	16
+#define VG_PREFIX_DIR_MAX	24
+#define VG_PREFIX_BITMAP_MAX	27
+#define VG_PREFIX_CLASS_BITS_MIN	12
+
+typedef struct _vg_prefix_range_s {
+	unsigned char		vpr_low[25];
+	unsigned char		vpr_high[25];
+} vg_prefix_range_t;
+
+typedef struct _vg_prefix_trie_s {
+	uint64_t		vpt_mask;
+	uint64_t		vpt_children;
+	int			vpt_child;
+	int			vpt_next;
+	vg_prefix_class_t	*vpt_class;
+} vg_prefix_trie_t;
+
+typedef struct _vg_prefix_snapshot_s {
+	vg_snapshot_t		base;
+	int			vps_nranges;
+	int			vps_ntrie;
+	int			vps_lead;
+	int			vps_addrtype;
+	int			vps_dirbits;
+	int			vps_bitmapbits;
+	int			vps_classbits;
+	size_t			vps_size;
+	unsigned char		*vps_data;
+	uint64_t		*vps_eytz;
+	int			*vps_eytz_index;
+	uint64_t		*vps_low64;
+	uint64_t		*vps_high64;
+	unsigned int		*vps_dir;
+	uint64_t		*vps_bitmap;
+	uint64_t		*vps_class_bitmap;
+	vg_prefix_range_t	*vps_ranges;
+	vg_prefix_trie_t	*vps_trie;
+
+	/* Removed from the store, freed with the snapshot */
+	vg_prefix_class_t	*vps_dead_classes;
+} vg_prefix_snapshot_t;
+
+static INLINE uint64_t
+vg_prefix_load64(const unsigned char *p)
+{
+	return (((uint64_t) p[0] << 56) | ((uint64_t) p[1] << 48) |
+		((uint64_t) p[2] << 40) | ((uint64_t) p[3] << 32) |
+		((uint64_t) p[4] << 24) | ((uint64_t) p[5] << 16) |
+		((uint64_t) p[6] << 8) | (uint64_t) p[7]);
+}
 
-			if (ret && vp) {
-				vg_prefix_delete(&vcpp->vcp_avlroot, vp);
-				vp = NULL;
-			}
-		}
+#if defined(__GNUC__)
+#define vg_prefix_prefetch(p) __builtin_prefetch(p)
+#define vg_prefix_ffs(x) __builtin_ffs(x)
+#else
+#define vg_prefix_prefetch(p)
+static INLINE int
+vg_prefix_ffs(int x)
+{
+	int n;
+	if (!x)
+		return 0;
+	for (n = 1; !(x & 1); n++)
+		x >>= 1;
+	return n;
+}
+#endif
 
-		if (ret == -2) {
-			fprintf(stderr,
-				"Prefix '%s' not possible\n", patterns[i]);
-			impossible++;
-		}
+/*
+ * Position of a leading key among the addresses of the snapshot's
+ * version, in units of 2^(56 - bits), clamped to the version's space
+ */
+static INLINE uint64_t
+vg_prefix_radix(const vg_prefix_snapshot_t *vpsp, uint64_t key, int bits)
+{
+	if ((int) (key >> 56) < vpsp->vps_addrtype)
+		return 0;
+	if ((int) (key >> 56) > vpsp->vps_addrtype)
+		return ((uint64_t) 1 << bits) - 1;
+	return (key & 0x00ffffffffffffffULL) >> (56 - bits);
+}
 
-		if (!vp)
-			continue;
+/*
+ * Leading base58 digits of an address, for the prefixes with classes.
+ *
+ * Addresses of 25 bytes are 200-bit numbers, kept here as four 64-bit
+ * limbs, least significant first.  The first k of the d digits of v
+ * are the quotient floor(v / 58^(d-k)).  Up to VG_B58_LEAD_MAX of them
+ * fit in 64 bits, and the quotient is found by multiplying the top
+ * 128 bits of v by a fixed-point reciprocal of the top 64 bits of
+ * 58^(d-k), which comes out a few below the quotient.  Stepping it up
+ * against the exact remainder corrects it.
+ */
 
-		npfx++;
+#define VG_B58_LEAD_MAX		10
+#define VG_B58_POW_MAX		35
 
-		/* Determine the probability of finding a match */
-		vg_prefix_range_sum(vp, &bntmp, &bntmp2);
-		BN_add(&bntmp2, &vcpp->vcp_difficulty, &bntmp);
-		BN_copy(&vcpp->vcp_difficulty, &bntmp2);
+typedef struct _vg_b58_pow_s {
+	uint64_t	bp_limb[4];
+	int		bp_shift;	/* Bits below the top 64 */
+	uint64_t	bp_recip;	/* 2^128 / (top 64 bits + 1) - 2^64 */
+} vg_b58_pow_t;
 
-		if (vcp->vc_verbose > 1) {
-			BN_clear(&bntmp2);
-			BN_set_bit(&bntmp2, 192);
-			BN_div(&bntmp3, NULL, &bntmp2, &bntmp, bnctx);
+static vg_b58_pow_t vg_b58_pow[VG_B58_POW_MAX];
 
-			dbuf = BN_bn2dec(&bntmp3);
-			fprintf(stderr,
-				"Prefix difficulty: %20s %s\n",
-				dbuf, patterns[i]);
-			OPENSSL_free(dbuf);
-		}
+/* Digits of 2^(n-1), for numbers of n bits */
+static unsigned char vg_b58_bits_digits[201];
+
+static int vg_b58_pow_ready;
+
+static INLINE int
+vg_b58_cmp(const uint64_t *a, const uint64_t *b)
+{
+	int i;
+	for (i = 3; i >= 0; i--) {
+		if (a[i] != b[i])
+			return (a[i] < b[i]) ? -1 : 1;
 	}
+	return 0;
+}
 
-	vcpp->base.vc_npatterns += npfx;
-	vcpp->base.vc_npatterns_start += npfx;
+static void
+vg_b58_limbs(const BIGNUM *bn, uint64_t *limbs)
+{
+	unsigned char buf[32];
+	int i, j, nbytes;
+
+	nbytes = BN_num_bytes(bn);
+	assert(nbytes <= 32);
+	memset(buf, 0, sizeof(buf));
+	BN_bn2bin(bn, buf + (32 - nbytes));
+	for (i = 0; i < 4; i++) {
+		limbs[i] = 0;
+		for (j = 0; j < 8; j++)
+			limbs[i] |= (uint64_t) buf[31 - (8 * i) - j] << (8 * j);
+	}
+}
 
-	if (!npfx && impossible) {
-		const char *ats = "bitcoin", *bw = "\"1\"";
-		switch (vcpp->base.vc_addrtype) {
-		case 5:
-			ats = "bitcoin script";
-			bw = "\"3\"";
-			break;
-		case 111:
-			ats = "testnet";
-			bw = "\"m\" or \"n\"";
-			break;
-		case 52:
-			ats = "namecoin";
-			bw = "\"M\" or \"N\"";
-			break;
-		default:
-			break;
-		}
-		fprintf(stderr,
-			"Hint: valid %s addresses begin with %s\n", ats, bw);
+/* Called before the threads start */
+static void
+vg_b58_pow_init(void)
+{
+	BN_CTX *bnctx;
+	BIGNUM *bnpow, *bnbase, *bntop, *bntmp, *bnrecip;
+	uint64_t limbs[4];
+	int e, b;
+
+	if (vg_b58_pow_ready)
+		return;
+
+	bnctx = BN_CTX_new();
+	BN_CTX_start(bnctx);
+	bnpow = BN_CTX_get(bnctx);
+	bnbase = BN_CTX_get(bnctx);
+	bntop = BN_CTX_get(bnctx);
+	bntmp = BN_CTX_get(bnctx);
+	bnrecip = BN_CTX_get(bnctx);
+	BN_one(bnpow);
+	BN_set_word(bnbase, 58);
+
+	for (e = 0; e < VG_B58_POW_MAX; e++) {
+		vg_b58_limbs(bnpow, vg_b58_pow[e].bp_limb);
+		vg_b58_pow[e].bp_shift = BN_num_bits(bnpow) - 64;
+		if (vg_b58_pow[e].bp_shift >= 0)
+			BN_rshift(bntop, bnpow, vg_b58_pow[e].bp_shift);
+		else
+			BN_lshift(bntop, bnpow, -vg_b58_pow[e].bp_shift);
+
+		/* The top bits of a power of 58 are never all ones */
+		BN_add_word(bntop, 1);
+		assert(BN_num_bits(bntop) == 64);
+		BN_zero(bntmp);
+		BN_set_bit(bntmp, 128);
+		BN_sub_word(bntmp, 1);
+		BN_div(bnrecip, NULL, bntmp, bntop, bnctx);
+		BN_clear_bit(bnrecip, 64);
+		vg_b58_limbs(bnrecip, limbs);
+		vg_b58_pow[e].bp_recip = limbs[0];
+
+		BN_mul(bnpow, bnpow, bnbase, bnctx);
 	}
 
-	if (npfx)
-		vg_prefix_context_next_difficulty(vcpp, &bntmp, &bntmp2, bnctx);
+	/* 2^(b-1) has as many digits as the first power of 58 above it */
+	for (b = 1, e = 0; b <= 200; b++) {
+		memset(limbs, 0, sizeof(limbs));
+		limbs[(b - 1) >> 6] = (uint64_t) 1 << ((b - 1) & 63);
+		while (vg_b58_cmp(limbs, vg_b58_pow[e].bp_limb) >= 0)
+			e++;
+		vg_b58_bits_digits[b] = e;
+	}
 
-	ret = (npfx != 0);
+	assert(vg_b58_pow[VG_B58_LEAD_MAX].bp_shift < 0);
 
-	BN_clear_free(&bntmp);
-	BN_clear_free(&bntmp2);
-	BN_clear_free(&bntmp3);
+	BN_CTX_end(bnctx);
 	BN_CTX_free(bnctx);
-	return ret;
+	vg_b58_pow_ready = 1;
 }
 
-double
-vg_prefix_get_difficulty(int addrtype, const char *pattern)
+static INLINE void
+vg_b58_mul64(uint64_t a, uint64_t b, uint64_t *hi, uint64_t *lo)
 {
-	BN_CTX *bnctx;
-	BIGNUM result, bntmp;
-	BIGNUM *ranges[4];
-	char *dbuf;
-	int ret;
-	double diffret = 0.0;
-
-	bnctx = BN_CTX_new();
-	BN_init(&result);
-	BN_init(&bntmp);
+#if defined(__SIZEOF_INT128__)
+	unsigned __int128 r = (unsigned __int128) a * b;
+	*hi = (uint64_t) (r >> 64);
+	*lo = (uint64_t) r;
+#elif defined(_MSC_VER) && defined(_M_X64)
+	*lo = _umul128(a, b, hi);
+#else
+	uint64_t ll, lh, hl, hh, mid;
+	ll = (a & 0xffffffff) * (b & 0xffffffff);
+	lh = (a & 0xffffffff) * (b >> 32);
+	hl = (a >> 32) * (b & 0xffffffff);
+	hh = (a >> 32) * (b >> 32);
+	mid = (ll >> 32) + (lh & 0xffffffff) + (hl & 0xffffffff);
+	*lo = (mid << 32) | (ll & 0xffffffff);
+	*hi = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+#endif
+}
 
-	ret = get_prefix_ranges(addrtype,
-				pattern, ranges, bnctx);
+static INLINE int
+vg_b58_bitlen64(uint64_t x)
+{
+#if defined(__GNUC__)
+	return x ? (64 - __builtin_clzll(x)) : 0;
+#else
+	int n;
+	for (n = 0; x; n++)
+		x >>= 1;
+	return n;
+#endif
+}
 
-	if (ret == 0) {
-		BN_sub(&bntmp, ranges[1], ranges[0]);
-		BN_add(&result, &result, &bntmp);
-		if (ranges[2]) {
-			BN_sub(&bntmp, ranges[3], ranges[2]);
-			BN_add(&result, &result, &bntmp);
+/* The first k of the d digits of v, k at most VG_B58_LEAD_MAX */
+static INLINE uint64_t
+vg_b58_lead(const uint64_t *v, int d, int k)
+{
+	const vg_b58_pow_t *bp = &vg_b58_pow[d - k];
+	uint64_t w[6], r[4], a0, a1, hi, lo, t, q, c, borrow;
+	int s = bp->bp_shift, i, j;
+
+	/* a = v / 2^s, which is below 2^128 as the quotient is */
+	if (s >= 0) {
+		memcpy(w, v, 4 * sizeof(*v));
+		w[4] = w[5] = 0;
+		i = s >> 6;
+		j = s & 63;
+		a0 = w[i] >> j;
+		a1 = w[i + 1] >> j;
+		if (j) {
+			a0 |= w[i + 1] << (64 - j);
+			a1 |= w[i + 2] << (64 - j);
 		}
-		free_ranges(ranges);
-
-		BN_clear(&bntmp);
-		BN_set_bit(&bntmp, 192);
-		BN_div(&result, NULL, &bntmp, &result, bnctx);
+	} else {
+		/* 58^(d-k) has fewer than 64 bits, and v fewer than 128 */
+		j = -s;
+		a0 = v[0] << j;
+		a1 = (v[1] << j) | (v[0] >> (64 - j));
+	}
 
-		dbuf = BN_bn2dec(&result);
-		diffret = strtod(dbuf, NULL);
-		OPENSSL_free(dbuf);
+	/* q = floor(a * (2^64 + recip) / 2^128), a few low at most */
+	vg_b58_mul64(a0, bp->bp_recip, &hi, &lo);
+	t = hi;
+	vg_b58_mul64(a1, bp->bp_recip, &hi, &lo);
+	t += lo;
+	q = a1 + hi + (t < lo);
+
+	/* r = v - q * 58^(d-k) */
+	for (i = 0, c = 0, borrow = 0; i < 4; i++) {
+		vg_b58_mul64(q, bp->bp_limb[i], &hi, &lo);
+		lo += c;
+		c = hi + (lo < c);
+		t = v[i] - lo;
+		r[i] = t - borrow;
+		borrow = (v[i] < lo) | (t < borrow);
 	}
 
-	BN_clear_free(&result);
-	BN_clear_free(&bntmp);
-	BN_CTX_free(bnctx);
-	return diffret;
+	while (vg_b58_cmp(r, bp->bp_limb) >= 0) {
+		for (i = 0, borrow = 0; i < 4; i++) {
+			t = r[i] - bp->bp_limb[i];
+			c = (r[i] < bp->bp_limb[i]) | (t < borrow);
+			r[i] = t - borrow;
+			borrow = c;
+		}
+		q++;
+	}
+	return q;
 }
 
-
+/*
+ * Leading digits of the address of 25 bytes addr, its zero bytes
+ * first as zero digits, up to n of them.  Returns how many were
+ * found, which is fewer for a short address.
+ */
 static int
-vg_prefix_test(vg_exec_context_t *vxcp)
+vg_b58_lead_digits(const unsigned char *addr, int n, unsigned char *digits)
 {
-	vg_prefix_context_t *vcpp = (vg_prefix_context_t *) vxcp->vxc_vc;
-	vg_prefix_t *vp;
-	int res = 0;
-
-	/*
-	 * We constrain the prefix so that we can check for
-	 * a match without generating the lower four byte
-	 * check code.
-	 */
+	uint64_t v[4], q;
+	int z, d, k, i;
 
-	BN_bin2bn(vxcp->vxc_binres, 25, &vxcp->vxc_bntarg);
+	for (z = 0; (z < 25) && !addr[z]; z++);
+	if (z >= n) {
+		memset(digits, 0, n);
+		return n;
+	}
+	memset(digits, 0, z);
+
+	v[3] = addr[0];
+	v[2] = vg_prefix_load64(addr + 1);
+	v[1] = vg_prefix_load64(addr + 9);
+	v[0] = vg_prefix_load64(addr + 17);
+	for (i = 3; (i > 0) && !v[i]; i--);
+	d = vg_b58_bits_digits[(64 * i) + vg_b58_bitlen64(v[i])];
+	if (vg_b58_cmp(v, vg_b58_pow[d].bp_limb) >= 0)
+		d++;
+
+	k = n - z;
+	if (k > d)
+		k = d;
+	if (k > VG_B58_LEAD_MAX)
+		k = VG_B58_LEAD_MAX;
+	if (!k)
+		return z;
+	q = vg_b58_lead(v, d, k);
+	for (i = z + k - 1; i >= z; i--) {
+		digits[i] = q % 58;
+		q /= 58;
+	}
+	return z + k;
+}
 
-research:
-	vp = vg_prefix_avl_search(&vcpp->vcp_avlroot, &vxcp->vxc_bntarg);
-	if (vp) {
-		if (vg_exec_context_upgrade_lock(vxcp))
-			goto research;
+/* (hi * 2^64 + lo) mod 58^VG_B58_LEAD_MAX, hi below the modulus */
+static INLINE uint64_t
+vg_b58_reduce(uint64_t hi, uint64_t lo)
+{
+	const vg_b58_pow_t *bp = &vg_b58_pow[VG_B58_LEAD_MAX];
+	uint64_t m = bp->bp_limb[0], a0, a1, ph, pl, t, q, r;
+	int j = -bp->bp_shift;
+
+	/* 58^VG_B58_LEAD_MAX has 59 bits, so a is x shifted left */
+	a0 = lo << j;
+	a1 = (hi << j) | (lo >> (64 - j));
+	vg_b58_mul64(a0, bp->bp_recip, &ph, &pl);
+	t = ph;
+	vg_b58_mul64(a1, bp->bp_recip, &ph, &pl);
+	t += pl;
+	q = a1 + ph + (t < pl);
+
+	/* q is a few low at most, so the remainder fits in 64 bits */
+	r = lo - (q * m);
+	while (r >= m)
+		r -= m;
+	return r;
+}
 
-		vg_exec_context_consolidate_key(vxcp);
-		vcpp->base.vc_output_match(&vcpp->base, vxcp->vxc_key,
-					   vp->vp_pattern);
+/*
+ * The last VG_B58_LEAD_MAX digits of the 25-byte address addr, as
+ * addr mod 58^VG_B58_LEAD_MAX.  Each step of Horner's rule divides a
+ * remainder and a limb, below 58^VG_B58_LEAD_MAX * 2^64, so the
+ * quotient fits in 64 bits and the reciprocal of vg_b58_lead applies.
+ */
+static INLINE uint64_t
+vg_b58_tail(const unsigned char *addr)
+{
+	uint64_t r;
 
-		vcpp->base.vc_found++;
+	r = vg_b58_reduce(addr[0], vg_prefix_load64(addr + 1));
+	r = vg_b58_reduce(r, vg_prefix_load64(addr + 9));
+	return vg_b58_reduce(r, vg_prefix_load64(addr + 17));
+}
+
+static void
+vg_prefix_bn2bin(const BIGNUM *bn, unsigned char *buf)
+{
+	int nbytes = BN_num_bytes(bn);
+	assert(nbytes <= 25);
+	memset(buf, 0, 25 - nbytes);
+	BN_bn2bin(bn, buf + (25 - nbytes));
+}
+
+static void
+vg_prefix_snapshot_free(vg_snapshot_t *vsp)
+{
+	vg_prefix_snapshot_t *vpsp = (vg_prefix_snapshot_t *) vsp;
+	vg_prefix_class_t *vpcp;
+
+	while (vpsp->vps_dead_classes) {
+		vpcp = vpsp->vps_dead_classes;
+		vpsp->vps_dead_classes = vpcp->vpc_next;
+		vg_prefix_class_free(vpcp);
+	}
+	free(vsp);
+}
+
+/* Take a cache line aligned array from the snapshot's block */
+static void *
+vg_prefix_snapshot_carve(unsigned char **pp, size_t size)
+{
+	void *res = *pp;
+	*pp += (size + 63) & ~(size_t) 63;
+	return res;
+}
+
+/*
+ * Allocate a snapshot of nranges ranges and ntrie trie nodes in one
+ * block.  dirbits of zero selects the Eytzinger search.
+ */
+static vg_prefix_snapshot_t *
+vg_prefix_snapshot_new(int nranges, int ntrie, int addrtype, int dirbits,
+		       int bitmapbits, int classbits)
+{
+	vg_prefix_snapshot_t *vpsp;
+	unsigned char *p;
+	size_t size;
+
+	size = 64 * 8;
+	if (dirbits) {
+		size += (nranges * sizeof(*vpsp->vps_low64)) +
+			((((size_t) 1 << dirbits) + 1) *
+			 sizeof(*vpsp->vps_dir)) +
+			((size_t) 1 << (bitmapbits - 3));
+	} else {
+		size += ((nranges + 1) * sizeof(*vpsp->vps_eytz)) +
+			((nranges + 1) * sizeof(*vpsp->vps_eytz_index));
+	}
+	if (classbits)
+		size += (size_t) 1 << (classbits - 3);
+	size += (nranges * sizeof(*vpsp->vps_high64)) +
+		(nranges * sizeof(*vpsp->vps_ranges)) +
+		(ntrie * sizeof(*vpsp->vps_trie));
+	vpsp = (vg_prefix_snapshot_t *) malloc(sizeof(*vpsp) + size);
+	if (!vpsp)
+		return NULL;
+
+	vg_snapshot_init(&vpsp->base, vg_prefix_snapshot_free, NULL);
+	vpsp->vps_nranges = nranges;
+	vpsp->vps_ntrie = ntrie;
+	vpsp->vps_lead = 0;
+	vpsp->vps_addrtype = addrtype;
+	vpsp->vps_dirbits = dirbits;
+	vpsp->vps_bitmapbits = bitmapbits;
+	vpsp->vps_classbits = classbits;
+	vpsp->vps_eytz = NULL;
+	vpsp->vps_eytz_index = NULL;
+	vpsp->vps_low64 = NULL;
+	vpsp->vps_dir = NULL;
+	vpsp->vps_bitmap = NULL;
+	vpsp->vps_class_bitmap = NULL;
+	vpsp->vps_dead_classes = NULL;
+
+	p = (unsigned char *) (((uintptr_t) (vpsp + 1) + 63) &
+			       ~(uintptr_t) 63);
+	vpsp->vps_data = p;
+	if (dirbits) {
+		vpsp->vps_bitmap = (uint64_t *) vg_prefix_snapshot_carve(
+			&p, (size_t) 1 << (bitmapbits - 3));
+		vpsp->vps_dir = (unsigned int *) vg_prefix_snapshot_carve(
+			&p, (((size_t) 1 << dirbits) + 1) *
+			sizeof(*vpsp->vps_dir));
+		vpsp->vps_low64 = (uint64_t *) vg_prefix_snapshot_carve(
+			&p, nranges * sizeof(*vpsp->vps_low64));
+	} else {
+		vpsp->vps_eytz = (uint64_t *) vg_prefix_snapshot_carve(
+			&p, (nranges + 1) * sizeof(*vpsp->vps_eytz));
+		vpsp->vps_eytz_index = (int *) vg_prefix_snapshot_carve(
+			&p, (nranges + 1) * sizeof(*vpsp->vps_eytz_index));
+	}
+	if (classbits)
+		vpsp->vps_class_bitmap = (uint64_t *)
+			vg_prefix_snapshot_carve(
+				&p, (size_t) 1 << (classbits - 3));
+	vpsp->vps_high64 = (uint64_t *) vg_prefix_snapshot_carve(
+		&p, nranges * sizeof(*vpsp->vps_high64));
+	vpsp->vps_ranges = (vg_prefix_range_t *) vg_prefix_snapshot_carve(
+		&p, nranges * sizeof(*vpsp->vps_ranges));
+	vpsp->vps_trie = (vg_prefix_trie_t *) vg_prefix_snapshot_carve(
+		&p, ntrie * sizeof(*vpsp->vps_trie));
+	vpsp->vps_size = p - vpsp->vps_data;
+	return vpsp;
+}
+
+static vg_snapshot_t *
+vg_prefix_snapshot_clone(vg_snapshot_t *vsp)
+{
+	vg_prefix_snapshot_t *vpsp = (vg_prefix_snapshot_t *) vsp;
+	vg_prefix_snapshot_t *copyp;
+
+	copyp = vg_prefix_snapshot_new(vpsp->vps_nranges, vpsp->vps_ntrie,
+				       vpsp->vps_addrtype, vpsp->vps_dirbits,
+				       vpsp->vps_bitmapbits,
+				       vpsp->vps_classbits);
+	if (!copyp)
+		return NULL;
+	copyp->vps_lead = vpsp->vps_lead;
+	memcpy(copyp->vps_data, vpsp->vps_data, vpsp->vps_size);
+	return &copyp->base;
+}
+
+/*
+ * Fill Eytzinger node k and its subtree from the sorted ranges,
+ * starting at range i, and return the range after the subtree
+ */
+static int
+vg_prefix_snapshot_eytzinger(vg_prefix_snapshot_t *vpsp, int i, int k)
+{
+	if (k <= vpsp->vps_nranges) {
+		i = vg_prefix_snapshot_eytzinger(vpsp, i, 2 * k);
+		vpsp->vps_eytz[k] =
+			vg_prefix_load64(vpsp->vps_ranges[i].vpr_low);
+		vpsp->vps_eytz_index[k] = i++;
+		i = vg_prefix_snapshot_eytzinger(vpsp, i, (2 * k) + 1);
+	}
+	return i;
+}
+
+/* Build the radix directory and the bitmap over the sorted ranges */
+static void
+vg_prefix_snapshot_radix(vg_prefix_snapshot_t *vpsp)
+{
+	int n = vpsp->vps_nranges, i;
+	uint64_t b, nbuckets, first, last;
+
+	for (i = 0; i < n; i++)
+		vpsp->vps_low64[i] =
+			vg_prefix_load64(vpsp->vps_ranges[i].vpr_low);
+
+	/* Bucket b starts at the first range starting in or after it */
+	nbuckets = (uint64_t) 1 << vpsp->vps_dirbits;
+	for (b = 0, i = 0; b <= nbuckets; b++) {
+		while ((i < n) &&
+		       (vg_prefix_radix(vpsp, vpsp->vps_low64[i],
+					vpsp->vps_dirbits) < b))
+			i++;
+		vpsp->vps_dir[b] = i;
+	}
+
+	memset(vpsp->vps_bitmap, 0,
+	       (size_t) 1 << (vpsp->vps_bitmapbits - 3));
+	for (i = 0; i < n; i++) {
+		first = vg_prefix_radix(vpsp, vpsp->vps_low64[i],
+					vpsp->vps_bitmapbits);
+		last = vg_prefix_radix(vpsp, vpsp->vps_high64[i],
+				       vpsp->vps_bitmapbits);
+		for (b = first; b <= last; b++)
+			vpsp->vps_bitmap[b >> 6] |= (uint64_t) 1 << (b & 63);
+	}
+}
+
+/*
+ * Build the trie of the prefixes with classes, which the context keeps
+ * in order, so the children of a node are added one after another
+ */
+static void
+vg_prefix_snapshot_trie(vg_prefix_snapshot_t *vpsp,
+			vg_prefix_class_t **classes, unsigned long nclasses)
+{
+	vg_prefix_trie_t *trie = vpsp->vps_trie, *vptp;
+	vg_prefix_class_t *vpcp, *prevp = NULL;
+	int path[VG_PREFIX_CLASS_LEN + 1];
+	uint64_t b, first, last;
+	unsigned long i;
+	int n = 1, l, j;
+
+	memset(vpsp->vps_class_bitmap, 0,
+	       (size_t) 1 << (vpsp->vps_classbits - 3));
+	for (i = 0; i < nclasses; i++) {
+		vpcp = classes[i];
+		for (j = 0; j < vpcp->vpc_nspans; j++) {
+			first = vg_prefix_radix(vpsp, vpcp->vpc_spans[2 * j],
+						vpsp->vps_classbits);
+			last = vg_prefix_radix(vpsp,
+					       vpcp->vpc_spans[(2 * j) + 1],
+					       vpsp->vps_classbits);
+			for (b = first; b <= last; b++)
+				vpsp->vps_class_bitmap[b >> 6] |=
+					(uint64_t) 1 << (b & 63);
+		}
+	}
+
+	memset(&trie[0], 0, sizeof(trie[0]));
+	path[0] = 0;
+	for (i = 0; i < nclasses; i++, prevp = vpcp) {
+		vpcp = classes[i];
+
+		/* Positions shared with the previous prefix */
+		for (l = 0;
+		     prevp && (l < vpcp->vpc_len) && (l < prevp->vpc_len) &&
+			     (vpcp->vpc_masks[l] == prevp->vpc_masks[l]);
+		     l++);
+
+		for (j = l; j < vpcp->vpc_len; j++) {
+			vptp = &trie[n];
+			vptp->vpt_mask = vpcp->vpc_masks[j];
+			vptp->vpt_children = 0;
+			vptp->vpt_child = 0;
+			vptp->vpt_next = 0;
+			vptp->vpt_class = NULL;
+			if ((j == l) && prevp && (l < prevp->vpc_len))
+				trie[path[j + 1]].vpt_next = n;
+			else
+				trie[path[j]].vpt_child = n;
+			trie[path[j]].vpt_children |= vptp->vpt_mask;
+			path[j + 1] = n++;
+		}
+		if (!trie[path[vpcp->vpc_len]].vpt_class)
+			trie[path[vpcp->vpc_len]].vpt_class = vpcp;
+		if (vpcp->vpc_len > vpsp->vps_lead)
+			vpsp->vps_lead = vpcp->vpc_len;
+	}
+}
+
+static vg_snapshot_t *
+vg_prefix_context_build_snapshot(vg_context_t *vcp)
+{
+	vg_prefix_context_t *vcpp = (vg_prefix_context_t *) vcp;
+	vg_prefix_snapshot_t *vpsp;
+	vg_prefix_range_t *vprp;
+	vg_prefix_t *vp;
+	unsigned long j;
+	int nranges = 0, ntrie = 0, nspans = 0, dirbits = 0, bitmapbits = 0;
+	int classbits = 0, i;
+
+	for (vp = vg_prefix_first(&vcpp->vcp_avlroot);
+	     vp != NULL;
+	     vp = vg_prefix_next(vp))
+		nranges++;
+	for (j = 0; j < vcpp->vcp_nclasses; j++) {
+		ntrie += vcpp->vcp_classes[j]->vpc_len;
+		nspans += vcpp->vcp_classes[j]->vpc_nspans;
+	}
+	if (ntrie) {
+		ntrie++;
+		for (classbits = VG_PREFIX_CLASS_BITS_MIN;
+		     (classbits < VG_PREFIX_BITMAP_MAX) &&
+			     ((1 << classbits) < (16 * nspans));
+		     classbits++);
+	}
+
+	/* About one range per bucket, and sixteen bitmap bits per range */
+	if (nranges >= VG_PREFIX_RADIX_MIN) {
+		for (dirbits = VG_PREFIX_DIR_MIN;
+		     (dirbits < VG_PREFIX_DIR_MAX) &&
+			     ((1 << dirbits) < nranges);
+		     dirbits++);
+		bitmapbits = dirbits + 4;
+		if (bitmapbits > VG_PREFIX_BITMAP_MAX)
+			bitmapbits = VG_PREFIX_BITMAP_MAX;
+	}
+
+	vpsp = vg_prefix_snapshot_new(nranges, ntrie, vcp->vc_addrtype,
+				      dirbits, bitmapbits, classbits);
+	if (!vpsp)
+		return NULL;
+	vpsp->base.vs_clone = vg_prefix_snapshot_clone;
+
+	for (vp = vg_prefix_first(&vcpp->vcp_avlroot), vprp = vpsp->vps_ranges;
+	     vp != NULL;
+	     vp = vg_prefix_next(vp), vprp++) {
+		vg_prefix_bn2bin(vp->vp_low, vprp->vpr_low);
+		vg_prefix_bn2bin(vp->vp_high, vprp->vpr_high);
+	}
+	for (i = 0; i < nranges; i++)
+		vpsp->vps_high64[i] =
+			vg_prefix_load64(vpsp->vps_ranges[i].vpr_high);
+	if (dirbits) {
+		vg_prefix_snapshot_radix(vpsp);
+	} else {
+		vpsp->vps_eytz[0] = 0;
+		vpsp->vps_eytz_index[0] = nranges;
+		vg_prefix_snapshot_eytzinger(vpsp, 0, 1);
+	}
+	if (ntrie)
+		vg_prefix_snapshot_trie(vpsp, vcpp->vcp_classes,
+					vcpp->vcp_nclasses);
+
+	if ((((dirbits << 8) | bitmapbits) != vcpp->vcp_index_shape) &&
+	    ((vcp->vc_verbose > 1) || (dirbits && (vcp->vc_verbose > 0)))) {
+		if (dirbits)
+			fprintf(stderr,
+				"Prefix index: %d ranges, %.1fMB, "
+				"2^%d bucket directory, 2^%d bit filter\n",
+				nranges, vpsp->vps_size / 1048576.0,
+				dirbits, bitmapbits);
+		else if (ntrie)
+			fprintf(stderr,
+				"Prefix index: %d ranges, %lu with classes, "
+				"%.1fKB\n",
+				nranges, vcpp->vcp_nclasses,
+				vpsp->vps_size / 1024.0);
+		else
+			fprintf(stderr,
+				"Prefix index: %d ranges, %.1fKB\n",
+				nranges, vpsp->vps_size / 1024.0);
+	}
+	vcpp->vcp_index_shape = (dirbits << 8) | bitmapbits;
+	return &vpsp->base;
+}
+
+/*
+ * Check the target against the last range whose leading key is at or
+ * below the target's, range i
+ */
+static INLINE int
+vg_prefix_snapshot_check(vg_prefix_snapshot_t *vpsp, int i, uint64_t t,
+			 const unsigned char *targ)
+{
+	vg_prefix_range_t *ranges = vpsp->vps_ranges;
+
+	if ((i < 0) || (t > vpsp->vps_high64[i]))
+		return 0;
+
+	/*
+	 * Rarely, the target may be in the range, or share its leading
+	 * bytes with the low bounds of this and earlier ranges
+	 */
+	while ((i >= 0) && (memcmp(ranges[i].vpr_low, targ, 25) > 0))
+		i--;
+	return (i >= 0) && (memcmp(targ, ranges[i].vpr_high, 25) <= 0);
+}
+
+static int
+vg_prefix_snapshot_search(vg_prefix_snapshot_t *vpsp,
+			  const unsigned char *targ)
+{
+	uint64_t t = vg_prefix_load64(targ), b;
+	int n = vpsp->vps_nranges, k, i, lo, hi, mid;
+
+	if (vpsp->vps_dirbits) {
+		/* Targets in a bucket no range touches miss outright */
+		b = vg_prefix_radix(vpsp, t, vpsp->vps_bitmapbits);
+		if (!(vpsp->vps_bitmap[b >> 6] & ((uint64_t) 1 << (b & 63))))
+			return 0;
+
+		/*
+		 * The last range starting at or below the leading key
+		 * starts in the target's bucket, or is the one before
+		 */
+		b = vg_prefix_radix(vpsp, t, vpsp->vps_dirbits);
+		lo = vpsp->vps_dir[b];
+		hi = vpsp->vps_dir[b + 1];
+		if ((int) (t >> 56) != vpsp->vps_addrtype) {
+			lo = 0;
+			hi = n;
+		}
+		while (lo < hi) {
+			mid = (lo + hi) / 2;
+			if (vpsp->vps_low64[mid] <= t)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		i = lo - 1;
+
+	} else {
+		/*
+		 * Find the first leading key above the target's,
+		 * prefetching the line of the node's descendants three
+		 * levels down.  The comparison only picks the child, so
+		 * the loop has no data-dependent branch.
+		 */
+		const uint64_t *eytz = vpsp->vps_eytz;
+
+		k = 1;
+		while (k <= n) {
+			vg_prefix_prefetch(eytz + (8 * k));
+			k = (2 * k) + (eytz[k] <= t);
+		}
+		k >>= vg_prefix_ffs(~k);
+
+		/* The last range starting at or below the leading key */
+		i = vpsp->vps_eytz_index[k] - 1;
+	}
+	return vg_prefix_snapshot_check(vpsp, i, t, targ);
+}
+
+/* First prefix below the trie node matching the leading digits */
+static vg_prefix_class_t *
+vg_prefix_trie_match(const vg_prefix_trie_t *trie, int node,
+		     const unsigned char *digits, int ndigits)
+{
+	vg_prefix_class_t *vpcp;
+	uint64_t bit;
+
+	if (!ndigits)
+		return NULL;
+	bit = (uint64_t) 1 << digits[0];
+	if (!(trie[node].vpt_children & bit))
+		return NULL;
+	for (node = trie[node].vpt_child; node; node = trie[node].vpt_next) {
+		if (!(trie[node].vpt_mask & bit))
+			continue;
+		if (trie[node].vpt_class)
+			return trie[node].vpt_class;
+		vpcp = vg_prefix_trie_match(trie, node, digits + 1,
+					    ndigits - 1);
+		if (vpcp)
+			return vpcp;
+	}
+	return NULL;
+}
+
+static vg_prefix_class_t *
+vg_prefix_snapshot_classes(vg_prefix_snapshot_t *vpsp,
+			   const unsigned char *targ)
+{
+	unsigned char digits[VG_PREFIX_CLASS_LEN];
+	uint64_t b;
+	int ndigits;
+
+	b = vg_prefix_radix(vpsp, vg_prefix_load64(targ),
+			    vpsp->vps_classbits);
+	if (!(vpsp->vps_class_bitmap[b >> 6] & ((uint64_t) 1 << (b & 63))))
+		return NULL;
+
+	ndigits = vg_b58_lead_digits(targ, vpsp->vps_lead, digits);
+	return vg_prefix_trie_match(vpsp->vps_trie, 0, digits, ndigits);
+}
+
+static void
+vg_prefix_context_clear_all_patterns(vg_context_t *vcp)
+{
+	vg_prefix_context_t *vcpp = (vg_prefix_context_t *) vcp;
+	vg_prefix_t *vp;
+	unsigned long npfx_left = 0;
+
+	while (!avl_root_empty(&vcpp->vcp_avlroot)) {
+		vp = avl_item_entry(vcpp->vcp_avlroot.ar_root,
+				    vg_prefix_t, vp_item);
+		vg_prefix_delete(&vcpp->vcp_avlroot, vp);
+		npfx_left++;
+	}
+	for (; vcpp->vcp_nclasses; npfx_left++)
+		vg_prefix_class_free(
+			vcpp->vcp_classes[--vcpp->vcp_nclasses]);
+
+	assert(npfx_left == vcpp->base.vc_npatterns);
+	vcpp->base.vc_npatterns = 0;
+	vcpp->base.vc_npatterns_start = 0;
+	vcpp->base.vc_found = 0;
+	BN_clear(&vcpp->vcp_difficulty);
+}
+
+static void
+vg_prefix_context_free(vg_context_t *vcp)
+{
+	vg_prefix_context_t *vcpp = (vg_prefix_context_t *) vcp;
+	vg_prefix_context_clear_all_patterns(vcp);
+	BN_clear_free(&vcpp->vcp_difficulty);
+	if (vcpp->vcp_classes)
+		free(vcpp->vcp_classes);
+	free(vcpp);
+}
+
+static void
+vg_prefix_context_next_difficulty(vg_prefix_context_t *vcpp,
+				  BIGNUM *bntmp, BIGNUM *bntmp2, BN_CTX *bnctx)
+{
+	char *dbuf;
+
+	BN_clear(bntmp);
+	BN_set_bit(bntmp, 192);
+	BN_div(bntmp2, NULL, bntmp, &vcpp->vcp_difficulty, bnctx);
+
+	dbuf = BN_bn2dec(bntmp2);
+	if (vcpp->base.vc_verbose > 0) {
+		if (vcpp->base.vc_npatterns > 1)
+			fprintf(stderr,
+				"Next match difficulty: %s (%ld prefixes)\n",
+				dbuf, vcpp->base.vc_npatterns);
+		else
+			fprintf(stderr, "Difficulty: %s\n", dbuf);
+	}
+	vcpp->base.vc_chance = atof(dbuf);
+	OPENSSL_free(dbuf);
+}
+
+/*
+ * Find the ranges of the first few positions of a prefix with classes,
+ * where the count of leading '1's and the leading digit decide them,
+ * for its filter and its size.  Each later position only scales the
+ * size by the number of characters it accepts.
+ */
+#define VG_PREFIX_CLASS_SPANS	64
+
+static int
+vg_prefix_class_ranges(vg_prefix_context_t *vcpp, vg_prefix_class_t *vpcp,
+		       BIGNUM *tmp1, BN_CTX *bnctx)
+{
+	prefix_class_iter_t classiter;
+	BIGNUM *ranges[4];
+	unsigned char bnbuf[25];
+	int nvariants, i, n, lead, ret;
+
+	for (lead = 0;
+	     (lead < vpcp->vpc_len) && (vpcp->vpc_masks[lead] == 1);
+	     lead++);
+	for (n = lead + 3; ; n--) {
+		if (n > vpcp->vpc_len)
+			n = vpcp->vpc_len;
+		for (i = 0, nvariants = 1; i < n; i++)
+			nvariants *= vg_prefix_mask_count(vpcp->vpc_masks[i]);
+		if ((nvariants <= VG_PREFIX_CLASS_SPANS) || (n <= lead + 1))
+			break;
+	}
+
+	vpcp->vpc_spans = (uint64_t *)
+		malloc(4 * nvariants * sizeof(*vpcp->vpc_spans));
+	if (!vpcp->vpc_spans)
+		return -1;
+	vpcp->vpc_size = BN_new();
+	BN_clear(vpcp->vpc_size);
+
+	prefix_class_iter_init(&classiter, vpcp->vpc_masks, n);
+	do {
+		ret = get_prefix_ranges(vcpp->base.vc_addrtype,
+					classiter.ci_prefix, ranges, bnctx);
+		if (ret == -2)
+			continue;
+		if (ret)
+			return ret;
+		for (i = 0; (i < 4) && ranges[i]; i += 2) {
+			BN_sub(tmp1, ranges[i + 1], ranges[i]);
+			BN_add(vpcp->vpc_size, vpcp->vpc_size, tmp1);
+			vg_prefix_bn2bin(ranges[i], bnbuf);
+			vpcp->vpc_spans[2 * vpcp->vpc_nspans] =
+				vg_prefix_load64(bnbuf);
+			vg_prefix_bn2bin(ranges[i + 1], bnbuf);
+			vpcp->vpc_spans[(2 * vpcp->vpc_nspans) + 1] =
+				vg_prefix_load64(bnbuf);
+			vpcp->vpc_nspans++;
+		}
+		free_ranges(ranges);
+	} while (prefix_class_iter_next(&classiter));
+
+	if (!vpcp->vpc_nspans)
+		return -2;
+	for (i = n; i < vpcp->vpc_len; i++) {
+		BN_mul_word(vpcp->vpc_size,
+			    vg_prefix_mask_count(vpcp->vpc_masks[i]));
+		BN_div_word(vpcp->vpc_size, 58);
+	}
+	return 0;
+}
+
+static int
+vg_prefix_context_add_patterns(vg_context_t *vcp,
+			       const char ** const patterns, int npatterns)
+{
+	vg_prefix_context_t *vcpp = (vg_prefix_context_t *) vcp;
+	prefix_class_iter_t classiter;
+	uint64_t masks[VG_PREFIX_CLASS_LEN];
+	vg_prefix_class_t *vpcp, **classes;
+	vg_prefix_t *vp, *vp2;
+	BN_CTX *bnctx;
+	BIGNUM bntmp, bntmp2, bntmp3;
+	BIGNUM *ranges[4];
+	double nvariants;
+	int ret = 0;
+	int i, j, len, lead, impossible = 0;
+	int class_impossible;
+	unsigned long npfx, k, n;
+	char *dbuf;
+
+	bnctx = BN_CTX_new();
+	BN_init(&bntmp);
+	BN_init(&bntmp2);
+	BN_init(&bntmp3);
+
+	npfx = 0;
+	for (i = 0; i < npatterns; i++) {
+		vp = NULL;
+		vpcp = NULL;
+		if (!vcpp->vcp_caseinsensitive &&
+		    !strchr(patterns[i], '[')) {
+			ret = get_prefix_ranges(vcpp->base.vc_addrtype,
+						patterns[i],
+						ranges, bnctx);
+			if (!ret) {
+				vp = vg_prefix_add_ranges(&vcpp->vcp_avlroot,
+							  patterns[i],
+							  ranges, NULL);
+			}
+			goto added;
+		}
+
+		len = vg_parse_classes(patterns[i], vcpp->vcp_caseinsensitive,
+				       masks, VG_PREFIX_CLASS_LEN, "prefix");
+		if (len == -2)
+			fprintf(stderr,
+				"Prefix '%s' is too long\n", patterns[i]);
+		if (len < 0)
+			continue;
+
+		nvariants = 1.0;
+		for (j = 0; j < len; j++)
+			nvariants *= vg_prefix_mask_count(masks[j]);
+		for (lead = 0; (lead < len) && (masks[lead] == 1); lead++);
+
+		if ((nvariants > 1.0) && !vcpp->vcp_expand_classes &&
+		    ((len - lead) <= VG_B58_LEAD_MAX)) {
+			/* Match the prefix by its leading digits */
+			vpcp = (vg_prefix_class_t *) malloc(sizeof(*vpcp));
+			if (!vpcp) {
+				ret = -1;
+				break;
+			}
+			memset(vpcp, 0, sizeof(*vpcp));
+			vpcp->vpc_pattern = patterns[i];
+			vpcp->vpc_caseinsensitive = vcpp->vcp_caseinsensitive;
+			vpcp->vpc_len = len;
+			memcpy(vpcp->vpc_masks, masks, len * sizeof(*masks));
+			ret = vg_prefix_class_ranges(vcpp, vpcp, &bntmp, bnctx);
+			if (ret) {
+				vg_prefix_class_free(vpcp);
+				vpcp = NULL;
+				goto added;
+			}
+
+			if (vcpp->vcp_nclasses == vcpp->vcp_classes_alloc) {
+				n = vcpp->vcp_classes_alloc ?
+					(2 * vcpp->vcp_classes_alloc) : 16;
+				classes = (vg_prefix_class_t **)
+					realloc(vcpp->vcp_classes,
+						n * sizeof(*classes));
+				if (!classes) {
+					vg_prefix_class_free(vpcp);
+					ret = -1;
+					break;
+				}
+				vcpp->vcp_classes = classes;
+				vcpp->vcp_classes_alloc = n;
+			}
+			vcpp->vcp_classes[vcpp->vcp_nclasses++] = vpcp;
+			BN_copy(&bntmp, vpcp->vpc_size);
+			goto counted;
+		}
+
+		/* Enumerate the prefix as ranges */
+		if (nvariants > 65536.0) {
+			fprintf(stderr,
+				"WARNING: Prefix '%s' has "
+				"%.0f derivatives\n",
+				patterns[i], nvariants);
+		}
+
+		class_impossible = 0;
+		prefix_class_iter_init(&classiter, masks, len);
+		do {
+			ret = get_prefix_ranges(vcpp->base.vc_addrtype,
+						classiter.ci_prefix,
+						ranges, bnctx);
+			if (ret == -2) {
+				class_impossible++;
+				ret = 0;
+				continue;
+			}
+			if (ret)
+				break;
+			vp2 = vg_prefix_add_ranges(&vcpp->vcp_avlroot,
+						   patterns[i],
+						   ranges,
+						   vp);
+			if (!vp2) {
+				ret = -1;
+				break;
+			}
+			if (!vp)
+				vp = vp2;
+
+		} while (prefix_class_iter_next(&classiter));
+
+		if (!vp && class_impossible)
+			ret = -2;
+
+		if (ret && vp) {
+			vg_prefix_delete(&vcpp->vcp_avlroot, vp);
+			vp = NULL;
+		}
+
+	added:
+		if (ret == -2) {
+			fprintf(stderr,
+				"Prefix '%s' not possible\n", patterns[i]);
+			impossible++;
+		}
+
+		if (!vp)
+			continue;
+
+		/* Checkpoints record how the pattern was expanded */
+		vp2 = vp;
+		do {
+			vp2->vp_caseinsensitive = vcpp->vcp_caseinsensitive;
+			vp2 = vp2->vp_sibling;
+		} while (vp2 && (vp2 != vp));
+
+		vg_prefix_range_sum(vp, &bntmp, &bntmp2);
+
+	counted:
+		npfx++;
+
+		/* Determine the probability of finding a match */
+		BN_add(&bntmp2, &vcpp->vcp_difficulty, &bntmp);
+		BN_copy(&vcpp->vcp_difficulty, &bntmp2);
+
+		if (vcp->vc_verbose > 1) {
+			BN_clear(&bntmp2);
+			BN_set_bit(&bntmp2, 192);
+			BN_div(&bntmp3, NULL, &bntmp2, &bntmp, bnctx);
+
+			dbuf = BN_bn2dec(&bntmp3);
+			fprintf(stderr,
+				"Prefix difficulty: %20s %s\n",
+				dbuf, patterns[i]);
+			OPENSSL_free(dbuf);
+		}
+	}
+
+	/*
+	 * Keep the prefixes with classes in order for the trie, and
+	 * drop repeats, which could never be matched
+	 */
+	if (vcpp->vcp_nclasses) {
+		qsort(vcpp->vcp_classes, vcpp->vcp_nclasses,
+		      sizeof(*vcpp->vcp_classes), vg_prefix_class_cmp);
+		for (k = 0, n = 0; k < vcpp->vcp_nclasses; k++) {
+			vpcp = vcpp->vcp_classes[k];
+			if (n && !vg_prefix_class_cmp(
+				    &vcpp->vcp_classes[n - 1], &vpcp)) {
+				fprintf(stderr,
+					"Prefix '%s' ignored, overlaps '%s'\n",
+					vpcp->vpc_pattern,
+					vcpp->vcp_classes[n - 1]->vpc_pattern);
+				BN_sub(&bntmp, &vcpp->vcp_difficulty,
+				       vpcp->vpc_size);
+				BN_copy(&vcpp->vcp_difficulty, &bntmp);
+				vg_prefix_class_free(vpcp);
+				npfx--;
+				continue;
+			}
+			vpcp->vpc_index = n;
+			vcpp->vcp_classes[n++] = vpcp;
+		}
+		vcpp->vcp_nclasses = n;
+	}
+
+	vcpp->base.vc_npatterns += npfx;
+	vcpp->base.vc_npatterns_start += npfx;
+
+	if (!npfx && impossible) {
+		const char *ats = "bitcoin", *bw = "\"1\"";
+		switch (vcpp->base.vc_addrtype) {
+		case 5:
+			ats = "bitcoin script";
+			bw = "\"3\"";
+			break;
+		case 111:
+			ats = "testnet";
+			bw = "\"m\" or \"n\"";
+			break;
+		case 52:
+			ats = "namecoin";
+			bw = "\"M\" or \"N\"";
+			break;
+		default:
+			break;
+		}
+		fprintf(stderr,
+			"Hint: valid %s addresses begin with %s\n", ats, bw);
+	}
+
+	if (npfx)
+		vg_prefix_context_next_difficulty(vcpp, &bntmp, &bntmp2, bnctx);
+
+	ret = (npfx != 0);
+
+	BN_clear_free(&bntmp);
+	BN_clear_free(&bntmp2);
+	BN_clear_free(&bntmp3);
+	BN_CTX_free(bnctx);
+	return ret;
+}
+
+double
+vg_prefix_get_difficulty(int addrtype, const char *pattern)
+{
+	BN_CTX *bnctx;
+	BIGNUM result, bntmp;
+	BIGNUM *ranges[4];
+	char *dbuf;
+	int ret;
+	double diffret = 0.0;
+
+	bnctx = BN_CTX_new();
+	BN_init(&result);
+	BN_init(&bntmp);
+
+	ret = get_prefix_ranges(addrtype,
+				pattern, ranges, bnctx);
+
+	if (ret == 0) {
+		BN_sub(&bntmp, ranges[1], ranges[0]);
+		BN_add(&result, &result, &bntmp);
+		if (ranges[2]) {
+			BN_sub(&bntmp, ranges[3], ranges[2]);
+			BN_add(&result, &result, &bntmp);
+		}
+		free_ranges(ranges);
+
+		BN_clear(&bntmp);
+		BN_set_bit(&bntmp, 192);
+		BN_div(&result, NULL, &bntmp, &result, bnctx);
+
+		dbuf = BN_bn2dec(&result);
+		diffret = strtod(dbuf, NULL);
+		OPENSSL_free(dbuf);
+	}
+
+	BN_clear_free(&result);
+	BN_clear_free(&bntmp);
+	BN_CTX_free(bnctx);
+	return diffret;
+}
+
+
+/*
+ * Confirm a snapshot hit in vxc_binres and handle the match.
+ * The snapshot may predate a removal by another thread, so
+ * look the match up again in the prefix tree itself.
+ */
+static int
+vg_prefix_test_match(vg_exec_context_t *vxcp)
+{
+	vg_prefix_context_t *vcpp = (vg_prefix_context_t *) vxcp->vxc_vc;
+	vg_prefix_t *vp;
+	int res = 0;
+
+	pthread_mutex_lock(&vg_pattern_lock);
+	BN_bin2bn(vxcp->vxc_binres, 25, &vxcp->vxc_bntarg);
+	vp = vg_prefix_avl_search(&vcpp->vcp_avlroot, &vxcp->vxc_bntarg);
+	if (vp) {
+		vg_exec_context_note_origin(vxcp);
+		vg_exec_context_consolidate_key(vxcp);
+		vcpp->base.vc_output_match(&vcpp->base, vxcp->vxc_key,
+					   vp->vp_pattern);
+
+		vcpp->base.vc_found++;
 
 		if (vcpp->base.vc_only_one) {
-			return 2;
+			res = 2;
+			goto out;
 		}
 
 		if (vcpp->base.vc_remove_on_match) {
@@ -1506,21 +3158,219 @@ research:
 			vg_prefix_delete(&vcpp->vcp_avlroot,vp);
 			vcpp->base.vc_npatterns--;
 
-			if (!avl_root_empty(&vcpp->vcp_avlroot))
+			if (!vg_prefix_context_empty(vcpp))
 				vg_prefix_context_next_difficulty(
 					vcpp, &vxcp->vxc_bntmp,
 					&vxcp->vxc_bntmp2,
 					vxcp->vxc_bnctx);
 			vcpp->base.vc_pattern_generation++;
+			vg_context_publish(&vcpp->base);
 		}
 		res = 1;
 	}
-	if (avl_root_empty(&vcpp->vcp_avlroot)) {
-		return 2;
+	if (vg_prefix_context_empty(vcpp))
+		res = 2;
+out:
+	pthread_mutex_unlock(&vg_pattern_lock);
+	return res;
+}
+
+/*
+ * Confirm a trie hit on the address with its check code, which the
+ * leading digits may depend on, and handle the match.  The snapshot
+ * may predate the removal of the prefix by another thread.
+ */
+static int
+vg_prefix_test_class(vg_exec_context_t *vxcp, vg_prefix_class_t *vpcp)
+{
+	vg_prefix_context_t *vcpp = (vg_prefix_context_t *) vxcp->vxc_vc;
+	vg_prefix_snapshot_t *vpsp_pub;
+	char addr[64];
+	unsigned long i;
+	int res = 0;
+
+	vg_b58_encode_check(vxcp->vxc_binres, 21, addr);
+	if (!vg_prefix_class_match(vpcp, addr))
+		return 0;
+
+	pthread_mutex_lock(&vg_pattern_lock);
+	i = vpcp->vpc_index;
+	if ((i < vcpp->vcp_nclasses) && (vcpp->vcp_classes[i] == vpcp)) {
+		vg_exec_context_note_origin(vxcp);
+		vg_exec_context_consolidate_key(vxcp);
+		vcpp->base.vc_output_match(&vcpp->base, vxcp->vxc_key,
+					   vpcp->vpc_pattern);
+
+		vcpp->base.vc_found++;
+
+		if (vcpp->base.vc_only_one) {
+			res = 2;
+			goto out;
+		}
+
+		if (vcpp->base.vc_remove_on_match) {
+			BN_sub(&vxcp->vxc_bntmp, &vcpp->vcp_difficulty,
+			       vpcp->vpc_size);
+			BN_copy(&vcpp->vcp_difficulty, &vxcp->vxc_bntmp);
+
+			/* Keep the table in order */
+			vcpp->vcp_nclasses--;
+			for (; i < vcpp->vcp_nclasses; i++) {
+				vcpp->vcp_classes[i] =
+					vcpp->vcp_classes[i + 1];
+				vcpp->vcp_classes[i]->vpc_index = i;
+			}
+			vpcp->vpc_index = (unsigned long) -1;
+			vcpp->base.vc_npatterns--;
+
+			if (!vg_prefix_context_empty(vcpp))
+				vg_prefix_context_next_difficulty(
+					vcpp, &vxcp->vxc_bntmp,
+					&vxcp->vxc_bntmp2,
+					vxcp->vxc_bnctx);
+			vcpp->base.vc_pattern_generation++;
+
+			/*
+			 * Threads may still be matching the prefix in
+			 * the published snapshot, so it is freed when
+			 * that snapshot is reclaimed.  If publishing
+			 * fails, the snapshot stays and collects more.
+			 */
+			vpsp_pub = (vg_prefix_snapshot_t *)
+				vcpp->base.vc_snapshot;
+			vpcp->vpc_next = vpsp_pub->vps_dead_classes;
+			vpsp_pub->vps_dead_classes = vpcp;
+			vg_context_publish(&vcpp->base);
+		}
+		res = 1;
 	}
+	if (vg_prefix_context_empty(vcpp))
+		res = 2;
+out:
+	pthread_mutex_unlock(&vg_pattern_lock);
 	return res;
 }
 
+static int
+vg_prefix_test(vg_exec_context_t *vxcp)
+{
+	vg_prefix_snapshot_t *vpsp;
+	vg_prefix_class_t *vpcp;
+
+	/*
+	 * We constrain the prefix so that we can check for
+	 * a match without generating the lower four byte
+	 * check code.
+	 */
+
+	vpsp = (vg_prefix_snapshot_t *) vxcp->vxc_snapshot;
+	if (!vpsp || (!vpsp->vps_nranges && !vpsp->vps_ntrie))
+		return 2;
+	if (vpsp->vps_nranges &&
+	    vg_prefix_snapshot_search(vpsp, vxcp->vxc_binres))
+		return vg_prefix_test_match(vxcp);
+	if (vpsp->vps_ntrie &&
+	    (vpcp = vg_prefix_snapshot_classes(vpsp, vxcp->vxc_binres)))
+		return vg_prefix_test_class(vxcp, vpcp);
+	return 0;
+}
+
+/*
+ * Batches are searched a group at a time.  The Eytzinger descents of a
+ * group run level by level, so their chains of loads overlap, and the
+ * radix index prefetches the bitmap word of the key a group ahead.
+ */
+#define VG_PREFIX_GROUP		8
+
+static int
+vg_prefix_test_batch(vg_exec_context_t *vxcp, const unsigned char *hashes,
+		     int n, int base_delta)
+{
+	vg_prefix_snapshot_t *vpsp;
+	vg_prefix_class_t *vpcp;
+	const uint64_t *eytz;
+	uint64_t t[VG_PREFIX_GROUP], b, ver;
+	int k[VG_PREFIX_GROUP];
+	int nvariants = vxcp->vxc_vc->vc_variants;
+	int i, j, g, m, d, depth, nranges, found, res;
+
+	vxcp->vxc_test_index = 0;
+	vpsp = (vg_prefix_snapshot_t *) vxcp->vxc_snapshot;
+	if (!vpsp || (!vpsp->vps_nranges && !vpsp->vps_ntrie))
+		return 2;
+
+	nranges = vpsp->vps_nranges;
+	eytz = vpsp->vps_eytz;
+	ver = (uint64_t) vxcp->vxc_binres[0] << 56;
+
+	/* Levels of the Eytzinger tree every descent goes through */
+	for (depth = 0; (((uint64_t) 2 << depth) - 1) <= nranges; depth++);
+
+	for (i = 0; i < n; i += VG_PREFIX_GROUP) {
+		m = ((n - i) < VG_PREFIX_GROUP) ? (n - i) : VG_PREFIX_GROUP;
+		for (g = 0; g < m; g++) {
+			t[g] = ver | (vg_prefix_load64(hashes +
+						       (20 * (i + g))) >> 8);
+			k[g] = 1;
+		}
+
+		if (vpsp->vps_dirbits) {
+			for (j = i + VG_PREFIX_GROUP;
+			     (j < n) && (j < i + (2 * VG_PREFIX_GROUP));
+			     j++) {
+				b = ver | (vg_prefix_load64(hashes + (20 * j))
+					   >> 8);
+				b = vg_prefix_radix(vpsp, b,
+						    vpsp->vps_bitmapbits);
+				vg_prefix_prefetch(&vpsp->vps_bitmap[b >> 6]);
+			}
+		} else {
+			for (d = 0; d < depth; d++) {
+				for (g = 0; g < m; g++) {
+					vg_prefix_prefetch(eytz + (8 * k[g]));
+					k[g] = (2 * k[g]) +
+						(eytz[k[g]] <= t[g]);
+				}
+			}
+		}
+
+		for (g = 0; g < m; g++) {
+			memcpy(&vxcp->vxc_binres[1],
+			       hashes + (20 * (i + g)), 20);
+			vpcp = NULL;
+			if (!nranges) {
+				found = 0;
+			} else if (vpsp->vps_dirbits) {
+				found = vg_prefix_snapshot_search(
+					vpsp, vxcp->vxc_binres);
+			} else {
+				/* Finish the descent as in the single search */
+				if (k[g] <= nranges)
+					k[g] = (2 * k[g]) +
+						(eytz[k[g]] <= t[g]);
+				k[g] >>= vg_prefix_ffs(~k[g]);
+				found = vg_prefix_snapshot_check(
+					vpsp,
+					vpsp->vps_eytz_index[k[g]] - 1,
+					t[g], vxcp->vxc_binres);
+			}
+			if (!found && vpsp->vps_ntrie)
+				vpcp = vg_prefix_snapshot_classes(
+					vpsp, vxcp->vxc_binres);
+			if (!found && !vpcp)
+				continue;
+			vxcp->vxc_delta = base_delta + ((i + g) / nvariants);
+			vxcp->vxc_variant = (i + g) % nvariants;
+			vxcp->vxc_test_index = i + g;
+			res = vpcp ? vg_prefix_test_class(vxcp, vpcp) :
+				vg_prefix_test_match(vxcp);
+			if (res)
+				return res;
+		}
+	}
+	return 0;
+}
+
 static int
 vg_prefix_hash160_sort(vg_context_t *vcp, void *buf)
 {
@@ -1569,6 +3419,58 @@ vg_prefix_hash160_sort(vg_context_t *vcp, void *buf)
 	return npfx;
 }
 
+static int
+vg_prefix_pattern_cmp(const void *a, const void *b)
+{
+	const vg_prefix_t *vpa = *(const vg_prefix_t **) a;
+	const vg_prefix_t *vpb = *(const vg_prefix_t **) b;
+
+	if (vpa->vp_pattern == vpb->vp_pattern)
+		return 0;
+	return (vpa->vp_pattern < vpb->vp_pattern) ? -1 : 1;
+}
+
+/*
+ * Write the remaining patterns for a checkpoint.  Every range of a
+ * pattern points at the same string, so sort the ranges by it and
+ * write each string once.  Called with vg_pattern_lock held.
+ */
+static void
+vg_prefix_context_write_patterns(vg_context_t *vcp, FILE *fp)
+{
+	vg_prefix_context_t *vcpp = (vg_prefix_context_t *) vcp;
+	vg_prefix_t *vp, **vps;
+	unsigned long i, n;
+
+	fprintf(fp, "type prefix\n");
+	for (i = 0; i < vcpp->vcp_nclasses; i++)
+		fprintf(fp, "%s %s\n",
+			vcpp->vcp_classes[i]->vpc_caseinsensitive ?
+			"ipattern" : "pattern",
+			vcpp->vcp_classes[i]->vpc_pattern);
+	for (n = 0, vp = vg_prefix_first(&vcpp->vcp_avlroot);
+	     vp != NULL;
+	     n++, vp = vg_prefix_next(vp));
+	if (!n)
+		return;
+	vps = (vg_prefix_t **) malloc(n * sizeof(*vps));
+	if (!vps)
+		return;
+	for (i = 0, vp = vg_prefix_first(&vcpp->vcp_avlroot);
+	     vp != NULL;
+	     i++, vp = vg_prefix_next(vp))
+		vps[i] = vp;
+	qsort(vps, n, sizeof(*vps), vg_prefix_pattern_cmp);
+	for (i = 0; i < n; i++) {
+		if (i && (vps[i]->vp_pattern == vps[i-1]->vp_pattern))
+			continue;
+		fprintf(fp, "%s %s\n",
+			vps[i]->vp_caseinsensitive ? "ipattern" : "pattern",
+			vps[i]->vp_pattern);
+	}
+	free(vps);
+}
+
 vg_context_t *
 vg_prefix_context_new(int addrtype, int privtype, int caseinsensitive)
 {
@@ -1587,11 +3489,19 @@ vg_prefix_context_new(int addrtype, int privtype, int caseinsensitive)
 		vcpp->base.vc_add_patterns = vg_prefix_context_add_patterns;
 		vcpp->base.vc_clear_all_patterns =
 			vg_prefix_context_clear_all_patterns;
+		vcpp->base.vc_variants = 1;
 		vcpp->base.vc_test = vg_prefix_test;
+		vcpp->base.vc_test_batch = vg_prefix_test_batch;
 		vcpp->base.vc_hash160_sort = vg_prefix_hash160_sort;
+		vcpp->base.vc_build_snapshot =
+			vg_prefix_context_build_snapshot;
+		vcpp->base.vc_write_patterns =
+			vg_prefix_context_write_patterns;
 		avl_root_init(&vcpp->vcp_avlroot);
 		BN_init(&vcpp->vcp_difficulty);
 		vcpp->vcp_caseinsensitive = caseinsensitive;
+		vcpp->vcp_index_shape = -1;
+		vg_b58_pow_init();
 	}
 	return &vcpp->base;
 }
@@ -1607,6 +3517,82 @@ typedef struct _vg_regex_context_s {
 	unsigned long		vcr_nalloc;
 } vg_regex_context_t;
 
+/*
+ * Regex snapshot: the compiled expressions of the store.  Every
+ * expression removed from the store while this was the published
+ * snapshot is marked in vrs_dead, and freed along with it.
+ */
+
+typedef struct _vg_regex_snapshot_s {
+	vg_snapshot_t		base;
+	int			vrs_npatterns;
+	pcre			**vrs_regex;
+	pcre_extra		**vrs_regex_extra;
+	unsigned char		*vrs_dead;
+} vg_regex_snapshot_t;
+
+static void
+vg_regex_snapshot_free(vg_snapshot_t *vsp)
+{
+	vg_regex_snapshot_t *vrsp = (vg_regex_snapshot_t *) vsp;
+	int i;
+
+	for (i = 0; i < vrsp->vrs_npatterns; i++) {
+		if (!vrsp->vrs_dead[i])
+			continue;
+		if (vrsp->vrs_regex_extra[i])
+			pcre_free(vrsp->vrs_regex_extra[i]);
+		pcre_free(vrsp->vrs_regex[i]);
+	}
+	free(vrsp);
+}
+
+static vg_snapshot_t *
+vg_regex_snapshot_new(int nres, pcre **regex, pcre_extra **regex_extra,
+		      vg_snapshot_clone_func_t clonefunc)
+{
+	vg_regex_snapshot_t *vrsp;
+
+	vrsp = (vg_regex_snapshot_t *)
+		malloc(sizeof(*vrsp) + (2 * nres * sizeof(void *)) + nres);
+	if (!vrsp)
+		return NULL;
+
+	vg_snapshot_init(&vrsp->base, vg_regex_snapshot_free, clonefunc);
+	vrsp->vrs_npatterns = nres;
+	vrsp->vrs_regex = (pcre **) (vrsp + 1);
+	vrsp->vrs_regex_extra = (pcre_extra **) &vrsp->vrs_regex[nres];
+	vrsp->vrs_dead = (unsigned char *) &vrsp->vrs_regex_extra[nres];
+	memset(vrsp->vrs_dead, 0, nres);
+	if (nres) {
+		memcpy(vrsp->vrs_regex, regex,
+		       nres * sizeof(*vrsp->vrs_regex));
+		memcpy(vrsp->vrs_regex_extra, regex_extra,
+		       nres * sizeof(*vrsp->vrs_regex_extra));
+	}
+	return &vrsp->base;
+}
+
+static vg_snapshot_t *
+vg_regex_snapshot_clone(vg_snapshot_t *vsp)
+{
+	vg_regex_snapshot_t *vrsp = (vg_regex_snapshot_t *) vsp;
+
+	/* The compiled expressions stay shared with the original */
+	return vg_regex_snapshot_new(vrsp->vrs_npatterns, vrsp->vrs_regex,
+				     vrsp->vrs_regex_extra, NULL);
+}
+
+static vg_snapshot_t *
+vg_regex_context_build_snapshot(vg_context_t *vcp)
+{
+	vg_regex_context_t *vcrp = (vg_regex_context_t *) vcp;
+
+	return vg_regex_snapshot_new(vcrp->base.vc_npatterns,
+				     vcrp->vcr_regex, vcrp->vcr_regex_extra,
+				     vg_regex_snapshot_clone);
+}
+
 static int
 vg_regex_context_add_patterns(vg_context_t *vcp,
 			      const char ** const patterns, int npatterns)
@@ -1646,199 +3632,1067 @@ vg_regex_context_add_patterns(vg_context_t *vcp,
 		vcrp->vcr_nalloc = count;
 	}
 
-	nres = vcrp->base.vc_npatterns;
+	nres = vcrp->base.vc_npatterns;
+	for (i = 0; i < npatterns; i++) {
+		vcrp->vcr_regex[nres] =
+			pcre_compile(patterns[i], 0,
+				     &pcre_errptr, &pcre_erroffset, NULL);
+		if (!vcrp->vcr_regex[nres]) {
+			const char *spaces = "                ";
+			fprintf(stderr, "%s\n", patterns[i]);
+			while (pcre_erroffset > 16) {
+				fprintf(stderr, "%s", spaces);
+				pcre_erroffset -= 16;
+			}
+			if (pcre_erroffset > 0)
+				fprintf(stderr,
+					"%s", &spaces[16 - pcre_erroffset]);
+			fprintf(stderr, "^\nRegex error: %s\n", pcre_errptr);
+			continue;
+		}
+		vcrp->vcr_regex_extra[nres] =
+			pcre_study(vcrp->vcr_regex[nres], 0, &pcre_errptr);
+		if (pcre_errptr) {
+			fprintf(stderr, "Regex error: %s\n", pcre_errptr);
+			pcre_free(vcrp->vcr_regex[nres]);
+			continue;
+		}
+		vcrp->vcr_regex_pat[nres] = patterns[i];
+		nres += 1;
+	}
+
+	if (nres == vcrp->base.vc_npatterns)
+		return 0;
+
+	vcrp->base.vc_npatterns_start += (nres - vcrp->base.vc_npatterns);
+	vcrp->base.vc_npatterns = nres;
+	return 1;
+}
+
+static void
+vg_regex_context_clear_all_patterns(vg_context_t *vcp)
+{
+	vg_regex_context_t *vcrp = (vg_regex_context_t *) vcp;
+	int i;
+	for (i = 0; i < vcrp->base.vc_npatterns; i++) {
+		if (vcrp->vcr_regex_extra[i])
+			pcre_free(vcrp->vcr_regex_extra[i]);
+		pcre_free(vcrp->vcr_regex[i]);
+	}
+	vcrp->base.vc_npatterns = 0;
+	vcrp->base.vc_npatterns_start = 0;
+	vcrp->base.vc_found = 0;
+}
+
+static void
+vg_regex_context_free(vg_context_t *vcp)
+{
+	vg_regex_context_t *vcrp = (vg_regex_context_t *) vcp;
+	vg_regex_context_clear_all_patterns(vcp);
+	if (vcrp->vcr_nalloc)
+		free(vcrp->vcr_regex);
+	free(vcrp);
+}
+
+static int
+vg_regex_test(vg_exec_context_t *vxcp)
+{
+	vg_regex_context_t *vcrp = (vg_regex_context_t *) vxcp->vxc_vc;
+	vg_regex_snapshot_t *vrsp, *vrsp_pub;
+
+	unsigned char hash1[32], hash2[32];
+	int i, j, zpfx, p, d, nres, re_vec[9];
+	char b58[40];
+	BIGNUM bnrem;
+	BIGNUM *bn, *bndiv, *bnptmp;
+	int res = 0;
+
+	pcre *re;
+
+	vrsp = (vg_regex_snapshot_t *) vxcp->vxc_snapshot;
+	nres = vrsp ? vrsp->vrs_npatterns : 0;
+	if (!nres)
+		return 2;
+
+	BN_init(&bnrem);
+
+	/* Hash the hash and write the four byte check code */
+	SHA256(vxcp->vxc_binres, 21, hash1);
+	SHA256(hash1, sizeof(hash1), hash2);
+	memcpy(&vxcp->vxc_binres[21], hash2, 4);
+
+	bn = &vxcp->vxc_bntmp;
+	bndiv = &vxcp->vxc_bntmp2;
+
+	BN_bin2bn(vxcp->vxc_binres, 25, bn);
+
+	/* Compute the complete encoded address */
+	for (zpfx = 0; zpfx < 25 && vxcp->vxc_binres[zpfx] == 0; zpfx++);
+	p = sizeof(b58) - 1;
+	b58[p] = '\0';
+	while (!BN_is_zero(bn)) {
+		BN_div(bndiv, &bnrem, bn, &vxcp->vxc_bnbase, vxcp->vxc_bnctx);
+		bnptmp = bn;
+		bn = bndiv;
+		bndiv = bnptmp;
+		d = BN_get_word(&bnrem);
+		b58[--p] = vg_b58_alphabet[d];
+	}
+	while (zpfx--) {
+		b58[--p] = vg_b58_alphabet[0];
+	}
+
+	/*
+	 * Run the regular expressions on it
+	 * SLOW, runs in linear time with the number of REs
+	 */
+	for (i = 0; i < nres; i++) {
+		d = pcre_exec(vrsp->vrs_regex[i],
+			      vrsp->vrs_regex_extra[i],
+			      &b58[p], (sizeof(b58) - 1) - p, 0,
+			      0,
+			      re_vec, sizeof(re_vec)/sizeof(re_vec[0]));
+
+		if (d <= 0) {
+			if (d != PCRE_ERROR_NOMATCH) {
+				fprintf(stderr, "PCRE error: %d\n", d);
+				res = 2;
+				goto out;
+			}
+			continue;
+		}
+
+		/*
+		 * The snapshot may predate a removal by another thread,
+		 * so find the expression in the store itself.
+		 */
+		re = vrsp->vrs_regex[i];
+		pthread_mutex_lock(&vg_pattern_lock);
+		for (j = 0;
+		     (j < vcrp->base.vc_npatterns) && (vcrp->vcr_regex[j] != re);
+		     j++);
+		if (j == vcrp->base.vc_npatterns) {
+			pthread_mutex_unlock(&vg_pattern_lock);
+			continue;
+		}
+
+		vg_exec_context_note_origin(vxcp);
+		vg_exec_context_consolidate_key(vxcp);
+		vcrp->base.vc_output_match(&vcrp->base, vxcp->vxc_key,
+					   vcrp->vcr_regex_pat[j]);
+		vcrp->base.vc_found++;
+
+		if (vcrp->base.vc_only_one) {
+			pthread_mutex_unlock(&vg_pattern_lock);
+			res = 2;
+			goto out;
+		}
+
+		if (vcrp->base.vc_remove_on_match) {
+			/*
+			 * Threads may still be running the expression
+			 * from the published snapshot, so it is freed
+			 * when that snapshot is reclaimed.  One added
+			 * since the last publish that succeeded is in
+			 * no snapshot, and is freed now.
+			 */
+			vrsp_pub = (vg_regex_snapshot_t *)
+				vcrp->base.vc_snapshot;
+			for (d = 0;
+			     (d < vrsp_pub->vrs_npatterns) &&
+				     (vrsp_pub->vrs_regex[d] != re);
+			     d++);
+			if (d < vrsp_pub->vrs_npatterns) {
+				vrsp_pub->vrs_dead[d] = 1;
+			} else {
+				if (vcrp->vcr_regex_extra[j])
+					pcre_free(vcrp->vcr_regex_extra[j]);
+				pcre_free(re);
+			}
+
+			d = vcrp->base.vc_npatterns - 1;
+			vcrp->vcr_regex[j] = vcrp->vcr_regex[d];
+			vcrp->vcr_regex_extra[j] = vcrp->vcr_regex_extra[d];
+			vcrp->vcr_regex_pat[j] = vcrp->vcr_regex_pat[d];
+			vcrp->base.vc_npatterns = d;
+			vcrp->base.vc_pattern_generation++;
+			vg_context_publish(&vcrp->base);
+			if (!d) {
+				pthread_mutex_unlock(&vg_pattern_lock);
+				res = 2;
+				goto out;
+			}
+		}
+		pthread_mutex_unlock(&vg_pattern_lock);
+		res = 1;
+	}
+out:
+	BN_clear_free(&bnrem);
+	return res;
+}
+
+static int
+vg_regex_test_batch(vg_exec_context_t *vxcp, const unsigned char *hashes,
+		    int n, int base_delta)
+{
+	vg_regex_snapshot_t *vrsp;
+	int nvariants = vxcp->vxc_vc->vc_variants;
+	int i, res;
+
+	vxcp->vxc_test_index = 0;
+	vrsp = (vg_regex_snapshot_t *) vxcp->vxc_snapshot;
+	if (!vrsp || !vrsp->vrs_npatterns)
+		return 2;
+
+	/*
+	 * Every address is encoded and run through the expressions,
+	 * so the single key test is the whole of the work
+	 */
+	for (i = 0; i < n; i++) {
+		memcpy(&vxcp->vxc_binres[1], hashes + (20 * i), 20);
+		vxcp->vxc_delta = base_delta + (i / nvariants);
+		vxcp->vxc_variant = i % nvariants;
+		vxcp->vxc_test_index = i;
+		res = vg_regex_test(vxcp);
+		if (res)
+			return res;
+	}
+	return 0;
+}
+
+/* Called with vg_pattern_lock held */
+static void
+vg_regex_context_write_patterns(vg_context_t *vcp, FILE *fp)
+{
+	vg_regex_context_t *vcrp = (vg_regex_context_t *) vcp;
+	unsigned long i;
+
+	fprintf(fp, "type regex\n");
+	for (i = 0; i < vcrp->base.vc_npatterns; i++)
+		fprintf(fp, "pattern %s\n", vcrp->vcr_regex_pat[i]);
+}
+
+vg_context_t *
+vg_regex_context_new(int addrtype, int privtype)
+{
+	vg_regex_context_t *vcrp;
+
+	vcrp = (vg_regex_context_t *) malloc(sizeof(*vcrp));
+	if (vcrp) {
+		memset(vcrp, 0, sizeof(*vcrp));
+		vcrp->base.vc_addrtype = addrtype;
+		vcrp->base.vc_privtype = privtype;
+		vcrp->base.vc_npatterns = 0;
+		vcrp->base.vc_npatterns_start = 0;
+		vcrp->base.vc_found = 0;
+		vcrp->base.vc_chance = 0.0;
+		vcrp->base.vc_free = vg_regex_context_free;
+		vcrp->base.vc_add_patterns = vg_regex_context_add_patterns;
+		vcrp->base.vc_clear_all_patterns =
+			vg_regex_context_clear_all_patterns;
+		vcrp->base.vc_variants = 1;
+		vcrp->base.vc_test = vg_regex_test;
+		vcrp->base.vc_test_batch = vg_regex_test_batch;
+		vcrp->base.vc_hash160_sort = NULL;
+		vcrp->base.vc_build_snapshot =
+			vg_regex_context_build_snapshot;
+		vcrp->base.vc_write_patterns =
+			vg_regex_context_write_patterns;
+		vcrp->vcr_regex = NULL;
+		vcrp->vcr_nalloc = 0;
+	}
+	return &vcrp->base;
+}
+
+
+/*
+ * Suffix matching
+ *
+ * The last k digits of an address are its 25-byte value, check code
+ * included, mod 58^k.  The check codes of a batch are found with the
+ * batched SHA-256, and the last VG_B58_LEAD_MAX digits with a fixed
+ * number of multiplications, leaving a hash table lookup per suffix
+ * length in use.  Suffixes are parsed like prefixes, and each variant
+ * of one goes in the table as its own value.
+ */
+
+#define VG_SUFFIX_LEN		VG_B58_LEAD_MAX
+#define VG_SUFFIX_VARIANTS	65536
+#define VG_SUFFIX_BATCH		64
+
+typedef struct _vg_suffix_s {
+	struct _vg_suffix_s	*vs_next;
+	const char		*vs_pattern;
+	int			vs_caseinsensitive;
+	int			vs_len;
+	int			vs_nkeys;
+	unsigned long		vs_index;
+	double			vs_chance;
+	uint64_t		*vs_keys;
+	uint64_t		vs_masks[VG_SUFFIX_LEN];
+} vg_suffix_t;
+
+typedef struct _vg_suffix_context_s {
+	vg_context_t		base;
+	vg_suffix_t		**vcs_suffixes;
+	unsigned long		vcs_nalloc;
+	int			vcs_caseinsensitive;
+	double			vcs_chance;
+} vg_suffix_context_t;
+
+static void
+vg_suffix_free(vg_suffix_t *vsp)
+{
+	if (vsp->vs_keys)
+		free(vsp->vs_keys);
+	free(vsp);
+}
+
+/* Hash table key of a suffix of len digits with value v */
+#define VG_SUFFIX_KEY(len, v)	(((uint64_t) (len) << 59) | (v))
+
+/*
+ * Suffix snapshot: an open addressing table of the keys of the
+ * suffixes, and the lengths that have any.  Suffixes removed from the
+ * store while this was the published snapshot are freed along with it.
+ */
+
+typedef struct _vg_suffix_entry_s {
+	uint64_t		vse_key;
+	vg_suffix_t		*vse_suffix;
+} vg_suffix_entry_t;
+
+typedef struct _vg_suffix_snapshot_s {
+	vg_snapshot_t		base;
+	int			vss_nsuffixes;
+	int			vss_bits;
+	unsigned int		vss_lengths;
+	uint64_t		vss_pow[VG_SUFFIX_LEN + 1];
+	vg_suffix_entry_t	*vss_table;
+	vg_suffix_t		*vss_dead;		/* List by vs_next */
+} vg_suffix_snapshot_t;
+
+static INLINE unsigned long
+vg_suffix_hash(const vg_suffix_snapshot_t *vssp, uint64_t key)
+{
+	return (unsigned long)
+		((key * 0x9e3779b97f4a7c15ULL) >> (64 - vssp->vss_bits));
+}
+
+static void
+vg_suffix_snapshot_free(vg_snapshot_t *vsp)
+{
+	vg_suffix_snapshot_t *vssp = (vg_suffix_snapshot_t *) vsp;
+	vg_suffix_t *deadp;
+
+	while (vssp->vss_dead) {
+		deadp = vssp->vss_dead;
+		vssp->vss_dead = deadp->vs_next;
+		vg_suffix_free(deadp);
+	}
+	free(vssp);
+}
+
+static vg_suffix_snapshot_t *
+vg_suffix_snapshot_new(int nsuffixes, int bits)
+{
+	vg_suffix_snapshot_t *vssp;
+	int i;
+
+	vssp = (vg_suffix_snapshot_t *)
+		malloc(sizeof(*vssp) +
+		       (((size_t) 1 << bits) * sizeof(*vssp->vss_table)));
+	if (!vssp)
+		return NULL;
+
+	vg_snapshot_init(&vssp->base, vg_suffix_snapshot_free, NULL);
+	vssp->vss_nsuffixes = nsuffixes;
+	vssp->vss_bits = bits;
+	vssp->vss_lengths = 0;
+	for (i = 0; i <= VG_SUFFIX_LEN; i++)
+		vssp->vss_pow[i] = vg_b58_pow[i].bp_limb[0];
+	vssp->vss_table = (vg_suffix_entry_t *) (vssp + 1);
+	vssp->vss_dead = NULL;
+	return vssp;
+}
+
+static vg_snapshot_t *
+vg_suffix_snapshot_clone(vg_snapshot_t *vsp)
+{
+	vg_suffix_snapshot_t *vssp = (vg_suffix_snapshot_t *) vsp;
+	vg_suffix_snapshot_t *copyp;
+
+	/* The suffixes stay shared with the original */
+	copyp = vg_suffix_snapshot_new(vssp->vss_nsuffixes, vssp->vss_bits);
+	if (!copyp)
+		return NULL;
+	copyp->vss_lengths = vssp->vss_lengths;
+	memcpy(copyp->vss_table, vssp->vss_table,
+	       ((size_t) 1 << vssp->vss_bits) * sizeof(*vssp->vss_table));
+	return &copyp->base;
+}
+
+static vg_snapshot_t *
+vg_suffix_context_build_snapshot(vg_context_t *vcp)
+{
+	vg_suffix_context_t *vcsp = (vg_suffix_context_t *) vcp;
+	vg_suffix_snapshot_t *vssp;
+	vg_suffix_t *vsp;
+	unsigned long i, h, nkeys = 0;
+	int j, bits;
+
+	for (i = 0; i < vcsp->base.vc_npatterns; i++)
+		nkeys += vcsp->vcs_suffixes[i]->vs_nkeys;
+
+	/* At most half full */
+	for (bits = 8; ((unsigned long) 1 << bits) < (2 * nkeys); bits++);
+
+	vssp = vg_suffix_snapshot_new(vcsp->base.vc_npatterns, bits);
+	if (!vssp)
+		return NULL;
+	vssp->base.vs_clone = vg_suffix_snapshot_clone;
+	memset(vssp->vss_table, 0,
+	       ((size_t) 1 << bits) * sizeof(*vssp->vss_table));
+
+	for (i = 0; i < vcsp->base.vc_npatterns; i++) {
+		vsp = vcsp->vcs_suffixes[i];
+		vssp->vss_lengths |= 1U << vsp->vs_len;
+		for (j = 0; j < vsp->vs_nkeys; j++) {
+			h = vg_suffix_hash(vssp, vsp->vs_keys[j]);
+			while (vssp->vss_table[h].vse_key &&
+			       (vssp->vss_table[h].vse_key != vsp->vs_keys[j]))
+				h = (h + 1) & (((unsigned long) 1 << bits) - 1);
+
+			/* Of suffixes sharing a value, the first is tried */
+			if (vssp->vss_table[h].vse_key)
+				continue;
+			vssp->vss_table[h].vse_key = vsp->vs_keys[j];
+			vssp->vss_table[h].vse_suffix = vsp;
+		}
+	}
+	return &vssp->base;
+}
+
+/* The suffix of the snapshot the address in addr ends with, if any */
+static vg_suffix_t *
+vg_suffix_snapshot_search(vg_suffix_snapshot_t *vssp,
+			  const unsigned char *addr)
+{
+	uint64_t tail, key;
+	unsigned long h;
+	unsigned int lengths;
+	int len;
+
+	tail = vg_b58_tail(addr);
+	for (lengths = vssp->vss_lengths; lengths; lengths &= lengths - 1) {
+		len = vg_prefix_ffs(lengths) - 1;
+		key = VG_SUFFIX_KEY(len, (len == VG_SUFFIX_LEN) ? tail :
+				    (tail % vssp->vss_pow[len]));
+		h = vg_suffix_hash(vssp, key);
+		while (vssp->vss_table[h].vse_key) {
+			if (vssp->vss_table[h].vse_key == key)
+				return vssp->vss_table[h].vse_suffix;
+			h = (h + 1) &
+				(((unsigned long) 1 << vssp->vss_bits) - 1);
+		}
+	}
+	return NULL;
+}
+
+void
+vg_suffix_context_set_case_insensitive(vg_context_t *vcp, int caseinsensitive)
+{
+	((vg_suffix_context_t *) vcp)->vcs_caseinsensitive = caseinsensitive;
+}
+
+static void
+vg_suffix_context_next_difficulty(vg_suffix_context_t *vcsp)
+{
+	vcsp->base.vc_chance = 1.0 / vcsp->vcs_chance;
+	if (vcsp->base.vc_verbose > 0) {
+		if (vcsp->base.vc_npatterns > 1)
+			fprintf(stderr,
+				"Next match difficulty: %.0f (%ld suffixes)\n",
+				vcsp->base.vc_chance,
+				vcsp->base.vc_npatterns);
+		else
+			fprintf(stderr, "Difficulty: %.0f\n",
+				vcsp->base.vc_chance);
+	}
+}
+
+static int
+vg_suffix_context_add_patterns(vg_context_t *vcp,
+			       const char ** const patterns, int npatterns)
+{
+	vg_suffix_context_t *vcsp = (vg_suffix_context_t *) vcp;
+	prefix_class_iter_t classiter;
+	uint64_t masks[VG_SUFFIX_LEN], v;
+	vg_suffix_t *vsp, **suffixes;
+	unsigned long count, nsfx;
+	double nvariants;
+	int i, j, len;
+
+	nsfx = vcsp->base.vc_npatterns;
 	for (i = 0; i < npatterns; i++) {
-		vcrp->vcr_regex[nres] =
-			pcre_compile(patterns[i], 0,
-				     &pcre_errptr, &pcre_erroffset, NULL);
-		if (!vcrp->vcr_regex[nres]) {
-			const char *spaces = "                ";
-			fprintf(stderr, "%s\n", patterns[i]);
-			while (pcre_erroffset > 16) {
-				fprintf(stderr, "%s", spaces);
-				pcre_erroffset -= 16;
-			}
-			if (pcre_erroffset > 0)
-				fprintf(stderr,
-					"%s", &spaces[16 - pcre_erroffset]);
-			fprintf(stderr, "^\nRegex error: %s\n", pcre_errptr);
+		len = vg_parse_classes(patterns[i], vcsp->vcs_caseinsensitive,
+				       masks, VG_SUFFIX_LEN, "suffix");
+		if (len == -2)
+			fprintf(stderr,
+				"Suffix '%s' is too long\n", patterns[i]);
+		if (len < 0)
+			continue;
+		if (!len) {
+			fprintf(stderr, "Empty suffix\n");
 			continue;
 		}
-		vcrp->vcr_regex_extra[nres] =
-			pcre_study(vcrp->vcr_regex[nres], 0, &pcre_errptr);
-		if (pcre_errptr) {
-			fprintf(stderr, "Regex error: %s\n", pcre_errptr);
-			pcre_free(vcrp->vcr_regex[nres]);
+
+		nvariants = 1.0;
+		for (j = 0; j < len; j++)
+			nvariants *= vg_prefix_mask_count(masks[j]);
+		if (nvariants > VG_SUFFIX_VARIANTS) {
+			fprintf(stderr,
+				"Suffix '%s' has too many variants\n",
+				patterns[i]);
 			continue;
 		}
-		vcrp->vcr_regex_pat[nres] = patterns[i];
-		nres += 1;
+
+		if (nsfx == vcsp->vcs_nalloc) {
+			count = vcsp->vcs_nalloc ? (2 * vcsp->vcs_nalloc) : 16;
+			suffixes = (vg_suffix_t **)
+				realloc(vcsp->vcs_suffixes,
+					count * sizeof(*suffixes));
+			if (!suffixes)
+				break;
+			vcsp->vcs_suffixes = suffixes;
+			vcsp->vcs_nalloc = count;
+		}
+
+		vsp = (vg_suffix_t *) malloc(sizeof(*vsp));
+		if (!vsp)
+			break;
+		memset(vsp, 0, sizeof(*vsp));
+		vsp->vs_keys = (uint64_t *)
+			malloc((size_t) nvariants * sizeof(*vsp->vs_keys));
+		if (!vsp->vs_keys) {
+			vg_suffix_free(vsp);
+			break;
+		}
+		vsp->vs_pattern = patterns[i];
+		vsp->vs_caseinsensitive = vcsp->vcs_caseinsensitive;
+		vsp->vs_len = len;
+		memcpy(vsp->vs_masks, masks, len * sizeof(*masks));
+
+		prefix_class_iter_init(&classiter, masks, len);
+		do {
+			for (j = 0, v = 0; j < len; j++)
+				v = (v * 58) + vg_b58_reverse_map[
+					(int) classiter.ci_prefix[j]];
+			vsp->vs_keys[vsp->vs_nkeys++] = VG_SUFFIX_KEY(len, v);
+		} while (prefix_class_iter_next(&classiter));
+
+		/* The last digits are all but uniform */
+		vsp->vs_chance = nvariants /
+			(double) vg_b58_pow[len].bp_limb[0];
+		vcsp->vcs_chance += vsp->vs_chance;
+
+		if (vcp->vc_verbose > 1)
+			fprintf(stderr,
+				"Suffix difficulty: %20.0f %s\n",
+				1.0 / vsp->vs_chance, patterns[i]);
+
+		vsp->vs_index = nsfx;
+		vcsp->vcs_suffixes[nsfx++] = vsp;
 	}
 
-	if (nres == vcrp->base.vc_npatterns)
+	if (nsfx == vcsp->base.vc_npatterns)
 		return 0;
 
-	vcrp->base.vc_npatterns_start += (nres - vcrp->base.vc_npatterns);
-	vcrp->base.vc_npatterns = nres;
+	vcsp->base.vc_npatterns_start += (nsfx - vcsp->base.vc_npatterns);
+	vcsp->base.vc_npatterns = nsfx;
+	vg_suffix_context_next_difficulty(vcsp);
 	return 1;
 }
 
 static void
-vg_regex_context_clear_all_patterns(vg_context_t *vcp)
+vg_suffix_context_clear_all_patterns(vg_context_t *vcp)
 {
-	vg_regex_context_t *vcrp = (vg_regex_context_t *) vcp;
-	int i;
-	for (i = 0; i < vcrp->base.vc_npatterns; i++) {
-		if (vcrp->vcr_regex_extra[i])
-			pcre_free(vcrp->vcr_regex_extra[i]);
-		pcre_free(vcrp->vcr_regex[i]);
-	}
-	vcrp->base.vc_npatterns = 0;
-	vcrp->base.vc_npatterns_start = 0;
-	vcrp->base.vc_found = 0;
+	vg_suffix_context_t *vcsp = (vg_suffix_context_t *) vcp;
+	unsigned long i;
+
+	for (i = 0; i < vcsp->base.vc_npatterns; i++)
+		vg_suffix_free(vcsp->vcs_suffixes[i]);
+	vcsp->base.vc_npatterns = 0;
+	vcsp->base.vc_npatterns_start = 0;
+	vcsp->base.vc_found = 0;
+	vcsp->vcs_chance = 0.0;
 }
 
 static void
-vg_regex_context_free(vg_context_t *vcp)
+vg_suffix_context_free(vg_context_t *vcp)
 {
-	vg_regex_context_t *vcrp = (vg_regex_context_t *) vcp;
-	vg_regex_context_clear_all_patterns(vcp);
-	if (vcrp->vcr_nalloc)
-		free(vcrp->vcr_regex);
-	free(vcrp);
+	vg_suffix_context_t *vcsp = (vg_suffix_context_t *) vcp;
+	vg_suffix_context_clear_all_patterns(vcp);
+	if (vcsp->vcs_suffixes)
+		free(vcsp->vcs_suffixes);
+	free(vcsp);
 }
 
+/*
+ * Confirm a snapshot hit on the address in vxc_binres, check code
+ * included, and handle the match.  The snapshot may predate the
+ * removal of the suffix by another thread.
+ */
 static int
-vg_regex_test(vg_exec_context_t *vxcp)
+vg_suffix_test_match(vg_exec_context_t *vxcp, vg_suffix_t *vsp)
 {
-	vg_regex_context_t *vcrp = (vg_regex_context_t *) vxcp->vxc_vc;
+	vg_suffix_context_t *vcsp = (vg_suffix_context_t *) vxcp->vxc_vc;
+	vg_suffix_snapshot_t *vssp_pub;
+	char addr[64];
+	unsigned long i, last;
+	int j, n, c, res = 0;
+
+	vg_b58_encode_check(vxcp->vxc_binres, 21, addr);
+	n = strlen(addr) - vsp->vs_len;
+	for (j = 0; j < vsp->vs_len; j++) {
+		c = vg_b58_reverse_map[(int)(unsigned char) addr[n + j]];
+		if ((c == -1) || !(vsp->vs_masks[j] & ((uint64_t) 1 << c)))
+			return 0;
+	}
 
-	unsigned char hash1[32], hash2[32];
-	int i, zpfx, p, d, nres, re_vec[9];
-	char b58[40];
-	BIGNUM bnrem;
-	BIGNUM *bn, *bndiv, *bnptmp;
-	int res = 0;
+	pthread_mutex_lock(&vg_pattern_lock);
+	i = vsp->vs_index;
+	if ((i < vcsp->base.vc_npatterns) && (vcsp->vcs_suffixes[i] == vsp)) {
+		vg_exec_context_note_origin(vxcp);
+		vg_exec_context_consolidate_key(vxcp);
+		vcsp->base.vc_output_match(&vcsp->base, vxcp->vxc_key,
+					   vsp->vs_pattern);
 
-	pcre *re;
+		vcsp->base.vc_found++;
 
-	BN_init(&bnrem);
+		if (vcsp->base.vc_only_one) {
+			res = 2;
+			goto out;
+		}
+
+		if (vcsp->base.vc_remove_on_match) {
+			vcsp->vcs_chance -= vsp->vs_chance;
+
+			last = vcsp->base.vc_npatterns - 1;
+			vcsp->vcs_suffixes[i] = vcsp->vcs_suffixes[last];
+			vcsp->vcs_suffixes[i]->vs_index = i;
+			vsp->vs_index = (unsigned long) -1;
+			vcsp->base.vc_npatterns = last;
+
+			if (vcsp->base.vc_npatterns)
+				vg_suffix_context_next_difficulty(vcsp);
+			vcsp->base.vc_pattern_generation++;
+
+			/*
+			 * Threads may still be looking the suffix up in
+			 * the published snapshot, so it is freed when
+			 * that snapshot is reclaimed.  If publishing
+			 * fails, the snapshot stays and collects more.
+			 */
+			vssp_pub = (vg_suffix_snapshot_t *)
+				vcsp->base.vc_snapshot;
+			vsp->vs_next = vssp_pub->vss_dead;
+			vssp_pub->vss_dead = vsp;
+			vg_context_publish(&vcsp->base);
+		}
+		res = 1;
+	}
+	if (!vcsp->base.vc_npatterns)
+		res = 2;
+out:
+	pthread_mutex_unlock(&vg_pattern_lock);
+	return res;
+}
+
+static int
+vg_suffix_test(vg_exec_context_t *vxcp)
+{
+	vg_suffix_snapshot_t *vssp;
+	vg_suffix_t *vsp;
+	unsigned char hash1[32], hash2[32];
+
+	vssp = (vg_suffix_snapshot_t *) vxcp->vxc_snapshot;
+	if (!vssp || !vssp->vss_nsuffixes)
+		return 2;
 
-	/* Hash the hash and write the four byte check code */
 	SHA256(vxcp->vxc_binres, 21, hash1);
 	SHA256(hash1, sizeof(hash1), hash2);
 	memcpy(&vxcp->vxc_binres[21], hash2, 4);
 
-	bn = &vxcp->vxc_bntmp;
-	bndiv = &vxcp->vxc_bntmp2;
+	vsp = vg_suffix_snapshot_search(vssp, vxcp->vxc_binres);
+	if (!vsp)
+		return 0;
+	return vg_suffix_test_match(vxcp, vsp);
+}
 
-	BN_bin2bn(vxcp->vxc_binres, 25, bn);
+static int
+vg_suffix_test_batch(vg_exec_context_t *vxcp, const unsigned char *hashes,
+		     int n, int base_delta)
+{
+	vg_suffix_snapshot_t *vssp;
+	vg_suffix_t *vsp;
+	unsigned char msgs[VG_SUFFIX_BATCH * 21], checks[VG_SUFFIX_BATCH * 4];
+	int nvariants = vxcp->vxc_vc->vc_variants;
+	int i, g, m, res;
+
+	vxcp->vxc_test_index = 0;
+	vssp = (vg_suffix_snapshot_t *) vxcp->vxc_snapshot;
+	if (!vssp || !vssp->vss_nsuffixes)
+		return 2;
 
-	/* Compute the complete encoded address */
-	for (zpfx = 0; zpfx < 25 && vxcp->vxc_binres[zpfx] == 0; zpfx++);
-	p = sizeof(b58) - 1;
-	b58[p] = '\0';
-	while (!BN_is_zero(bn)) {
-		BN_div(bndiv, &bnrem, bn, &vxcp->vxc_bnbase, vxcp->vxc_bnctx);
-		bnptmp = bn;
-		bn = bndiv;
-		bndiv = bnptmp;
-		d = BN_get_word(&bnrem);
-		b58[--p] = vg_b58_alphabet[d];
-	}
-	while (zpfx--) {
-		b58[--p] = vg_b58_alphabet[0];
+	for (i = 0; i < n; i += VG_SUFFIX_BATCH) {
+		m = ((n - i) < VG_SUFFIX_BATCH) ? (n - i) : VG_SUFFIX_BATCH;
+		for (g = 0; g < m; g++) {
+			msgs[21 * g] = vxcp->vxc_binres[0];
+			memcpy(&msgs[(21 * g) + 1], hashes + (20 * (i + g)), 20);
+		}
+		vg_checksum_batch(checks, msgs, 21, 21, m);
+
+		for (g = 0; g < m; g++) {
+			memcpy(vxcp->vxc_binres, &msgs[21 * g], 21);
+			memcpy(&vxcp->vxc_binres[21], &checks[4 * g], 4);
+			vsp = vg_suffix_snapshot_search(vssp,
+							vxcp->vxc_binres);
+			if (!vsp)
+				continue;
+			vxcp->vxc_delta = base_delta + ((i + g) / nvariants);
+			vxcp->vxc_variant = (i + g) % nvariants;
+			vxcp->vxc_test_index = i + g;
+			res = vg_suffix_test_match(vxcp, vsp);
+			if (res)
+				return res;
+		}
 	}
+	return 0;
+}
 
-	/*
-	 * Run the regular expressions on it
-	 * SLOW, runs in linear time with the number of REs
-	 */
-restart_loop:
-	nres = vcrp->base.vc_npatterns;
-	if (!nres) {
-		res = 2;
-		goto out;
+/* Called with vg_pattern_lock held */
+static void
+vg_suffix_context_write_patterns(vg_context_t *vcp, FILE *fp)
+{
+	vg_suffix_context_t *vcsp = (vg_suffix_context_t *) vcp;
+	unsigned long i;
+
+	fprintf(fp, "type suffix\n");
+	for (i = 0; i < vcsp->base.vc_npatterns; i++)
+		fprintf(fp, "%s %s\n",
+			vcsp->vcs_suffixes[i]->vs_caseinsensitive ?
+			"ipattern" : "pattern",
+			vcsp->vcs_suffixes[i]->vs_pattern);
+}
+
+vg_context_t *
+vg_suffix_context_new(int addrtype, int privtype, int caseinsensitive)
+{
+	vg_suffix_context_t *vcsp;
+
+	vcsp = (vg_suffix_context_t *) malloc(sizeof(*vcsp));
+	if (vcsp) {
+		memset(vcsp, 0, sizeof(*vcsp));
+		vcsp->base.vc_addrtype = addrtype;
+		vcsp->base.vc_privtype = privtype;
+		vcsp->base.vc_npatterns = 0;
+		vcsp->base.vc_npatterns_start = 0;
+		vcsp->base.vc_found = 0;
+		vcsp->base.vc_chance = 0.0;
+		vcsp->base.vc_free = vg_suffix_context_free;
+		vcsp->base.vc_add_patterns = vg_suffix_context_add_patterns;
+		vcsp->base.vc_clear_all_patterns =
+			vg_suffix_context_clear_all_patterns;
+		vcsp->base.vc_variants = 1;
+		vcsp->base.vc_test = vg_suffix_test;
+		vcsp->base.vc_test_batch = vg_suffix_test_batch;
+		vcsp->base.vc_hash160_sort = NULL;
+		vcsp->base.vc_build_snapshot =
+			vg_suffix_context_build_snapshot;
+		vcsp->base.vc_write_patterns =
+			vg_suffix_context_write_patterns;
+		vcsp->vcs_caseinsensitive = caseinsensitive;
+		vg_b58_pow_init();
 	}
-	for (i = 0; i < nres; i++) {
-		d = pcre_exec(vcrp->vcr_regex[i],
-			      vcrp->vcr_regex_extra[i],
-			      &b58[p], (sizeof(b58) - 1) - p, 0,
-			      0,
-			      re_vec, sizeof(re_vec)/sizeof(re_vec[0]));
+	return &vcsp->base;
+}
 
-		if (d <= 0) {
-			if (d != PCRE_ERROR_NOMATCH) {
-				fprintf(stderr, "PCRE error: %d\n", d);
-				res = 2;
-				goto out;
-			}
-			continue;
-		}
 
-		re = vcrp->vcr_regex[i];
+/*
+ * Checkpoints
+ *
+ * A checkpoint is a text file of "name value" lines with the
+ * accounting of a search, its remaining patterns, and for a seeded
+ * key schedule the first run of each unit that was not finished.
+ * A resumed seeded search redoes the runs that were in progress, so
+ * no key is skipped.  A random search keeps no position, a new random
+ * run being as good as the old one.
+ */
 
-		if (vg_exec_context_upgrade_lock(vxcp) &&
-		    ((i >= vcrp->base.vc_npatterns) ||
-		     (vcrp->vcr_regex[i] != re)))
-			goto restart_loop;
+static long
+vg_file_size(const char *path)
+{
+	FILE *fp;
+	long size = -1;
+
+	fp = fopen(path, "rb");
+	if (fp) {
+		if (!fseek(fp, 0, SEEK_END))
+			size = ftell(fp);
+		fclose(fp);
+	}
+	return size;
+}
 
-		vg_exec_context_consolidate_key(vxcp);
-		vcrp->base.vc_output_match(&vcrp->base, vxcp->vxc_key,
-					   vcrp->vcr_regex_pat[i]);
-		vcrp->base.vc_found++;
+/*
+ * Write a checkpoint to a temporary file and rename it over the
+ * previous one, so that an interruption leaves one of them intact
+ */
+int
+vg_context_write_checkpoint(vg_context_t *vcp, unsigned long long total,
+			    unsigned long long sincelast)
+{
+	vg_exec_context_t *tp;
+	unsigned char seedhash[32];
+	char tmpname[1024];
+	unsigned long u;
+	long outpos;
+	FILE *fp;
+	int i, res;
+
+	snprintf(tmpname, sizeof(tmpname), "%s.tmp", vcp->vc_checkpoint_file);
+	fp = fopen(tmpname, "w");
+	if (!fp) {
+		fprintf(stderr, "ERROR: could not write checkpoint %s: %s\n",
+			tmpname, strerror(errno));
+		return 0;
+	}
 
-		if (vcrp->base.vc_only_one) {
-			res = 2;
-			goto out;
-		}
+	pthread_mutex_lock(&vg_pattern_lock);
+	fprintf(fp, "vanitygen-checkpoint 1\n");
+	fprintf(fp, "addrtype %d\n", vcp->vc_addrtype);
+	fprintf(fp, "total %llu\n", total);
+	fprintf(fp, "sincelast %llu\n", sincelast);
+	fprintf(fp, "found %llu\n", vcp->vc_found);
+	fprintf(fp, "patterns %ld\n", vcp->vc_npatterns_start);
+	if (vcp->vc_result_file) {
+		outpos = vg_file_size(vcp->vc_result_file);
+		if (outpos >= 0)
+			fprintf(fp, "outpos %ld\n", outpos);
+	}
+	if (vcp->vc_seeded) {
+		/* Identify the seed without storing it */
+		SHA256(vcp->vc_seed, sizeof(vcp->vc_seed), seedhash);
+		fprintf(fp, "seed ");
+		for (i = 0; i < 32; i++)
+			fprintf(fp, "%02x", seedhash[i]);
+		fprintf(fp, "\nworker %lu\n", vcp->vc_worker);
 
-		if (vcrp->base.vc_remove_on_match) {
-			pcre_free(vcrp->vcr_regex[i]);
-			if (vcrp->vcr_regex_extra[i])
-				pcre_free(vcrp->vcr_regex_extra[i]);
-			nres -= 1;
-			vcrp->base.vc_npatterns = nres;
-			if (!nres) {
-				res = 2;
-				goto out;
-			}
-			vcrp->vcr_regex[i] = vcrp->vcr_regex[nres];
-			vcrp->vcr_regex_extra[i] =
-				vcrp->vcr_regex_extra[nres];
-			vcrp->vcr_regex_pat[i] = vcrp->vcr_regex_pat[nres];
-			vcrp->base.vc_npatterns = nres;
-			vcrp->base.vc_pattern_generation++;
+		pthread_mutex_lock(&vg_thread_lock);
+		for (tp = vcp->vc_threads; tp != NULL; tp = tp->vxc_next) {
+			if (tp->vxc_unit != VG_UNIT_NONE)
+				fprintf(fp, "unit %lu %llu\n", tp->vxc_unit,
+					vg_load_relaxed(&tp->vxc_resume_run));
 		}
-		res = 1;
+		/* Units of an earlier run that nothing has taken over */
+		for (u = vcp->vc_nunits; u < vcp->vc_nresume; u++)
+			fprintf(fp, "unit %lu %llu\n",
+				u, vcp->vc_resume_runs[u]);
+		pthread_mutex_unlock(&vg_thread_lock);
+	}
+	vcp->vc_write_patterns(vcp, fp);
+	pthread_mutex_unlock(&vg_pattern_lock);
+
+	res = !fflush(fp) && !ferror(fp);
+#if !defined(_WIN32)
+	if (res)
+		res = !fsync(fileno(fp));
+#endif
+	if (fclose(fp))
+		res = 0;
+#if defined(_WIN32)
+	if (res)
+		remove(vcp->vc_checkpoint_file);
+#endif
+	if (res && rename(tmpname, vcp->vc_checkpoint_file))
+		res = 0;
+	if (!res) {
+		fprintf(stderr, "ERROR: could not write checkpoint %s: %s\n",
+			vcp->vc_checkpoint_file, strerror(errno));
+		remove(tmpname);
 	}
-out:
-	BN_clear_free(&bnrem);
 	return res;
 }
 
-vg_context_t *
-vg_regex_context_new(int addrtype, int privtype)
+static int
+vg_context_resume_patterns(vg_context_t *vcp, const char **patterns,
+			   int npatterns, int caseinsensitive)
 {
-	vg_regex_context_t *vcrp;
+	if (!npatterns)
+		return 1;
+	if (vcp->vc_test == vg_suffix_test)
+		vg_suffix_context_set_case_insensitive(vcp, caseinsensitive);
+	else if (vcp->vc_test != vg_regex_test)
+		vg_prefix_context_set_case_insensitive(vcp, caseinsensitive);
+	else if (caseinsensitive)
+		return 0;
+	return vg_context_add_patterns(vcp, patterns, npatterns);
+}
 
-	vcrp = (vg_regex_context_t *) malloc(sizeof(*vcrp));
-	if (vcrp) {
-		memset(vcrp, 0, sizeof(*vcrp));
-		vcrp->base.vc_addrtype = addrtype;
-		vcrp->base.vc_privtype = privtype;
-		vcrp->base.vc_npatterns = 0;
-		vcrp->base.vc_npatterns_start = 0;
-		vcrp->base.vc_found = 0;
-		vcrp->base.vc_chance = 0.0;
-		vcrp->base.vc_free = vg_regex_context_free;
-		vcrp->base.vc_add_patterns = vg_regex_context_add_patterns;
-		vcrp->base.vc_clear_all_patterns =
-			vg_regex_context_clear_all_patterns;
-		vcrp->base.vc_test = vg_regex_test;
-		vcrp->base.vc_hash160_sort = NULL;
-		vcrp->vcr_regex = NULL;
-		vcrp->vcr_nalloc = 0;
+/*
+ * Restore the accounting, key schedule position and remaining
+ * patterns of a search from a checkpoint.  The patterns are added to
+ * the context, which should have none of its own.
+ */
+int
+vg_context_resume(vg_context_t *vcp, const char *path)
+{
+	FILE *fp;
+	char **lines, *name, *value;
+	unsigned char seedhash[32];
+	char seedhex[65];
+	unsigned long long run, *runs;
+	unsigned long unit;
+	long outpos = -1, size, nstart = -1;
+	int nlines, npatterns, ci, i, seeded = 0;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		fprintf(stderr, "Could not open checkpoint %s: %s\n",
+			path, strerror(errno));
+		return 0;
 	}
-	return &vcrp->base;
+	i = vg_read_file(fp, &lines, &nlines);
+	fclose(fp);
+	if (!i || !nlines || strcmp(lines[0], "vanitygen-checkpoint 1")) {
+		fprintf(stderr, "%s is not a vanitygen checkpoint\n", path);
+		return 0;
+	}
+
+	if (vcp->vc_seeded) {
+		SHA256(vcp->vc_seed, sizeof(vcp->vc_seed), seedhash);
+		for (i = 0; i < 32; i++)
+			sprintf(seedhex + (2 * i), "%02x", seedhash[i]);
+	}
+
+	/* Runs of patterns of the same kind are added together */
+	npatterns = 0;
+	ci = 0;
+	for (i = 1; i < nlines; i++) {
+		name = lines[i];
+		value = strchr(name, ' ');
+		if (!value)
+			goto bad;
+		*value++ = '\0';
+
+		if (!strcmp(name, "pattern") || !strcmp(name, "ipattern")) {
+			if (npatterns && (ci != (name[0] == 'i'))) {
+				if (!vg_context_resume_patterns(
+					    vcp, (const char **) lines,
+					    npatterns, ci))
+					goto bad;
+				npatterns = 0;
+			}
+			ci = (name[0] == 'i');
+			lines[npatterns++] = value;
+
+		} else if (!strcmp(name, "type")) {
+			if (strcmp(value,
+				   (vcp->vc_test == vg_regex_test) ? "regex" :
+				   (vcp->vc_test == vg_suffix_test) ? "suffix" :
+				   "prefix")) {
+				fprintf(stderr,
+					"Checkpoint is of a %s search\n",
+					value);
+				return 0;
+			}
+
+		} else if (!strcmp(name, "addrtype")) {
+			if (atoi(value) != vcp->vc_addrtype) {
+				fprintf(stderr,
+					"Checkpoint is of address type %s\n",
+					value);
+				return 0;
+			}
+
+		} else if (!strcmp(name, "total")) {
+			vcp->vc_timing_total = strtoull(value, NULL, 10);
+		} else if (!strcmp(name, "sincelast")) {
+			vcp->vc_timing_sincelast = strtoull(value, NULL, 10);
+		} else if (!strcmp(name, "found")) {
+			vcp->vc_found = strtoull(value, NULL, 10);
+			vcp->vc_timing_prevfound = vcp->vc_found;
+		} else if (!strcmp(name, "patterns")) {
+			nstart = strtol(value, NULL, 10);
+		} else if (!strcmp(name, "outpos")) {
+			outpos = strtol(value, NULL, 10);
+
+		} else if (!strcmp(name, "seed")) {
+			if (!vcp->vc_seeded || strcmp(value, seedhex)) {
+				fprintf(stderr,
+					"Checkpoint is of a search with "
+					"another seed\n");
+				return 0;
+			}
+			seeded = 1;
+
+		} else if (!strcmp(name, "worker")) {
+			if (strtoul(value, NULL, 10) != vcp->vc_worker) {
+				fprintf(stderr,
+					"Checkpoint is of worker %s\n", value);
+				return 0;
+			}
+
+		} else if (!strcmp(name, "unit")) {
+			if (sscanf(value, "%lu %llu", &unit, &run) != 2)
+				goto bad;
+			if (unit >= vcp->vc_nresume) {
+				runs = (unsigned long long *)
+					realloc(vcp->vc_resume_runs,
+						(unit + 1) * sizeof(*runs));
+				if (!runs)
+					return 0;
+				memset(runs + vcp->vc_nresume, 0,
+				       (unit + 1 - vcp->vc_nresume) *
+				       sizeof(*runs));
+				vcp->vc_resume_runs = runs;
+				vcp->vc_nresume = unit + 1;
+			}
+			vcp->vc_resume_runs[unit] = run;
+
+		} else {
+			goto bad;
+		}
+	}
+	if (!vg_context_resume_patterns(vcp, (const char **) lines,
+					npatterns, ci))
+		goto bad;
+
+	/*
+	 * Adding the patterns counted only those remaining.  Checkpoints
+	 * from before the count was kept get the found ones back.
+	 */
+	if (nstart < vcp->vc_npatterns)
+		nstart = vcp->vc_npatterns + (long) vcp->vc_found;
+	vcp->vc_npatterns_start = nstart;
+
+	if (vcp->vc_seeded && !seeded)
+		fprintf(stderr,
+			"WARNING: Checkpoint is of an unseeded search, "
+			"starting the seeded key schedule over\n");
+
+	if (vcp->vc_result_file && (outpos >= 0)) {
+		size = vg_file_size(vcp->vc_result_file);
+		if (size > outpos)
+			fprintf(stderr,
+				"WARNING: %s has matches from after the "
+				"checkpoint, which may be found again\n",
+				vcp->vc_result_file);
+	}
+	return 1;
+
+bad:
+	fprintf(stderr, "Invalid checkpoint %s\n", path);
+	return 0;
 }
@@ -24,6 +24,8 @@
 
 #include <pthread.h>
 
+#include <stdio.h>
+
 #ifdef _WIN32
 #include "winglue.h"
 #else
@@ -44,12 +46,45 @@ typedef struct _vg_exec_context_s vg_exec_context_t;
 
 typedef void *(*vg_exec_context_threadfunc_t)(vg_exec_context_t *);
 
+struct _vg_snapshot_s;
+typedef struct _vg_snapshot_s vg_snapshot_t;
+
+/* Exec context that has not taken a unit of the key schedule yet */
+#define VG_UNIT_NONE ((unsigned long) -1)
+
+/*
+ * Counters read by other threads without locking
+ */
+#if defined(__GNUC__)
+#define vg_load_relaxed(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define vg_store_relaxed(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define vg_load_epoch(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define vg_store_epoch(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#else
+#define vg_load_relaxed(p) (*(volatile unsigned long long *) (p))
+#define vg_store_relaxed(p, v) (*(volatile unsigned long long *) (p) = (v))
+/* Epochs are unsigned long, which is narrower than the above on LLP64 */
+#define vg_load_epoch(p) (*(volatile unsigned long *) (p))
+#define vg_store_epoch(p, v) (*(volatile unsigned long *) (p) = (v))
+#endif
+
 /* Context of one pattern-matching unit within the process */
 struct _vg_exec_context_s {
 	vg_context_t			*vxc_vc;
 	BN_CTX				*vxc_bnctx;
 	EC_KEY				*vxc_key;
 	int				vxc_delta;
+	int				vxc_variant;
+	int				vxc_compressed;
+	int				vxc_test_index;
+	unsigned char			vxc_rng_key[32];
+	unsigned long long		vxc_rng_count;
+	unsigned long			vxc_unit;
+	unsigned long long		vxc_run;
+	unsigned long long		vxc_nextrun;
+
+	/* First run not finished, kept by the search loop for checkpoints */
+	unsigned long long		vxc_resume_run;
 	unsigned char			vxc_binres[28];
 	BIGNUM				vxc_bntarg;
 	BIGNUM				vxc_bnbase;
@@ -64,6 +99,16 @@ struct _vg_exec_context_s {
 	struct _vg_exec_context_s	*vxc_next;
 	int				vxc_lockmode;
 	int				vxc_stop;
+
+	/* Pattern store snapshot in use, and the epoch it was taken in */
+	vg_snapshot_t			*vxc_snapshot;
+	unsigned long			vxc_epoch;
+	int				vxc_numa_node;
+
+	/* Keys checked, read by the reporter thread, on its own cache line */
+	char				vxc_work_pad0[56];
+	unsigned long long		vxc_work;
+	char				vxc_work_pad1[56];
 };
 
 
@@ -73,7 +118,19 @@ typedef int (*vg_add_pattern_func_t)(vg_context_t *,
 				     int npatterns);
 typedef void (*vg_clear_all_patterns_func_t)(vg_context_t *);
 typedef int (*vg_test_func_t)(vg_exec_context_t *);
+/*
+ * Test n hash160s, 20 bytes apart, in the encoding of vxc_compressed.
+ * Hash i is variant (i % vc_variants) of the point (base_delta +
+ * i / vc_variants) steps from the key.  Returns as vg_test_func_t,
+ * leaving the index of the hash that gave a nonzero result in
+ * vxc_test_index.
+ */
+typedef int (*vg_test_batch_func_t)(vg_exec_context_t *vxcp,
+				    const unsigned char *hashes, int n,
+				    int base_delta);
 typedef int (*vg_hash160_sort_func_t)(vg_context_t *vcp, void *buf);
+typedef vg_snapshot_t *(*vg_build_snapshot_func_t)(vg_context_t *vcp);
+typedef void (*vg_write_patterns_func_t)(vg_context_t *vcp, FILE *fp);
 typedef void (*vg_output_error_func_t)(vg_context_t *vcp, const char *info);
 typedef void (*vg_output_match_func_t)(vg_context_t *vcp, EC_KEY *pkey,
 				       const char *pattern);
@@ -86,6 +143,18 @@ enum vg_format {
 	VCF_SCRIPT,
 };
 
+enum vg_compression {
+	VCC_UNCOMPRESSED,
+	VCC_COMPRESSED,
+	VCC_BOTH,
+};
+
+enum vg_stepping {
+	VCS_SYMMETRIC,
+	VCS_AFFINE,
+	VCS_JACOBIAN,
+};
+
 /* Application-level context, incl. parameters and global pattern store */
 struct _vg_context_s {
 	int			vc_addrtype;
@@ -97,29 +166,60 @@ struct _vg_context_s {
 	double			vc_chance;
 	const char		*vc_result_file;
 	const char		*vc_key_protect_pass;
+	const char		*vc_gen_table_file;
 	int			vc_remove_on_match;
 	int			vc_only_one;
 	int			vc_verbose;
 	enum vg_format		vc_format;
 	int			vc_pubkeytype;
+	enum vg_compression	vc_compression;
 	EC_POINT		*vc_pubkey_base;
+	enum vg_stepping	vc_stepping;
+	int			vc_batchsize;
+	int			vc_streams;
+	int			vc_variants;
 	int			vc_halt;
 
+	/* Seeded key schedule, see vg_exec_context_generate_key() */
+	unsigned char		vc_seed[32];
+	int			vc_seeded;
+	unsigned long		vc_worker;
+	unsigned long		vc_nunits;
+	char			vc_match_origin[96];
+
+	/* Checkpoint file, and the runs each unit resumes from */
+	const char		*vc_checkpoint_file;
+	volatile int		vc_checkpoint_request;
+	unsigned long long	*vc_resume_runs;
+	unsigned long		vc_nresume;
+
 	vg_exec_context_t	*vc_threads;
 	int			vc_thread_excl;
 
+	/* Published pattern store snapshot, and the ones awaiting reclaim */
+	vg_snapshot_t		*vc_snapshot;
+	vg_snapshot_t		*vc_retired;
+	unsigned long		vc_epoch;
+	int			vc_numa_replicas;
+
 	/* Internal methods */
 	vg_free_func_t			vc_free;
 	vg_add_pattern_func_t		vc_add_patterns;
 	vg_clear_all_patterns_func_t	vc_clear_all_patterns;
 	vg_test_func_t			vc_test;
+	vg_test_batch_func_t		vc_test_batch;
 	vg_hash160_sort_func_t		vc_hash160_sort;
+	vg_build_snapshot_func_t	vc_build_snapshot;
+	vg_write_patterns_func_t	vc_write_patterns;
 
 	/* Performance related members */
 	unsigned long long		vc_timing_total;
 	unsigned long long		vc_timing_prevfound;
 	unsigned long long		vc_timing_sincelast;
-	struct _timing_info_s		*vc_timing_head;
+	unsigned long long		vc_timing_exited;
+	pthread_t			vc_timing_thread;
+	int				vc_timing_active;
+	int				vc_timing_stop;
 
 	/* External methods */
 	vg_output_error_func_t		vc_output_error;
@@ -136,19 +236,30 @@ extern void vg_context_clear_all_patterns(vg_context_t *vcp);
 extern int vg_context_start_threads(vg_context_t *vcp);
 extern void vg_context_stop_threads(vg_context_t *vcp);
 extern void vg_context_wait_for_completion(vg_context_t *vcp);
+extern int vg_context_write_checkpoint(vg_context_t *vcp,
+				       unsigned long long total,
+				       unsigned long long sincelast);
+extern int vg_context_resume(vg_context_t *vcp, const char *path);
 
 /* Prefix context methods */
 extern vg_context_t *vg_prefix_context_new(int addrtype, int privtype,
 					   int caseinsensitive);
 extern void vg_prefix_context_set_case_insensitive(vg_context_t *vcp,
 						   int caseinsensitive);
+extern void vg_prefix_context_set_expand_classes(vg_context_t *vcp,
+						 int expand);
 extern double vg_prefix_get_difficulty(int addrtype, const char *pattern);
 
 /* Regex context methods */
 extern vg_context_t *vg_regex_context_new(int addrtype, int privtype);
 
+/* Suffix context methods */
+extern vg_context_t *vg_suffix_context_new(int addrtype, int privtype,
+					   int caseinsensitive);
+extern void vg_suffix_context_set_case_insensitive(vg_context_t *vcp,
+						   int caseinsensitive);
+
 /* Utility functions */
-extern int vg_output_timing(vg_context_t *vcp, int cycle, struct timeval *last);
 extern void vg_output_match_console(vg_context_t *vcp, EC_KEY *pkey,
 				    const char *pattern);
 extern void vg_output_timing_console(vg_context_t *vcp, double count,
@@ -159,13 +270,19 @@ extern void vg_output_timing_console(vg_context_t *vcp, double count,
 
 /* Internal vg_context methods */
 extern int vg_context_hash160_sort(vg_context_t *vcp, void *buf);
-extern void vg_context_thread_exit(vg_context_t *vcp);
+extern int vg_context_start_timing(vg_context_t *vcp);
+extern void vg_context_stop_timing(vg_context_t *vcp);
 
 /* Internal Init/cleanup for common execution context */
 extern int vg_exec_context_init(vg_context_t *vcp, vg_exec_context_t *vxcp);
 extern void vg_exec_context_del(vg_exec_context_t *vxcp);
 extern void vg_exec_context_consolidate_key(vg_exec_context_t *vxcp);
 extern void vg_exec_context_calc_address(vg_exec_context_t *vxcp);
+extern int vg_exec_context_generate_key(vg_exec_context_t *vxcp);
+extern int vg_exec_context_replay(vg_exec_context_t *vxcp,
+				  const char *origin);
+extern void vg_exec_context_count(vg_exec_context_t *vxcp,
+				  unsigned long long work);
 extern EC_KEY *vg_exec_context_new_key(void);
 
 /* Internal execution context lock handling functions */
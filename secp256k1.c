@@ -0,0 +1,1738 @@
+/*
+ * Vanitygen, vanity bitcoin address generator
+ * Copyright (C) 2026 The Vanitygen contributors
+ *
+ * Vanitygen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Vanitygen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Vanitygen.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * The field and group arithmetic follow the design of libsecp256k1,
+ * Copyright (c) 2013 Pieter Wuille, MIT license
+ * (https://github.com/bitcoin-core/secp256k1): 5x52-bit limbs, the
+ * reduction by 2^256 == 0x1000003D1, and its Jacobian doubling and
+ * mixed addition formulas.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <openssl/bn.h>
+#include <openssl/ec.h>
+#include <openssl/sha.h>
+#include <openssl/crypto.h>
+
+#include "pattern.h"
+#include "util.h"
+#include "secp256k1.h"
+
+
+/*
+ * 64x64->128 bit multiply-accumulate helpers
+ */
+
+#if defined(__SIZEOF_INT128__)
+
+typedef unsigned __int128 vg_u128_t;
+
+static INLINE void
+u128_mul(vg_u128_t *r, uint64_t a, uint64_t b)
+{
+	*r = (vg_u128_t) a * b;
+}
+
+static INLINE void
+u128_accum_mul(vg_u128_t *r, uint64_t a, uint64_t b)
+{
+	*r += (vg_u128_t) a * b;
+}
+
+static INLINE void
+u128_accum_u64(vg_u128_t *r, uint64_t a)
+{
+	*r += a;
+}
+
+static INLINE void
+u128_rshift(vg_u128_t *r, int n)
+{
+	*r >>= n;
+}
+
+static INLINE uint64_t
+u128_to_u64(const vg_u128_t *a)
+{
+	return (uint64_t) *a;
+}
+
+#else /* !defined(__SIZEOF_INT128__) */
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+typedef struct {
+	uint64_t	lo;
+	uint64_t	hi;
+} vg_u128_t;
+
+static INLINE void
+u128_mul64(uint64_t *hi, uint64_t *lo, uint64_t a, uint64_t b)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+	*lo = _umul128(a, b, hi);
+#else
+	uint64_t ll, lh, hl, hh, mid;
+	ll = (a & 0xffffffff) * (b & 0xffffffff);
+	lh = (a & 0xffffffff) * (b >> 32);
+	hl = (a >> 32) * (b & 0xffffffff);
+	hh = (a >> 32) * (b >> 32);
+	mid = (ll >> 32) + (lh & 0xffffffff) + (hl & 0xffffffff);
+	*lo = (mid << 32) | (ll & 0xffffffff);
+	*hi = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+#endif
+}
+
+static INLINE void
+u128_mul(vg_u128_t *r, uint64_t a, uint64_t b)
+{
+	u128_mul64(&r->hi, &r->lo, a, b);
+}
+
+static INLINE void
+u128_accum_mul(vg_u128_t *r, uint64_t a, uint64_t b)
+{
+	uint64_t hi, lo;
+	u128_mul64(&hi, &lo, a, b);
+	r->lo += lo;
+	r->hi += hi + (r->lo < lo);
+}
+
+static INLINE void
+u128_accum_u64(vg_u128_t *r, uint64_t a)
+{
+	r->lo += a;
+	r->hi += (r->lo < a);
+}
+
+static INLINE void
+u128_rshift(vg_u128_t *r, int n)
+{
+	r->lo = (r->lo >> n) | (r->hi << (64 - n));
+	r->hi >>= n;
+}
+
+static INLINE uint64_t
+u128_to_u64(const vg_u128_t *a)
+{
+	return a->lo;
+}
+
+#endif /* defined(__SIZEOF_INT128__) */
+
+
+/*
+ * Field arithmetic modulo p = 2^256 - 2^32 - 977
+ *
+ * Reduction uses 2^256 == 0x1000003D1 (mod p), or equivalently
+ * 2^260 == 0x1000003D10 for the 52-bit limb boundary.
+ */
+
+#define M52 0xFFFFFFFFFFFFFULL
+#define M48 0x0FFFFFFFFFFFFULL
+#define P0 0xFFFFEFFFFFC2FULL
+#define R256 0x1000003D1ULL
+#define R260 0x1000003D10ULL
+
+void
+vg_fe_set_int(vg_fe_t *r, int a)
+{
+	r->n[0] = a;
+	r->n[1] = r->n[2] = r->n[3] = r->n[4] = 0;
+}
+
+void
+vg_fe_set_b32(vg_fe_t *r, const unsigned char *a)
+{
+	uint64_t w[4];
+	int i, j;
+
+	for (i = 0; i < 4; i++) {
+		w[i] = 0;
+		for (j = 0; j < 8; j++)
+			w[i] = (w[i] << 8) | a[(3 - i) * 8 + j];
+	}
+	r->n[0] = w[0] & M52;
+	r->n[1] = (w[0] >> 52) | ((w[1] << 12) & M52);
+	r->n[2] = (w[1] >> 40) | ((w[2] << 24) & M52);
+	r->n[3] = (w[2] >> 28) | ((w[3] << 36) & M52);
+	r->n[4] = w[3] >> 16;
+}
+
+void
+vg_fe_get_b32(unsigned char *r, const vg_fe_t *a)
+{
+	uint64_t w[4];
+	int i, j;
+
+	w[0] = a->n[0] | (a->n[1] << 52);
+	w[1] = (a->n[1] >> 12) | (a->n[2] << 40);
+	w[2] = (a->n[2] >> 24) | (a->n[3] << 28);
+	w[3] = (a->n[3] >> 36) | (a->n[4] << 16);
+	for (i = 0; i < 4; i++)
+		for (j = 0; j < 8; j++)
+			r[(3 - i) * 8 + j] = w[i] >> (56 - (8 * j));
+}
+
+/* Reduce to the unique representative in [0, p) */
+void
+vg_fe_normalize(vg_fe_t *r)
+{
+	uint64_t t0 = r->n[0], t1 = r->n[1], t2 = r->n[2],
+		t3 = r->n[3], t4 = r->n[4];
+	uint64_t m, x;
+
+	x = t4 >> 48;
+	t4 &= M48;
+	t0 += x * R256;
+	t1 += (t0 >> 52); t0 &= M52;
+	t2 += (t1 >> 52); t1 &= M52; m = t1;
+	t3 += (t2 >> 52); t2 &= M52; m &= t2;
+	t4 += (t3 >> 52); t3 &= M52; m &= t3;
+
+	/* At most one more subtraction of p is needed */
+	x = (t4 >> 48) | ((t4 == M48) & (m == M52) & (t0 >= P0));
+	t0 += x * R256;
+	t1 += (t0 >> 52); t0 &= M52;
+	t2 += (t1 >> 52); t1 &= M52;
+	t3 += (t2 >> 52); t2 &= M52;
+	t4 += (t3 >> 52); t3 &= M52;
+	t4 &= M48;
+
+	r->n[0] = t0; r->n[1] = t1; r->n[2] = t2; r->n[3] = t3; r->n[4] = t4;
+}
+
+/* Reduce to magnitude 1, not necessarily below p */
+void
+vg_fe_normalize_weak(vg_fe_t *r)
+{
+	uint64_t t0 = r->n[0], t1 = r->n[1], t2 = r->n[2],
+		t3 = r->n[3], t4 = r->n[4];
+	uint64_t x;
+
+	x = t4 >> 48;
+	t4 &= M48;
+	t0 += x * R256;
+	t1 += (t0 >> 52); t0 &= M52;
+	t2 += (t1 >> 52); t1 &= M52;
+	t3 += (t2 >> 52); t2 &= M52;
+	t4 += (t3 >> 52); t3 &= M52;
+
+	r->n[0] = t0; r->n[1] = t1; r->n[2] = t2; r->n[3] = t3; r->n[4] = t4;
+}
+
+int
+vg_fe_normalizes_to_zero(const vg_fe_t *a)
+{
+	vg_fe_t t = *a;
+	vg_fe_normalize(&t);
+	return !(t.n[0] | t.n[1] | t.n[2] | t.n[3] | t.n[4]);
+}
+
+/* Requires a normalized input */
+int
+vg_fe_is_odd(const vg_fe_t *a)
+{
+	return a->n[0] & 1;
+}
+
+void
+vg_fe_add(vg_fe_t *r, const vg_fe_t *a)
+{
+	r->n[0] += a->n[0];
+	r->n[1] += a->n[1];
+	r->n[2] += a->n[2];
+	r->n[3] += a->n[3];
+	r->n[4] += a->n[4];
+}
+
+/* r = -a, where a has magnitude at most m; result has magnitude m+1 */
+void
+vg_fe_negate(vg_fe_t *r, const vg_fe_t *a, int m)
+{
+	r->n[0] = P0 * 2 * (m + 1) - a->n[0];
+	r->n[1] = M52 * 2 * (m + 1) - a->n[1];
+	r->n[2] = M52 * 2 * (m + 1) - a->n[2];
+	r->n[3] = M52 * 2 * (m + 1) - a->n[3];
+	r->n[4] = M48 * 2 * (m + 1) - a->n[4];
+}
+
+void
+vg_fe_mul_int(vg_fe_t *r, int a)
+{
+	r->n[0] *= a;
+	r->n[1] *= a;
+	r->n[2] *= a;
+	r->n[3] *= a;
+	r->n[4] *= a;
+}
+
+/*
+ * Fold a 520-bit product, given as ten 52-bit columns, back into
+ * five limbs of magnitude 1.
+ */
+static INLINE void
+fe_reduce(uint64_t *r, const uint64_t *w)
+{
+	vg_u128_t c, d;
+	uint64_t t;
+
+	u128_mul(&c, w[5], R260);
+	u128_accum_u64(&c, w[0]);
+	r[0] = u128_to_u64(&c) & M52; u128_rshift(&c, 52);
+	u128_accum_mul(&c, w[6], R260);
+	u128_accum_u64(&c, w[1]);
+	r[1] = u128_to_u64(&c) & M52; u128_rshift(&c, 52);
+	u128_accum_mul(&c, w[7], R260);
+	u128_accum_u64(&c, w[2]);
+	r[2] = u128_to_u64(&c) & M52; u128_rshift(&c, 52);
+	u128_accum_mul(&c, w[8], R260);
+	u128_accum_u64(&c, w[3]);
+	r[3] = u128_to_u64(&c) & M52; u128_rshift(&c, 52);
+	u128_accum_mul(&c, w[9], R260);
+	u128_accum_u64(&c, w[4]);
+	r[4] = u128_to_u64(&c) & M48; u128_rshift(&c, 48);
+
+	/* Whatever is left sits at 2^256 */
+	t = u128_to_u64(&c);
+	u128_mul(&d, t, R256);
+	u128_accum_u64(&d, r[0]);
+	r[0] = u128_to_u64(&d) & M52; u128_rshift(&d, 52);
+	r[1] += u128_to_u64(&d);
+}
+
+void
+vg_fe_mul(vg_fe_t *r, const vg_fe_t *a, const vg_fe_t *b)
+{
+	const uint64_t *x = a->n, *y = b->n;
+	uint64_t w[10];
+	vg_u128_t c;
+
+	u128_mul(&c, x[0], y[0]);
+	w[0] = u128_to_u64(&c) & M52; u128_rshift(&c, 52);
+
+	u128_accum_mul(&c, x[0], y[1]);
+	u128_accum_mul(&c, x[1], y[0]);
+	w[1] = u128_to_u64(&c) & M52; u128_rshift(&c, 52);
+
+	u128_accum_mul(&c, x[0], y[2]);
+	u128_accum_mul(&c, x[1], y[1]);
+	u128_accum_mul(&c, x[2], y[0]);
+	w[2] = u128_to_u64(&c) & M52; u128_rshift(&c, 52);
+
+	u128_accum_mul(&c, x[0], y[3]);
+	u128_accum_mul(&c, x[1], y[2]);
+	u128_accum_mul(&c, x[2], y[1]);
+	u128_accum_mul(&c, x[3], y[0]);
+	w[3] = u128_to_u64(&c) & M52; u128_rshift(&c, 52);
+
+	u128_accum_mul(&c, x[0], y[4]);
+	u128_accum_mul(&c, x[1], y[3]);
+	u128_accum_mul(&c, x[2], y[2]);
+	u128_accum_mul(&c, x[3], y[1]);
+	u128_accum_mul(&c, x[4], y[0]);
+	w[4] = u128_to_u64(&c) & M52; u128_rshift(&c, 52);
+
+	u128_accum_mul(&c, x[1], y[4]);
+	u128_accum_mul(&c, x[2], y[3]);
+	u128_accum_mul(&c, x[3], y[2]);
+	u128_accum_mul(&c, x[4], y[1]);
+	w[5] = u128_to_u64(&c) & M52; u128_rshift(&c, 52);
+
+	u128_accum_mul(&c, x[2], y[4]);
+	u128_accum_mul(&c, x[3], y[3]);
+	u128_accum_mul(&c, x[4], y[2]);
+	w[6] = u128_to_u64(&c) & M52; u128_rshift(&c, 52);
+
+	u128_accum_mul(&c, x[3], y[4]);
+	u128_accum_mul(&c, x[4], y[3]);
+	w[7] = u128_to_u64(&c) & M52; u128_rshift(&c, 52);
+
+	u128_accum_mul(&c, x[4], y[4]);
+	w[8] = u128_to_u64(&c) & M52; u128_rshift(&c, 52);
+	w[9] = u128_to_u64(&c);
+
+	fe_reduce(r->n, w);
+}
+
+void
+vg_fe_sqr(vg_fe_t *r, const vg_fe_t *a)
+{
+	const uint64_t *x = a->n;
+	uint64_t w[10], x0d, x1d, x2d, x3d;
+	vg_u128_t c;
+
+	x0d = x[0] * 2;
+	x1d = x[1] * 2;
+	x2d = x[2] * 2;
+	x3d = x[3] * 2;
+
+	u128_mul(&c, x[0], x[0]);
+	w[0] = u128_to_u64(&c) & M52; u128_rshift(&c, 52);
+
+	u128_accum_mul(&c, x0d, x[1]);
+	w[1] = u128_to_u64(&c) & M52; u128_rshift(&c, 52);
+
+	u128_accum_mul(&c, x0d, x[2]);
+	u128_accum_mul(&c, x[1], x[1]);
+	w[2] = u128_to_u64(&c) & M52; u128_rshift(&c, 52);
+
+	u128_accum_mul(&c, x0d, x[3]);
+	u128_accum_mul(&c, x1d, x[2]);
+	w[3] = u128_to_u64(&c) & M52; u128_rshift(&c, 52);
+
+	u128_accum_mul(&c, x0d, x[4]);
+	u128_accum_mul(&c, x1d, x[3]);
+	u128_accum_mul(&c, x[2], x[2]);
+	w[4] = u128_to_u64(&c) & M52; u128_rshift(&c, 52);
+
+	u128_accum_mul(&c, x1d, x[4]);
+	u128_accum_mul(&c, x2d, x[3]);
+	w[5] = u128_to_u64(&c) & M52; u128_rshift(&c, 52);
+
+	u128_accum_mul(&c, x2d, x[4]);
+	u128_accum_mul(&c, x[3], x[3]);
+	w[6] = u128_to_u64(&c) & M52; u128_rshift(&c, 52);
+
+	u128_accum_mul(&c, x3d, x[4]);
+	w[7] = u128_to_u64(&c) & M52; u128_rshift(&c, 52);
+
+	u128_accum_mul(&c, x[4], x[4]);
+	w[8] = u128_to_u64(&c) & M52; u128_rshift(&c, 52);
+	w[9] = u128_to_u64(&c);
+
+	fe_reduce(r->n, w);
+}
+
+static INLINE void
+fe_sqr_n(vg_fe_t *r, const vg_fe_t *a, int n)
+{
+	vg_fe_sqr(r, a);
+	while (--n)
+		vg_fe_sqr(r, r);
+}
+
+/*
+ * r = a^(p-2), using a fixed addition chain over the runs of ones
+ * in p-2: 223 ones, 0, 22 ones, 0000, 1, 0, 11, 0, 1
+ */
+void
+vg_fe_inv(vg_fe_t *r, const vg_fe_t *a)
+{
+	vg_fe_t x2, x3, x6, x9, x11, x22, x44, x88, x176, x220, x223, t;
+
+	vg_fe_sqr(&x2, a);
+	vg_fe_mul(&x2, &x2, a);
+
+	vg_fe_sqr(&x3, &x2);
+	vg_fe_mul(&x3, &x3, a);
+
+	fe_sqr_n(&x6, &x3, 3);
+	vg_fe_mul(&x6, &x6, &x3);
+
+	fe_sqr_n(&x9, &x6, 3);
+	vg_fe_mul(&x9, &x9, &x3);
+
+	fe_sqr_n(&x11, &x9, 2);
+	vg_fe_mul(&x11, &x11, &x2);
+
+	fe_sqr_n(&x22, &x11, 11);
+	vg_fe_mul(&x22, &x22, &x11);
+
+	fe_sqr_n(&x44, &x22, 22);
+	vg_fe_mul(&x44, &x44, &x22);
+
+	fe_sqr_n(&x88, &x44, 44);
+	vg_fe_mul(&x88, &x88, &x44);
+
+	fe_sqr_n(&x176, &x88, 88);
+	vg_fe_mul(&x176, &x176, &x88);
+
+	fe_sqr_n(&x220, &x176, 44);
+	vg_fe_mul(&x220, &x220, &x44);
+
+	fe_sqr_n(&x223, &x220, 3);
+	vg_fe_mul(&x223, &x223, &x3);
+
+	fe_sqr_n(&t, &x223, 23);
+	vg_fe_mul(&t, &t, &x22);
+	fe_sqr_n(&t, &t, 5);
+	vg_fe_mul(&t, &t, a);
+	fe_sqr_n(&t, &t, 3);
+	vg_fe_mul(&t, &t, &x2);
+	fe_sqr_n(&t, &t, 2);
+	vg_fe_mul(r, &t, a);
+}
+
+/* The one inversion of a batch, timed when the thread is benchmarking */
+static void
+fe_inv_batch(vg_fe_t *r, const vg_fe_t *a)
+{
+	unsigned long long t0;
+
+	if (!vg_stage_ticks) {
+		vg_fe_inv(r, a);
+		return;
+	}
+	t0 = vg_timestamp();
+	vg_fe_inv(r, a);
+	vg_stage_ticks[VG_STAGE_INVERT] += vg_timestamp() - t0;
+}
+
+
+/*
+ * Group arithmetic on y^2 = x^3 + 7
+ */
+
+static const unsigned char vg_secp256k1_gen[64] = {
+	0x79, 0xbe, 0x66, 0x7e, 0xf9, 0xdc, 0xbb, 0xac,
+	0x55, 0xa0, 0x62, 0x95, 0xce, 0x87, 0x0b, 0x07,
+	0x02, 0x9b, 0xfc, 0xdb, 0x2d, 0xce, 0x28, 0xd9,
+	0x59, 0xf2, 0x81, 0x5b, 0x16, 0xf8, 0x17, 0x98,
+	0x48, 0x3a, 0xda, 0x77, 0x26, 0xa3, 0xc4, 0x65,
+	0x5d, 0xa4, 0xfb, 0xfc, 0x0e, 0x11, 0x08, 0xa8,
+	0xfd, 0x17, 0xb4, 0x48, 0xa6, 0x85, 0x54, 0x19,
+	0x9c, 0x47, 0xd0, 0x8f, 0xfb, 0x10, 0xd4, 0xb8,
+};
+
+/* Nontrivial cube root of unity mod p */
+static const unsigned char vg_secp256k1_beta[32] = {
+	0x7a, 0xe9, 0x6a, 0x2b, 0x65, 0x7c, 0x07, 0x10,
+	0x6e, 0x64, 0x47, 0x9e, 0xac, 0x34, 0x34, 0xe9,
+	0x9c, 0xf0, 0x49, 0x75, 0x12, 0xf5, 0x89, 0x95,
+	0xc1, 0x39, 0x6c, 0x28, 0x71, 0x95, 0x01, 0xee,
+};
+
+void
+vg_ge_set_generator(vg_ge_t *r)
+{
+	vg_fe_set_b32(&r->x, vg_secp256k1_gen);
+	vg_fe_set_b32(&r->y, vg_secp256k1_gen + 32);
+}
+
+/* Import an OpenSSL point, returns 0 for the point at infinity */
+int
+vg_ge_set_ecpoint(vg_ge_t *r, const EC_GROUP *pgroup, const EC_POINT *ppnt,
+		  BN_CTX *bnctx)
+{
+	unsigned char buf[65];
+	int len;
+
+	len = EC_POINT_point2oct(pgroup, ppnt, POINT_CONVERSION_UNCOMPRESSED,
+				 buf, sizeof(buf), bnctx);
+	if (len != 65)
+		return 0;
+	vg_fe_set_b32(&r->x, buf + 1);
+	vg_fe_set_b32(&r->y, buf + 33);
+	return 1;
+}
+
+/* Serialize an uncompressed public key, requires normalized coordinates */
+void
+vg_ge_get_pubkey(unsigned char *r, const vg_ge_t *a)
+{
+	r[0] = 0x04;
+	vg_fe_get_b32(r + 1, &a->x);
+	vg_fe_get_b32(r + 33, &a->y);
+}
+
+/* Serialize a compressed public key, requires normalized coordinates */
+void
+vg_ge_get_pubkey_compressed(unsigned char *r, const vg_ge_t *a)
+{
+	r[0] = vg_fe_is_odd(&a->y) ? 0x03 : 0x02;
+	vg_fe_get_b32(r + 1, &a->x);
+}
+
+/* r = -a, output normalized */
+void
+vg_ge_neg(vg_ge_t *r, const vg_ge_t *a)
+{
+	r->x = a->x;
+	vg_fe_negate(&r->y, &a->y, 1);
+	vg_fe_normalize(&r->y);
+}
+
+/*
+ * r = lambda a, using the endomorphism (x, y) -> (beta x, y).
+ * Output normalized, r may alias a.
+ */
+void
+vg_ge_mul_lambda(vg_ge_t *r, const vg_ge_t *a)
+{
+	vg_fe_t beta;
+
+	vg_fe_set_b32(&beta, vg_secp256k1_beta);
+	vg_fe_mul(&r->x, &a->x, &beta);
+	vg_fe_normalize(&r->x);
+	r->y = a->y;
+}
+
+void
+vg_gej_set_ge(vg_gej_t *r, const vg_ge_t *a)
+{
+	r->x = a->x;
+	r->y = a->y;
+	vg_fe_set_int(&r->z, 1);
+	r->infinity = 0;
+}
+
+/*
+ * Doubling for a = 0:
+ * S = 4XY^2, M = 3X^2, X3 = M^2 - 2S, Y3 = M(S - X3) - 8Y^4, Z3 = 2YZ
+ */
+void
+vg_gej_double(vg_gej_t *r, const vg_gej_t *a)
+{
+	vg_fe_t m, s, yy, c, t;
+
+	if (a->infinity) {
+		r->infinity = 1;
+		return;
+	}
+
+	vg_fe_mul(&r->z, &a->y, &a->z);
+	vg_fe_mul_int(&r->z, 2);
+	vg_fe_normalize_weak(&r->z);
+
+	vg_fe_sqr(&m, &a->x);
+	vg_fe_mul_int(&m, 3);			/* magnitude 3 */
+	vg_fe_sqr(&yy, &a->y);
+	vg_fe_mul(&s, &a->x, &yy);
+	vg_fe_mul_int(&s, 4);			/* magnitude 4 */
+	vg_fe_sqr(&c, &yy);
+	vg_fe_mul_int(&c, 8);			/* magnitude 8 */
+
+	t = s;
+	vg_fe_mul_int(&t, 2);			/* magnitude 8 */
+	vg_fe_sqr(&r->x, &m);
+	vg_fe_negate(&t, &t, 8);
+	vg_fe_add(&r->x, &t);
+	vg_fe_normalize_weak(&r->x);
+
+	vg_fe_negate(&t, &r->x, 1);
+	vg_fe_add(&t, &s);			/* magnitude 6 */
+	vg_fe_mul(&r->y, &m, &t);
+	vg_fe_negate(&c, &c, 8);
+	vg_fe_add(&r->y, &c);
+	vg_fe_normalize_weak(&r->y);
+	r->infinity = 0;
+}
+
+/*
+ * Mixed Jacobian/affine addition, r may alias a:
+ * U2 = x2 Z1^2, S2 = y2 Z1^3, H = U2 - X1, R = S2 - Y1
+ * X3 = R^2 - H^3 - 2 X1 H^2, Y3 = R(X1 H^2 - X3) - Y1 H^3, Z3 = Z1 H
+ */
+void
+vg_gej_add_ge(vg_gej_t *r, const vg_gej_t *a, const vg_ge_t *b)
+{
+	vg_fe_t zz, u2, s2, h, i, hh, hhh, v, t;
+
+	if (a->infinity) {
+		vg_gej_set_ge(r, b);
+		return;
+	}
+
+	vg_fe_sqr(&zz, &a->z);
+	vg_fe_mul(&u2, &b->x, &zz);
+	vg_fe_mul(&s2, &b->y, &zz);
+	vg_fe_mul(&s2, &s2, &a->z);
+
+	vg_fe_negate(&h, &a->x, 1);
+	vg_fe_add(&h, &u2);			/* magnitude 3 */
+	vg_fe_negate(&i, &a->y, 1);
+	vg_fe_add(&i, &s2);			/* magnitude 3 */
+
+	if (vg_fe_normalizes_to_zero(&h)) {
+		if (vg_fe_normalizes_to_zero(&i))
+			vg_gej_double(r, a);
+		else
+			r->infinity = 1;
+		return;
+	}
+
+	vg_fe_sqr(&hh, &h);
+	vg_fe_mul(&hhh, &h, &hh);
+	vg_fe_mul(&v, &a->x, &hh);
+	vg_fe_mul(&r->z, &a->z, &h);
+
+	/* From here on, a->x and a->y may be overwritten */
+	vg_fe_mul(&s2, &a->y, &hhh);		/* Y1 H^3 */
+	vg_fe_sqr(&r->x, &i);
+	vg_fe_negate(&t, &hhh, 1);
+	vg_fe_add(&r->x, &t);
+	t = v;
+	vg_fe_mul_int(&t, 2);
+	vg_fe_negate(&t, &t, 2);
+	vg_fe_add(&r->x, &t);			/* magnitude 6 */
+	vg_fe_normalize_weak(&r->x);
+
+	vg_fe_negate(&t, &r->x, 1);
+	vg_fe_add(&t, &v);			/* magnitude 3 */
+	vg_fe_mul(&r->y, &i, &t);
+	vg_fe_negate(&t, &s2, 1);
+	vg_fe_add(&r->y, &t);
+	vg_fe_normalize_weak(&r->y);
+	r->infinity = 0;
+}
+
+/*
+ * Convert an array of Jacobian points to normalized affine form using
+ * Montgomery's trick: one field inversion for the whole batch.
+ * scratch must hold n field elements.  Returns 0 if any input is the
+ * point at infinity, leaving r undefined.
+ */
+int
+vg_ge_set_all_gej(vg_ge_t *r, const vg_gej_t *a, int n, vg_fe_t *scratch)
+{
+	vg_fe_t inv, zi, zi2, zi3;
+	int i;
+
+	if (n <= 0)
+		return 1;
+
+	for (i = 0; i < n; i++)
+		if (a[i].infinity)
+			return 0;
+
+	scratch[0] = a[0].z;
+	for (i = 1; i < n; i++)
+		vg_fe_mul(&scratch[i], &scratch[i-1], &a[i].z);
+
+	fe_inv_batch(&inv, &scratch[n-1]);
+
+	for (i = n - 1; i >= 0; i--) {
+		if (i > 0) {
+			vg_fe_mul(&zi, &inv, &scratch[i-1]);
+			vg_fe_mul(&inv, &inv, &a[i].z);
+		} else {
+			zi = inv;
+		}
+		vg_fe_sqr(&zi2, &zi);
+		vg_fe_mul(&zi3, &zi2, &zi);
+		vg_fe_mul(&r[i].x, &a[i].x, &zi2);
+		vg_fe_mul(&r[i].y, &a[i].y, &zi3);
+		vg_fe_normalize(&r[i].x);
+		vg_fe_normalize(&r[i].y);
+	}
+	return 1;
+}
+
+/*
+ * r = a + b, given dinv = 1/(x_b - x_a).  x_b and y_b may have
+ * magnitude up to 2, and r may alias a.
+ */
+static INLINE void
+ge_add_dinv(vg_ge_t *r, const vg_ge_t *a, const vg_fe_t *bx,
+	    const vg_fe_t *by, const vg_fe_t *dinv)
+{
+	vg_fe_t lam, x3, y3, t;
+
+	/* lambda = (y_b - y_a) / (x_b - x_a) */
+	vg_fe_negate(&lam, &a->y, 1);
+	vg_fe_add(&lam, by);
+	vg_fe_mul(&lam, &lam, dinv);
+
+	/* x3 = lambda^2 - x_a - x_b */
+	vg_fe_sqr(&x3, &lam);
+	vg_fe_negate(&t, &a->x, 1);
+	vg_fe_add(&x3, &t);
+	vg_fe_negate(&t, bx, 2);
+	vg_fe_add(&x3, &t);			/* magnitude 5 */
+
+	/* y3 = lambda (x_a - x3) - y_a */
+	vg_fe_negate(&t, &x3, 5);
+	vg_fe_add(&t, &a->x);			/* magnitude 7 */
+	vg_fe_mul(&y3, &lam, &t);
+	vg_fe_negate(&t, &a->y, 1);
+	vg_fe_add(&y3, &t);
+
+	r->x = x3;
+	r->y = y3;
+	vg_fe_normalize(&r->x);
+	vg_fe_normalize(&r->y);
+}
+
+/*
+ * Add the affine point b to each of the n affine points in a, in place.
+ * The slope denominators (x_b - x_i) of the whole batch share a single
+ * field inversion, computed with Montgomery's trick.  scratch must hold
+ * n field elements.  Returns 0, leaving a untouched, if any a[i] is
+ * b or -b.
+ */
+int
+vg_ge_add_batch(vg_ge_t *a, int n, const vg_ge_t *b, vg_fe_t *scratch)
+{
+	vg_fe_t inv, d, dinv;
+	int i;
+
+	if (n <= 0)
+		return 1;
+
+	for (i = 0; i < n; i++) {
+		vg_fe_negate(&d, &a[i].x, 1);
+		vg_fe_add(&d, &b->x);
+		if (!i)
+			scratch[0] = d;
+		else
+			vg_fe_mul(&scratch[i], &scratch[i-1], &d);
+	}
+
+	if (vg_fe_normalizes_to_zero(&scratch[n-1]))
+		return 0;
+	fe_inv_batch(&inv, &scratch[n-1]);
+
+	for (i = n - 1; i >= 0; i--) {
+		vg_fe_negate(&d, &a[i].x, 1);
+		vg_fe_add(&d, &b->x);
+		if (i > 0) {
+			vg_fe_mul(&dinv, &inv, &scratch[i-1]);
+			vg_fe_mul(&inv, &inv, &d);
+		} else {
+			dinv = inv;
+		}
+		ge_add_dinv(&a[i], &a[i], &b->x, &b->y, &dinv);
+	}
+	return 1;
+}
+
+/*
+ * Symmetric batch around the center point c, using the table
+ * t[j] = (j+1)G for j < m:
+ *   r[m] = c, r[m+1+j] = c + t[j], r[m-1-j] = c - t[j]
+ * The points c + t[j] and c - t[j] share the slope denominator
+ * (x_t[j] - x_c), so each inverted denominator yields two points.
+ * The denominator for advancing c by step is folded into the same
+ * inversion, and c is replaced with c + step on return.
+ * r must hold 2m+1 points, scratch m+8 field elements.  Returns 0,
+ * leaving r and c untouched, if any denominator is zero.
+ */
+static int
+ge_add_batch_sym_scalar(vg_ge_t *r, vg_ge_t *c, const vg_ge_t *t, int m,
+			const vg_ge_t *step, vg_fe_t *scratch)
+{
+	vg_fe_t inv, d, dinv, ny;
+	vg_ge_t nc;
+	int j;
+
+	for (j = 0; j <= m; j++) {
+		vg_fe_negate(&d, &c->x, 1);
+		vg_fe_add(&d, (j < m) ? &t[j].x : &step->x);
+		if (!j)
+			scratch[0] = d;
+		else
+			vg_fe_mul(&scratch[j], &scratch[j-1], &d);
+	}
+
+	if (vg_fe_normalizes_to_zero(&scratch[m]))
+		return 0;
+	fe_inv_batch(&inv, &scratch[m]);
+
+	for (j = m; j >= 0; j--) {
+		vg_fe_negate(&d, &c->x, 1);
+		vg_fe_add(&d, (j < m) ? &t[j].x : &step->x);
+		if (j > 0) {
+			vg_fe_mul(&dinv, &inv, &scratch[j-1]);
+			vg_fe_mul(&inv, &inv, &d);
+		} else {
+			dinv = inv;
+		}
+
+		if (j == m) {
+			ge_add_dinv(&nc, c, &step->x, &step->y, &dinv);
+			continue;
+		}
+		ge_add_dinv(&r[m+1+j], c, &t[j].x, &t[j].y, &dinv);
+		vg_fe_negate(&ny, &t[j].y, 1);
+		ge_add_dinv(&r[m-1-j], c, &t[j].x, &ny, &dinv);
+	}
+
+	r[m] = *c;
+	*c = nc;
+	return 1;
+}
+
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define VG_FE_X86
+#include <immintrin.h>
+
+/*
+ * Eight field elements at once on AVX-512 IFMA, one per 64-bit lane.
+ *
+ * The 5x52 limb layout is the one IFMA multiplies natively, but
+ * vpmadd52luq/vpmadd52huq only see the low 52 bits of each input
+ * limb, so every fe8_t handed to fe8_mul() must have been through
+ * fe8_carry(): limbs 0..3 below 2^52 and limb 4 at most 2^48.
+ */
+
+#define FE8_TARGET	__attribute__((target("avx512f,avx512ifma")))
+
+typedef struct _fe8_s {
+	__m512i		n[5];
+} fe8_t;
+
+FE8_TARGET static INLINE void
+fe8_carry(fe8_t *r)
+{
+	const __m512i m52 = _mm512_set1_epi64(M52);
+	__m512i x;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		r->n[i+1] = _mm512_add_epi64(r->n[i+1],
+					     _mm512_srli_epi64(r->n[i], 52));
+		r->n[i] = _mm512_and_si512(r->n[i], m52);
+	}
+
+	/* Fold the bits above 2^256, then carry once more */
+	x = _mm512_srli_epi64(r->n[4], 48);
+	r->n[4] = _mm512_and_si512(r->n[4], _mm512_set1_epi64(M48));
+	r->n[0] = _mm512_madd52lo_epu64(r->n[0], x,
+					_mm512_set1_epi64(R256));
+	for (i = 0; i < 4; i++) {
+		r->n[i+1] = _mm512_add_epi64(r->n[i+1],
+					     _mm512_srli_epi64(r->n[i], 52));
+		r->n[i] = _mm512_and_si512(r->n[i], m52);
+	}
+}
+
+/* Reduce carried limbs to the unique representative in [0, p) */
+FE8_TARGET static INLINE void
+fe8_normalize(fe8_t *r)
+{
+	const __m512i m52 = _mm512_set1_epi64(M52);
+	__m512i t[5];
+	__mmask8 ge;
+	int i;
+
+	/* r >= p iff r + (2^256 - p) reaches 2^256 */
+	t[0] = _mm512_add_epi64(r->n[0], _mm512_set1_epi64(R256));
+	for (i = 0; i < 4; i++) {
+		t[i+1] = _mm512_add_epi64(r->n[i+1],
+					  _mm512_srli_epi64(t[i], 52));
+		t[i] = _mm512_and_si512(t[i], m52);
+	}
+	ge = _mm512_test_epi64_mask(t[4], _mm512_set1_epi64(1ULL << 48));
+	t[4] = _mm512_and_si512(t[4], _mm512_set1_epi64(M48));
+	for (i = 0; i < 5; i++)
+		r->n[i] = _mm512_mask_blend_epi64(ge, r->n[i], t[i]);
+}
+
+FE8_TARGET static INLINE void
+fe8_mul(fe8_t *r, const fe8_t *a, const fe8_t *b)
+{
+	const __m512i m52 = _mm512_set1_epi64(M52);
+	const __m512i r260 = _mm512_set1_epi64(R260);
+	__m512i c[10], x;
+	int i, j;
+
+	for (i = 0; i < 10; i++)
+		c[i] = _mm512_setzero_si512();
+	for (i = 0; i < 5; i++) {
+		for (j = 0; j < 5; j++) {
+			c[i+j] = _mm512_madd52lo_epu64(c[i+j],
+						       a->n[i], b->n[j]);
+			c[i+j+1] = _mm512_madd52hi_epu64(c[i+j+1],
+							 a->n[i], b->n[j]);
+		}
+	}
+
+	/* Ten 52-bit columns, then fold the upper five by 2^260 */
+	for (i = 0; i < 9; i++) {
+		c[i+1] = _mm512_add_epi64(c[i+1], _mm512_srli_epi64(c[i], 52));
+		c[i] = _mm512_and_si512(c[i], m52);
+	}
+	x = _mm512_madd52hi_epu64(_mm512_setzero_si512(), c[9], r260);
+	for (i = 0; i < 5; i++) {
+		c[i] = _mm512_madd52lo_epu64(c[i], c[i+5], r260);
+		if (i < 4)
+			c[i+1] = _mm512_madd52hi_epu64(c[i+1], c[i+5], r260);
+	}
+	c[0] = _mm512_madd52lo_epu64(c[0], x, r260);
+	c[1] = _mm512_madd52hi_epu64(c[1], x, r260);
+
+	for (i = 0; i < 5; i++)
+		r->n[i] = c[i];
+	fe8_carry(r);
+}
+
+/* r = a - b, as a + 2p - b */
+FE8_TARGET static INLINE void
+fe8_sub(fe8_t *r, const fe8_t *a, const fe8_t *b)
+{
+	r->n[0] = _mm512_sub_epi64(
+		_mm512_add_epi64(a->n[0], _mm512_set1_epi64(2 * P0)), b->n[0]);
+	r->n[1] = _mm512_sub_epi64(
+		_mm512_add_epi64(a->n[1], _mm512_set1_epi64(2 * M52)), b->n[1]);
+	r->n[2] = _mm512_sub_epi64(
+		_mm512_add_epi64(a->n[2], _mm512_set1_epi64(2 * M52)), b->n[2]);
+	r->n[3] = _mm512_sub_epi64(
+		_mm512_add_epi64(a->n[3], _mm512_set1_epi64(2 * M52)), b->n[3]);
+	r->n[4] = _mm512_sub_epi64(
+		_mm512_add_epi64(a->n[4], _mm512_set1_epi64(2 * M48)), b->n[4]);
+	fe8_carry(r);
+}
+
+/* fe8_sub(), with 1 in the lanes outside of live */
+FE8_TARGET static INLINE void
+fe8_sub_lanes(fe8_t *r, const fe8_t *a, const fe8_t *b, __mmask8 live)
+{
+	int i;
+
+	fe8_sub(r, a, b);
+	if (live != 0xff) {
+		r->n[0] = _mm512_mask_blend_epi64(live, _mm512_set1_epi64(1),
+						  r->n[0]);
+		for (i = 1; i < 5; i++)
+			r->n[i] = _mm512_maskz_mov_epi64(live, r->n[i]);
+	}
+}
+
+FE8_TARGET static INLINE void
+fe8_set1(fe8_t *r, const vg_fe_t *a)
+{
+	int i;
+
+	for (i = 0; i < 5; i++)
+		r->n[i] = _mm512_set1_epi64((long long) a->n[i]);
+	fe8_carry(r);
+}
+
+/* Gather one coordinate of eight consecutive points, 10 limbs apart */
+FE8_TARGET static INLINE void
+fe8_gather(fe8_t *r, const vg_fe_t *a)
+{
+	const __m512i idx = _mm512_setr_epi64(0, 10, 20, 30, 40, 50, 60, 70);
+	int i;
+
+	for (i = 0; i < 5; i++)
+		r->n[i] = _mm512_i64gather_epi64(idx, &a->n[i], 8);
+}
+
+FE8_TARGET static INLINE void
+fe8_store(uint64_t (*r)[8], const fe8_t *a)
+{
+	int i;
+
+	for (i = 0; i < 5; i++)
+		_mm512_storeu_si512((void *) r[i], a->n[i]);
+}
+
+/*
+ * Eight lanes kept in scratch space, which holds them as eight
+ * vg_fe_t-sized slots without the alignment of an fe8_t.
+ */
+FE8_TARGET static INLINE void
+fe8_load(fe8_t *r, const vg_fe_t *a)
+{
+	int i;
+
+	for (i = 0; i < 5; i++)
+		r->n[i] = _mm512_loadu_si512(
+			(const void *) (((const uint64_t *) a) + (8 * i)));
+}
+
+FE8_TARGET static INLINE void
+fe8_save(vg_fe_t *r, const fe8_t *a)
+{
+	int i;
+
+	for (i = 0; i < 5; i++)
+		_mm512_storeu_si512((void *) (((uint64_t *) r) + (8 * i)),
+				    a->n[i]);
+}
+
+/*
+ * Table points for lanes j0..j0+7 of ge_add_batch_sym_ifma(): t[j]
+ * below m, step at m, and a stand-in past that.  Returns the mask
+ * of the lanes that are real denominators.
+ */
+static INLINE __mmask8
+ge8_lanes(const vg_ge_t **pt, vg_ge_t *tmp, const vg_ge_t *t, int j0, int m,
+	  const vg_ge_t *step)
+{
+	int l;
+
+	if ((j0 + 8) <= m) {
+		*pt = &t[j0];
+		return 0xff;
+	}
+	for (l = 0; l < 8; l++)
+		tmp[l] = ((j0 + l) < m) ? t[j0 + l] : *step;
+	*pt = tmp;
+	return (__mmask8) ((1U << ((m + 1 - j0) < 8 ? (m + 1 - j0) : 8)) - 1);
+}
+
+/*
+ * ge_add_batch_sym_scalar() with the denominators split across eight
+ * lanes: lane l takes j = l, l+8, l+16..., keeping its own running
+ * product in scratch.  The eight lane totals are inverted together
+ * with one scalar inversion, and the backward pass and the point
+ * additions then run on all eight lanes.
+ */
+FE8_TARGET static int
+ge_add_batch_sym_ifma(vg_ge_t *r, vg_ge_t *c, const vg_ge_t *t, int m,
+		      const vg_ge_t *step, vg_fe_t *scratch)
+{
+	fe8_t cx, cy, ncy, tx, ty, d, inv, dinv, lam, x3, y3, u;
+	vg_fe_t tot[8], pre[8], linv, fe;
+	vg_ge_t tmp[8], nc;
+	const vg_ge_t *pt;
+	uint64_t xs[5][8], ys[5][8];
+	__mmask8 live;
+	int q, nq, j0, l, i;
+
+	nq = (m + 8) / 8;
+	fe8_set1(&cx, &c->x);
+	fe8_set1(&cy, &c->y);
+	vg_fe_set_int(&fe, 0);
+	fe8_set1(&ncy, &fe);
+	fe8_sub(&ncy, &ncy, &cy);
+
+	for (q = 0; q < nq; q++) {
+		live = ge8_lanes(&pt, tmp, t, 8 * q, m, step);
+		fe8_gather(&tx, &pt[0].x);
+		fe8_sub_lanes(&d, &tx, &cx, live);
+		if (q) {
+			fe8_load(&u, &scratch[8 * (q - 1)]);
+			fe8_mul(&d, &u, &d);
+		}
+		fe8_save(&scratch[8 * q], &d);
+	}
+
+	/* Invert the eight lane totals together */
+	fe8_load(&u, &scratch[8 * (nq - 1)]);
+	fe8_store(xs, &u);
+	for (l = 0; l < 8; l++) {
+		for (i = 0; i < 5; i++)
+			tot[l].n[i] = xs[i][l];
+		if (!l)
+			pre[0] = tot[0];
+		else
+			vg_fe_mul(&pre[l], &pre[l-1], &tot[l]);
+	}
+	if (vg_fe_normalizes_to_zero(&pre[7]))
+		return 0;
+	fe_inv_batch(&linv, &pre[7]);
+	for (l = 7; l >= 0; l--) {
+		if (l > 0) {
+			vg_fe_mul(&fe, &linv, &pre[l-1]);
+			vg_fe_mul(&linv, &linv, &tot[l]);
+		} else {
+			fe = linv;
+		}
+		for (i = 0; i < 5; i++)
+			xs[i][l] = fe.n[i];
+	}
+	for (i = 0; i < 5; i++)
+		inv.n[i] = _mm512_loadu_si512((const void *) xs[i]);
+	fe8_carry(&inv);
+
+	for (q = nq - 1; q >= 0; q--) {
+		j0 = 8 * q;
+		live = ge8_lanes(&pt, tmp, t, j0, m, step);
+		fe8_gather(&tx, &pt[0].x);
+		fe8_gather(&ty, &pt[0].y);
+		fe8_carry(&ty);
+		fe8_sub_lanes(&d, &tx, &cx, live);
+		if (q > 0) {
+			fe8_load(&u, &scratch[8 * (q - 1)]);
+			fe8_mul(&dinv, &inv, &u);
+			fe8_mul(&inv, &inv, &d);
+		} else {
+			dinv = inv;
+		}
+
+		/* c + t[j]: lambda = (y_t - y_c) / (x_t - x_c) */
+		fe8_sub(&lam, &ty, &cy);
+		fe8_mul(&lam, &lam, &dinv);
+		fe8_mul(&x3, &lam, &lam);
+		fe8_sub(&x3, &x3, &cx);
+		fe8_sub(&x3, &x3, &tx);
+		fe8_sub(&u, &cx, &x3);
+		fe8_mul(&y3, &lam, &u);
+		fe8_sub(&y3, &y3, &cy);
+		fe8_normalize(&x3);
+		fe8_normalize(&y3);
+		fe8_store(xs, &x3);
+		fe8_store(ys, &y3);
+		for (l = 0; (l < 8) && ((j0 + l) <= m); l++) {
+			vg_ge_t *pr = ((j0 + l) < m) ? &r[m+1+j0+l] : &nc;
+			for (i = 0; i < 5; i++) {
+				pr->x.n[i] = xs[i][l];
+				pr->y.n[i] = ys[i][l];
+			}
+		}
+
+		/* c - t[j]: lambda = (-y_t - y_c) / (x_t - x_c) */
+		fe8_sub(&lam, &ncy, &ty);
+		fe8_mul(&lam, &lam, &dinv);
+		fe8_mul(&x3, &lam, &lam);
+		fe8_sub(&x3, &x3, &cx);
+		fe8_sub(&x3, &x3, &tx);
+		fe8_sub(&u, &cx, &x3);
+		fe8_mul(&y3, &lam, &u);
+		fe8_sub(&y3, &y3, &cy);
+		fe8_normalize(&x3);
+		fe8_normalize(&y3);
+		fe8_store(xs, &x3);
+		fe8_store(ys, &y3);
+		for (l = 0; (l < 8) && ((j0 + l) < m); l++) {
+			vg_ge_t *pr = &r[m-1-j0-l];
+			for (i = 0; i < 5; i++) {
+				pr->x.n[i] = xs[i][l];
+				pr->y.n[i] = ys[i][l];
+			}
+		}
+	}
+
+	r[m] = *c;
+	*c = nc;
+	return 1;
+}
+#endif /* defined(__GNUC__) && defined(__x86_64__) */
+
+typedef int (*ge_add_batch_sym_func_t)(vg_ge_t *r, vg_ge_t *c,
+				       const vg_ge_t *t, int m,
+				       const vg_ge_t *step, vg_fe_t *scratch);
+
+static const struct {
+	const char			*name;
+	unsigned int			features;
+	ge_add_batch_sym_func_t		func;
+} vg_fe_backends[] = {
+#if defined(VG_FE_X86)
+	{ "ifma", VG_CPU_AVX512F | VG_CPU_AVX512IFMA, ge_add_batch_sym_ifma },
+#endif
+	{ "scalar", 0, ge_add_batch_sym_scalar },
+};
+
+static ge_add_batch_sym_func_t vg_ge_add_batch_sym_impl =
+	ge_add_batch_sym_scalar;
+static const char *vg_fe_name = "scalar";
+
+/*
+ * Select the field arithmetic backend for vg_ge_add_batch_sym(), by
+ * name if one is given, otherwise the first one the CPU supports.
+ * Returns 0 if the named backend is unknown or unsupported.
+ */
+int
+vg_fe_init(const char *name)
+{
+	unsigned int features = vg_cpu_features();
+	int i;
+
+	for (i = 0;
+	     i < (int) (sizeof(vg_fe_backends) / sizeof(vg_fe_backends[0]));
+	     i++) {
+		if (name && strcmp(name, vg_fe_backends[i].name))
+			continue;
+		if ((features & vg_fe_backends[i].features) !=
+		    vg_fe_backends[i].features)
+			continue;
+		vg_ge_add_batch_sym_impl = vg_fe_backends[i].func;
+		vg_fe_name = vg_fe_backends[i].name;
+		return 1;
+	}
+	return 0;
+}
+
+const char *
+vg_fe_backend_name(void)
+{
+	return vg_fe_name;
+}
+
+int
+vg_ge_add_batch_sym(vg_ge_t *r, vg_ge_t *c, const vg_ge_t *t, int m,
+		    const vg_ge_t *step, vg_fe_t *scratch)
+{
+	return vg_ge_add_batch_sym_impl(r, c, t, m, step, scratch);
+}
+
+
+/*
+ * Fixed-base multiplication by G
+ *
+ * One read-only table is shared by every thread in the process:
+ * window i holds j * 2^(8i) * G for j = 1..255, so k*G takes one
+ * mixed addition per byte of k.  Entries are selected by scanning the
+ * whole window, so the memory access pattern does not depend on k.
+ *
+ * The table is either built at startup, into hugepage-backed memory
+ * where available, or mapped from a cache file written on an earlier
+ * run.  The cache file holds a header with the SHA-256 of the table,
+ * which is checked on load, and every entry is checked against G
+ * before the mapped table is trusted.  The cache is replaced by
+ * renaming a new file over it, as other processes may have it mapped.
+ */
+
+#define VG_GEN_WINDOWS	32
+#define VG_GEN_ENTRIES	255
+#define VG_GEN_NPOINTS	(VG_GEN_WINDOWS * VG_GEN_ENTRIES)
+#define VG_GEN_MAGIC	"VGGENTB1"
+
+typedef struct _vg_gen_header_s {
+	char		gh_magic[8];
+	uint32_t	gh_npoints;
+	uint32_t	gh_pointsize;
+	unsigned char	gh_hash[32];
+} vg_gen_header_t;
+
+static const vg_ge_t *vg_gen_table = NULL;
+
+static void
+gen_table_hash(unsigned char *hash, const vg_ge_t *tab)
+{
+	SHA256((const unsigned char *) tab, VG_GEN_NPOINTS * sizeof(*tab),
+	       hash);
+}
+
+static int
+gen_table_build(vg_ge_t *tab)
+{
+	vg_gej_t *pj, base;
+	vg_ge_t abase;
+	vg_fe_t *scratch;
+	int i, j;
+
+	pj = (vg_gej_t *) malloc(VG_GEN_ENTRIES * sizeof(*pj));
+	scratch = (vg_fe_t *) malloc(VG_GEN_ENTRIES * sizeof(*scratch));
+	if (!pj || !scratch) {
+		if (pj)
+			free(pj);
+		if (scratch)
+			free(scratch);
+		return 0;
+	}
+
+	vg_ge_set_generator(&abase);
+	for (i = 0; i < VG_GEN_WINDOWS; i++) {
+		vg_gej_set_ge(&pj[0], &abase);
+		for (j = 1; j < VG_GEN_ENTRIES; j++)
+			vg_gej_add_ge(&pj[j], &pj[j-1], &abase);
+		vg_ge_set_all_gej(tab + (i * VG_GEN_ENTRIES), pj,
+				  VG_GEN_ENTRIES, scratch);
+
+		/* Next window base: 2 * 128 * 2^(8i) * G */
+		vg_gej_set_ge(&base, &tab[(i * VG_GEN_ENTRIES) + 127]);
+		vg_gej_double(&base, &base);
+		vg_ge_set_all_gej(&abase, &base, 1, scratch);
+	}
+
+	free(pj);
+	free(scratch);
+	return 1;
+}
+
+/* Nonzero if a is on the curve, with coordinates below p */
+static int
+gen_entry_valid(const vg_ge_t *a)
+{
+	vg_ge_t t = *a;
+	vg_fe_t y2, x3, seven;
+
+	vg_fe_normalize(&t.x);
+	vg_fe_normalize(&t.y);
+	if (memcmp(&t, a, sizeof(t)))
+		return 0;
+
+	/* y^2 - (x^3 + 7) */
+	vg_fe_sqr(&y2, &a->y);
+	vg_fe_sqr(&x3, &a->x);
+	vg_fe_mul(&x3, &x3, &a->x);
+	vg_fe_set_int(&seven, 7);
+	vg_fe_add(&x3, &seven);
+	vg_fe_negate(&x3, &x3, 2);
+	vg_fe_add(&x3, &y2);
+	return vg_fe_normalizes_to_zero(&x3);
+}
+
+/*
+ * Nonzero if r = p + q, for distinct valid points p and q.  That is
+ * the case when -r is the third point where the line through p and q
+ * meets the curve: -r is on the line, and is neither p nor q.
+ */
+static int
+gen_entry_is_sum(const vg_ge_t *r, const vg_ge_t *p, const vg_ge_t *q)
+{
+	vg_fe_t npx, dqp, drp, drq, dy, t;
+
+	vg_fe_negate(&npx, &p->x, 1);
+	dqp = q->x;
+	vg_fe_add(&dqp, &npx);
+	drp = r->x;
+	vg_fe_add(&drp, &npx);
+	vg_fe_negate(&drq, &q->x, 1);
+	vg_fe_add(&drq, &r->x);
+	if (vg_fe_normalizes_to_zero(&dqp) ||
+	    vg_fe_normalizes_to_zero(&drp) ||
+	    vg_fe_normalizes_to_zero(&drq))
+		return 0;
+
+	/* (yr + yp)(xq - xp) + (yq - yp)(xr - xp) */
+	vg_fe_negate(&dy, &p->y, 1);
+	vg_fe_add(&dy, &q->y);
+	vg_fe_mul(&dy, &dy, &drp);
+	t = r->y;
+	vg_fe_add(&t, &p->y);
+	vg_fe_mul(&t, &t, &dqp);
+	vg_fe_add(&t, &dy);
+	return vg_fe_normalizes_to_zero(&t);
+}
+
+/*
+ * Check every entry of a table that was not built here.  The first
+ * entry of each window is compared against 2^(8i) * G, walked by
+ * doubling G eight times per window, and the second against its
+ * double.  Every later entry must be on the curve and equal to the
+ * previous entry plus the first, which is checked without inversions.
+ * Returns 0 on any mismatch.
+ */
+static int
+gen_table_check(const vg_ge_t *tab)
+{
+	unsigned char want[65], have[65];
+	const vg_ge_t *win;
+	vg_gej_t base, dbl;
+	vg_ge_t abase, adbl;
+	vg_fe_t scratch;
+	int i, j;
+
+	vg_ge_set_generator(&abase);
+	vg_gej_set_ge(&base, &abase);
+	for (i = 0; i < VG_GEN_WINDOWS; i++) {
+		win = tab + (i * VG_GEN_ENTRIES);
+		if (i) {
+			for (j = 0; j < 8; j++)
+				vg_gej_double(&base, &base);
+			vg_ge_set_all_gej(&abase, &base, 1, &scratch);
+		}
+		vg_gej_double(&dbl, &base);
+		vg_ge_set_all_gej(&adbl, &dbl, 1, &scratch);
+		if (!gen_entry_valid(&win[0]) || !gen_entry_valid(&win[1]))
+			return 0;
+		vg_ge_get_pubkey(want, &abase);
+		vg_ge_get_pubkey(have, &win[0]);
+		if (memcmp(want, have, sizeof(want)))
+			return 0;
+		vg_ge_get_pubkey(want, &adbl);
+		vg_ge_get_pubkey(have, &win[1]);
+		if (memcmp(want, have, sizeof(want)))
+			return 0;
+		for (j = 2; j < VG_GEN_ENTRIES; j++) {
+			if (!gen_entry_valid(&win[j]) ||
+			    !gen_entry_is_sum(&win[j], &win[j-1], &win[0]))
+				return 0;
+		}
+	}
+	return 1;
+}
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static vg_ge_t *
+gen_table_alloc(void)
+{
+	size_t size = VG_GEN_NPOINTS * sizeof(vg_ge_t);
+	void *p;
+
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+#if defined(MADV_HUGEPAGE)
+	madvise(p, size, MADV_HUGEPAGE);
+#endif
+	return (vg_ge_t *) p;
+}
+
+static const vg_ge_t *
+gen_table_load(const char *file)
+{
+	vg_gen_header_t hdr;
+	unsigned char hash[32];
+	struct stat st;
+	size_t size;
+	void *p;
+	int fd;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	size = sizeof(hdr) + (VG_GEN_NPOINTS * sizeof(vg_ge_t));
+	if (fstat(fd, &st) || ((size_t) st.st_size != size)) {
+		close(fd);
+		return NULL;
+	}
+	p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return NULL;
+
+	memcpy(&hdr, p, sizeof(hdr));
+	if (memcmp(hdr.gh_magic, VG_GEN_MAGIC, sizeof(hdr.gh_magic)) ||
+	    (hdr.gh_npoints != VG_GEN_NPOINTS) ||
+	    (hdr.gh_pointsize != sizeof(vg_ge_t)))
+		goto bad;
+	gen_table_hash(hash, (const vg_ge_t *) ((char *) p + sizeof(hdr)));
+	if (memcmp(hash, hdr.gh_hash, sizeof(hash)) ||
+	    !gen_table_check((const vg_ge_t *) ((char *) p + sizeof(hdr))))
+		goto bad;
+	return (const vg_ge_t *) ((char *) p + sizeof(hdr));
+
+bad:
+	fprintf(stderr, "WARNING: ignoring invalid table cache \"%s\"\n",
+		file);
+	munmap(p, size);
+	return NULL;
+}
+
+#else /* defined(_WIN32) */
+
+static vg_ge_t *
+gen_table_alloc(void)
+{
+	return (vg_ge_t *) malloc(VG_GEN_NPOINTS * sizeof(vg_ge_t));
+}
+
+static const vg_ge_t *
+gen_table_load(const char *file)
+{
+	vg_gen_header_t hdr;
+	unsigned char hash[32];
+	vg_ge_t *tab;
+	FILE *fp;
+
+	fp = fopen(file, "rb");
+	if (!fp)
+		return NULL;
+	tab = gen_table_alloc();
+	if (!tab ||
+	    (fread(&hdr, sizeof(hdr), 1, fp) != 1) ||
+	    memcmp(hdr.gh_magic, VG_GEN_MAGIC, sizeof(hdr.gh_magic)) ||
+	    (hdr.gh_npoints != VG_GEN_NPOINTS) ||
+	    (hdr.gh_pointsize != sizeof(vg_ge_t)) ||
+	    (fread(tab, sizeof(*tab), VG_GEN_NPOINTS, fp) != VG_GEN_NPOINTS))
+		goto bad;
+	gen_table_hash(hash, tab);
+	if (memcmp(hash, hdr.gh_hash, sizeof(hash)) || !gen_table_check(tab))
+		goto bad;
+	fclose(fp);
+	return tab;
+
+bad:
+	fprintf(stderr, "WARNING: ignoring invalid table cache \"%s\"\n",
+		file);
+	if (tab)
+		free(tab);
+	fclose(fp);
+	return NULL;
+}
+#endif /* defined(_WIN32) */
+
+/*
+ * Write the table to a temporary file and rename it over the cache,
+ * so a process that has the old cache mapped keeps reading it intact.
+ */
+static void
+gen_table_save(const char *file, const vg_ge_t *tab)
+{
+	vg_gen_header_t hdr;
+	char tmpname[1024];
+	FILE *fp;
+	int res;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.gh_magic, VG_GEN_MAGIC, sizeof(hdr.gh_magic));
+	hdr.gh_npoints = VG_GEN_NPOINTS;
+	hdr.gh_pointsize = sizeof(vg_ge_t);
+	gen_table_hash(hdr.gh_hash, tab);
+
+	snprintf(tmpname, sizeof(tmpname), "%s.tmp", file);
+	fp = fopen(tmpname, "wb");
+	if (!fp) {
+		fprintf(stderr,
+			"WARNING: could not write table cache \"%s\"\n",
+			tmpname);
+		return;
+	}
+	res = (fwrite(&hdr, sizeof(hdr), 1, fp) == 1) &&
+		(fwrite(tab, sizeof(*tab), VG_GEN_NPOINTS, fp) ==
+		 VG_GEN_NPOINTS) &&
+		!fflush(fp);
+#if !defined(_WIN32)
+	if (res)
+		res = !fsync(fileno(fp));
+#endif
+	if (fclose(fp))
+		res = 0;
+#if defined(_WIN32)
+	if (res)
+		remove(file);
+#endif
+	if (res && rename(tmpname, file))
+		res = 0;
+	if (!res) {
+		fprintf(stderr,
+			"WARNING: could not write table cache \"%s\"\n",
+			file);
+		remove(tmpname);
+	}
+}
+
+/*
+ * Set up the shared table, from cachefile if it holds a valid one,
+ * otherwise by building it and then saving it to cachefile.  Does
+ * nothing if the table is already set up.  Not thread safe, returns 0
+ * if out of memory.
+ */
+int
+vg_ecmult_gen_init(const char *cachefile)
+{
+	vg_ge_t *tab;
+
+	if (vg_gen_table)
+		return 1;
+
+	if (cachefile) {
+		vg_gen_table = gen_table_load(cachefile);
+		if (vg_gen_table)
+			return 1;
+	}
+
+	tab = gen_table_alloc();
+	if (!tab)
+		return 0;
+	if (!gen_table_build(tab))
+		return 0;
+	if (cachefile)
+		gen_table_save(cachefile, tab);
+	vg_gen_table = tab;
+	return 1;
+}
+
+/* r = a if flag, flag is 0 or 1 */
+static INLINE void
+ge_cmov(vg_ge_t *r, const vg_ge_t *a, uint64_t flag)
+{
+	uint64_t mask = -flag;
+	int i;
+
+	for (i = 0; i < 5; i++) {
+		r->x.n[i] ^= mask & (r->x.n[i] ^ a->x.n[i]);
+		r->y.n[i] ^= mask & (r->y.n[i] ^ a->y.n[i]);
+	}
+}
+
+static INLINE void
+gej_cmov(vg_gej_t *r, const vg_gej_t *a, uint64_t flag)
+{
+	uint64_t mask = -flag;
+	int i;
+
+	for (i = 0; i < 5; i++) {
+		r->x.n[i] ^= mask & (r->x.n[i] ^ a->x.n[i]);
+		r->y.n[i] ^= mask & (r->y.n[i] ^ a->y.n[i]);
+		r->z.n[i] ^= mask & (r->z.n[i] ^ a->z.n[i]);
+	}
+	r->infinity ^= (int) (mask & (r->infinity ^ a->infinity));
+}
+
+/*
+ * r = k * G for a 32-byte big-endian k, which must be nonzero modulo
+ * the group order.  vg_ecmult_gen_init() must have been called.
+ */
+void
+vg_ecmult_gen(vg_ge_t *r, const unsigned char *k)
+{
+	const vg_ge_t *win;
+	vg_gej_t acc, sum;
+	vg_ge_t ent;
+	vg_fe_t scratch;
+	uint32_t b, e;
+	int i;
+
+	assert(vg_gen_table);
+	memset(&acc, 0, sizeof(acc));
+	acc.infinity = 1;
+	for (i = 0; i < VG_GEN_WINDOWS; i++) {
+		b = k[31 - i];
+		win = vg_gen_table + (i * VG_GEN_ENTRIES);
+		ent = win[0];
+		for (e = 1; e < VG_GEN_ENTRIES; e++)
+			ge_cmov(&ent, &win[e], ((e ^ (b - 1)) - 1) >> 31);
+		vg_gej_add_ge(&sum, &acc, &ent);
+		gej_cmov(&acc, &sum, (uint64_t) ((0 - b) >> 31));
+	}
+	vg_ge_set_all_gej(r, &acc, 1, &scratch);
+}
+
+/* Export a point with normalized coordinates as an OpenSSL point */
+int
+vg_ge_get_ecpoint(EC_POINT *r, const EC_GROUP *pgroup, const vg_ge_t *a,
+		  BN_CTX *bnctx)
+{
+	unsigned char buf[65];
+
+	vg_ge_get_pubkey(buf, a);
+	return EC_POINT_oct2point(pgroup, r, buf, sizeof(buf), bnctx);
+}
+
+/*
+ * Set the private key of pkey, and its public key using the shared
+ * table.  bnpriv must be in [1, n-1].
+ */
+int
+vg_ecmult_gen_key(EC_KEY *pkey, const BIGNUM *bnpriv, BN_CTX *bnctx)
+{
+	const EC_GROUP *pgroup;
+	EC_POINT *ppnt;
+	unsigned char k[32];
+	vg_ge_t pub;
+	int nbytes, res;
+
+	nbytes = BN_num_bytes(bnpriv);
+	if ((nbytes > 32) || BN_is_zero(bnpriv))
+		return 0;
+	memset(k, 0, sizeof(k));
+	BN_bn2bin(bnpriv, k + 32 - nbytes);
+	vg_ecmult_gen(&pub, k);
+
+	pgroup = EC_KEY_get0_group(pkey);
+	ppnt = EC_POINT_new(pgroup);
+	res = (ppnt &&
+	       vg_ge_get_ecpoint(ppnt, pgroup, &pub, bnctx) &&
+	       EC_KEY_set_private_key(pkey, bnpriv) &&
+	       EC_KEY_set_public_key(pkey, ppnt));
+	if (ppnt)
+		EC_POINT_free(ppnt);
+	OPENSSL_cleanse(k, sizeof(k));
+	return res;
+}
@@ -0,0 +1,99 @@
+/*
+ * Vanitygen, vanity bitcoin address generator
+ * Copyright (C) 2026 The Vanitygen contributors
+ *
+ * Vanitygen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * Vanitygen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with Vanitygen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined (__VG_SECP256K1_H__)
+#define __VG_SECP256K1_H__
+
+#include <stdint.h>
+
+#include <openssl/bn.h>
+#include <openssl/ec.h>
+
+/*
+ * Native secp256k1 field and group arithmetic for the search loop.
+ *
+ * Field elements are five 52-bit limbs, least significant first.
+ * Limbs may carry extra bits between reductions; the "magnitude" of
+ * an element bounds each limb to 2*m*(2^52-1) (2*m*(2^48-1) for the
+ * top limb).  Results of vg_fe_mul()/vg_fe_sqr() have magnitude 1,
+ * and their inputs must not exceed magnitude 8.
+ */
+typedef struct _vg_fe_s {
+	uint64_t	n[5];
+} vg_fe_t;
+
+/* Affine point, never the point at infinity */
+typedef struct _vg_ge_s {
+	vg_fe_t		x;
+	vg_fe_t		y;
+} vg_ge_t;
+
+/* Jacobian point, (x/z^2, y/z^3) */
+typedef struct _vg_gej_s {
+	vg_fe_t		x;
+	vg_fe_t		y;
+	vg_fe_t		z;
+	int		infinity;
+} vg_gej_t;
+
+/* Field element methods */
+extern void vg_fe_set_int(vg_fe_t *r, int a);
+extern void vg_fe_set_b32(vg_fe_t *r, const unsigned char *a);
+extern void vg_fe_get_b32(unsigned char *r, const vg_fe_t *a);
+extern void vg_fe_normalize(vg_fe_t *r);
+extern void vg_fe_normalize_weak(vg_fe_t *r);
+extern int vg_fe_normalizes_to_zero(const vg_fe_t *a);
+extern int vg_fe_is_odd(const vg_fe_t *a);
+extern void vg_fe_add(vg_fe_t *r, const vg_fe_t *a);
+extern void vg_fe_negate(vg_fe_t *r, const vg_fe_t *a, int m);
+extern void vg_fe_mul_int(vg_fe_t *r, int a);
+extern void vg_fe_mul(vg_fe_t *r, const vg_fe_t *a, const vg_fe_t *b);
+extern void vg_fe_sqr(vg_fe_t *r, const vg_fe_t *a);
+extern void vg_fe_inv(vg_fe_t *r, const vg_fe_t *a);
+
+/* Group element methods */
+extern void vg_ge_set_generator(vg_ge_t *r);
+extern int vg_ge_set_ecpoint(vg_ge_t *r, const EC_GROUP *pgroup,
+			     const EC_POINT *ppnt, BN_CTX *bnctx);
+extern void vg_ge_get_pubkey(unsigned char *r, const vg_ge_t *a);
+extern void vg_ge_get_pubkey_compressed(unsigned char *r, const vg_ge_t *a);
+extern void vg_ge_neg(vg_ge_t *r, const vg_ge_t *a);
+extern void vg_ge_mul_lambda(vg_ge_t *r, const vg_ge_t *a);
+extern void vg_gej_set_ge(vg_gej_t *r, const vg_ge_t *a);
+extern void vg_gej_double(vg_gej_t *r, const vg_gej_t *a);
+extern void vg_gej_add_ge(vg_gej_t *r, const vg_gej_t *a, const vg_ge_t *b);
+extern int vg_ge_set_all_gej(vg_ge_t *r, const vg_gej_t *a, int n,
+			     vg_fe_t *scratch);
+extern int vg_ge_add_batch(vg_ge_t *a, int n, const vg_ge_t *b,
+			   vg_fe_t *scratch);
+extern int vg_ge_add_batch_sym(vg_ge_t *r, vg_ge_t *c, const vg_ge_t *t,
+			       int m, const vg_ge_t *step, vg_fe_t *scratch);
+extern int vg_ge_get_ecpoint(EC_POINT *r, const EC_GROUP *pgroup,
+			     const vg_ge_t *a, BN_CTX *bnctx);
+
+/* Fixed-base multiplication by G, from a table shared by all threads */
+extern int vg_ecmult_gen_init(const char *cachefile);
+extern void vg_ecmult_gen(vg_ge_t *r, const unsigned char *k);
+extern int vg_ecmult_gen_key(EC_KEY *pkey, const BIGNUM *bnpriv,
+			     BN_CTX *bnctx);
+
+/* SIMD backend selection for vg_ge_add_batch_sym() */
+extern int vg_fe_init(const char *name);
+extern const char *vg_fe_backend_name(void);
+
+#endif /* !defined (__VG_SECP256K1_H__) */
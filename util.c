@@ -20,6 +20,10 @@
 #define _USE_MATH_DEFINES
 #endif /* defined(_WIN32) */
 
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif /* defined(__linux__) */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -39,6 +43,18 @@
 #include "pattern.h"
 #include "util.h"
 
+#if defined(__linux__)
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
 const char *vg_b58_alphabet = "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
 
 const signed char vg_b58_reverse_map[256] = {
@@ -237,21 +253,20 @@ out:
 
 void
 vg_encode_address(const EC_POINT *ppoint, const EC_GROUP *pgroup,
-		  int addrtype, char *result)
+		  point_conversion_form_t form, int addrtype, char *result)
 {
 	unsigned char eckey_buf[128], *pend;
 	unsigned char binres[21] = {0,};
 	unsigned char hash1[32];
-
-	pend = eckey_buf;
-
-	EC_POINT_point2oct(pgroup,
-			   ppoint,
-			   POINT_CONVERSION_UNCOMPRESSED,
-			   eckey_buf,
-			   sizeof(eckey_buf),
-			   NULL);
-	pend = eckey_buf + 0x41;
+	int len;
+
+	len = EC_POINT_point2oct(pgroup,
+				 ppoint,
+				 form,
+				 eckey_buf,
+				 sizeof(eckey_buf),
+				 NULL);
+	pend = eckey_buf + len;
 	binres[0] = addrtype;
 	SHA256(eckey_buf, pend - eckey_buf, hash1);
 	RIPEMD160(hash1, sizeof(hash1), &binres[1]);
@@ -261,27 +276,30 @@ vg_encode_address(const EC_POINT *ppoint, const EC_GROUP *pgroup,
 
 void
 vg_encode_script_address(const EC_POINT *ppoint, const EC_GROUP *pgroup,
-			 int addrtype, char *result)
+			 point_conversion_form_t form, int addrtype,
+			 char *result)
 {
 	unsigned char script_buf[69];
 	unsigned char *eckey_buf = script_buf + 2;
 	unsigned char binres[21] = {0,};
 	unsigned char hash1[32];
+	int len;
+
+	len = EC_POINT_point2oct(pgroup,
+				 ppoint,
+				 form,
+				 eckey_buf,
+				 65,
+				 NULL);
 
 	script_buf[ 0] = 0x51;  // OP_1
-	script_buf[ 1] = 0x41;  // pubkey length
-	// gap for pubkey
-	script_buf[67] = 0x51;  // OP_1
-	script_buf[68] = 0xae;  // OP_CHECKMULTISIG
-
-	EC_POINT_point2oct(pgroup,
-			   ppoint,
-			   POINT_CONVERSION_UNCOMPRESSED,
-			   eckey_buf,
-			   65,
-			   NULL);
+	script_buf[ 1] = len;   // pubkey length
+	// pubkey
+	script_buf[len + 2] = 0x51;  // OP_1
+	script_buf[len + 3] = 0xae;  // OP_CHECKMULTISIG
+
 	binres[0] = addrtype;
-	SHA256(script_buf, 69, hash1);
+	SHA256(script_buf, len + 4, hash1);
 	RIPEMD160(hash1, sizeof(hash1), &binres[1]);
 
 	vg_b58_encode_check(binres, sizeof(binres), result);
@@ -302,8 +320,13 @@ vg_encode_privkey(const EC_KEY *pkey, int addrtype, char *result)
 	if (nbytes < 32)
 		memset(eckey_buf + 1, 0, 32 - nbytes);
 	BN_bn2bin(bn, &eckey_buf[33 - nbytes]);
+	nbytes = 33;
 
-	vg_b58_encode_check(eckey_buf, 33, result);
+	/* Compressed public key flag */
+	if (EC_KEY_get_conv_form(pkey) == POINT_CONVERSION_COMPRESSED)
+		eckey_buf[nbytes++] = 0x01;
+
+	vg_b58_encode_check(eckey_buf, nbytes, result);
 }
 
 int
@@ -339,11 +362,15 @@ vg_decode_privkey(const char *b58encoded, EC_KEY *pkey, int *addrtype)
 	int res;
 
 	res = vg_b58_decode_check(b58encoded, ecpriv, sizeof(ecpriv));
-	if (res != 33)
+	if ((res != 33) && ((res != 34) || (ecpriv[33] != 0x01)))
 		return 0;
 
+	EC_KEY_set_conv_form(pkey, (res == 34) ?
+			     POINT_CONVERSION_COMPRESSED :
+			     POINT_CONVERSION_UNCOMPRESSED);
+
 	BN_init(&bnpriv);
-	BN_bin2bn(ecpriv + 1, res - 1, &bnpriv);
+	BN_bin2bn(ecpriv + 1, 32, &bnpriv);
 	res = vg_set_privkey(&bnpriv, pkey);
 	BN_clear_free(&bnpriv);
 	*addrtype = ecpriv[0];
@@ -1086,3 +1113,393 @@ vg_read_file(FILE *fp, char ***result, int *rescount)
 
 	return ret;
 }
+
+/*
+ * Hash the master seed of a deterministic search into out: the seed
+ * string itself, or for "-", the contents of seedfile, of which only
+ * the first 32 bytes are read from a device, or of stdin if there is
+ * no seedfile.
+ */
+int
+vg_read_seed(const char *seed, const char *seedfile, unsigned char *out)
+{
+	SHA256_CTX sha;
+	unsigned char buf[4096];
+	size_t n, max = (size_t) -1;
+	FILE *fp;
+
+	SHA256_Init(&sha);
+	if (strcmp(seed, "-")) {
+		SHA256_Update(&sha, seed, strlen(seed));
+	} else {
+		fp = seedfile ? fopen(seedfile, "rb") : stdin;
+		if (!fp)
+			return 0;
+#if !defined(_WIN32)
+		{	struct stat st;
+			if (!fstat(fileno(fp), &st) &&
+			    (S_ISCHR(st.st_mode) || S_ISBLK(st.st_mode)))
+				max = 32;
+		}
+#endif
+		while (max &&
+		       ((n = fread(buf, 1, (max < sizeof(buf)) ?
+				   max : sizeof(buf), fp)) > 0)) {
+			SHA256_Update(&sha, buf, n);
+			max -= n;
+		}
+		if (fp != stdin)
+			fclose(fp);
+		OPENSSL_cleanse(buf, sizeof(buf));
+	}
+	SHA256_Final(out, &sha);
+	OPENSSL_cleanse(&sha, sizeof(sha));
+	return 1;
+}
+
+
+/*
+ * CPU feature detection for the SIMD code paths
+ *
+ * The AVX and AVX-512 bits are only reported when the OS saves the
+ * corresponding register state.
+ */
+
+static void
+vg_cpuid(unsigned int leaf, unsigned int sub, unsigned int *r)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	r[0] = r[1] = r[2] = r[3] = 0;
+	if (leaf <= __get_cpuid_max(0, NULL))
+		__cpuid_count(leaf, sub, r[0], r[1], r[2], r[3]);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	int regs[4];
+	__cpuidex(regs, leaf, sub);
+	r[0] = regs[0]; r[1] = regs[1]; r[2] = regs[2]; r[3] = regs[3];
+#else
+	r[0] = r[1] = r[2] = r[3] = 0;
+#endif
+}
+
+static unsigned long long
+vg_xgetbv(void)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	unsigned int lo, hi;
+	__asm__ __volatile__ ("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+	return ((unsigned long long) hi << 32) | lo;
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	return _xgetbv(0);
+#else
+	return 0;
+#endif
+}
+
+unsigned int
+vg_cpu_features(void)
+{
+	static int detected = 0;
+	static unsigned int features = 0;
+	unsigned int r1[4], r7[4];
+	unsigned long long xcr0 = 0;
+
+	if (detected)
+		return features;
+
+	vg_cpuid(0, 0, r1);
+	if (!r1[0]) {
+		detected = 1;
+		return features;
+	}
+	vg_cpuid(1, 0, r1);
+	vg_cpuid(7, 0, r7);
+
+	if (r1[2] & (1 << 9))
+		features |= VG_CPU_SSSE3;
+	if (r1[2] & (1 << 19))
+		features |= VG_CPU_SSE41;
+	if (r7[1] & (1 << 8))
+		features |= VG_CPU_BMI2;
+	if (r7[1] & (1 << 29))
+		features |= VG_CPU_SHA;
+
+	/* OSXSAVE, then check the enabled register state */
+	if (r1[2] & (1 << 27))
+		xcr0 = vg_xgetbv();
+
+	if (((xcr0 & 0x06) == 0x06) && (r1[2] & (1 << 28))) {
+		features |= VG_CPU_AVX;
+		if (r7[1] & (1 << 5))
+			features |= VG_CPU_AVX2;
+	}
+	if (((xcr0 & 0xe6) == 0xe6) && (r7[1] & (1 << 16))) {
+		features |= VG_CPU_AVX512F;
+		if (r7[1] & (1 << 21))
+			features |= VG_CPU_AVX512IFMA;
+		if (r7[1] & (1 << 30))
+			features |= VG_CPU_AVX512BW;
+	}
+
+	detected = 1;
+	return features;
+}
+
+
+/*
+ * CPU placement
+ *
+ * The usable CPU count honors the process affinity mask and the CPU
+ * quota of the enclosing cgroup, as set up by container runtimes.
+ * Worker threads can be pinned in an order derived from the sysfs
+ * topology of the CPUs in the affinity mask.
+ */
+
+static int
+vg_read_int_file(const char *path, long long *a, long long *b)
+{
+	FILE *fp;
+	int res;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return 0;
+	res = b ? fscanf(fp, "%lld %lld", a, b) : fscanf(fp, "%lld", a);
+	fclose(fp);
+	return res;
+}
+
+int
+vg_cpu_quota(void)
+{
+	long long quota, period;
+
+	/* cgroup v2: "<quota> <period>", or "max <period>" if unlimited */
+	if ((vg_read_int_file("/sys/fs/cgroup/cpu.max",
+			      &quota, &period) == 2) ||
+	    ((vg_read_int_file("/sys/fs/cgroup/cpu/cpu.cfs_quota_us",
+			       &quota, NULL) == 1) &&
+	     (vg_read_int_file("/sys/fs/cgroup/cpu/cpu.cfs_period_us",
+			       &period, NULL) == 1))) {
+		if ((quota > 0) && (period > 0))
+			return (int) ((quota + period - 1) / period);
+	}
+	return 0;
+}
+
+#if defined(__linux__)
+
+typedef struct _vg_cpu_topo_s {
+	int	ct_cpu;
+	int	ct_package;
+	int	ct_core;
+	int	ct_sibling;
+} vg_cpu_topo_t;
+
+static int
+vg_cpu_topo_cmp_core(const void *a, const void *b)
+{
+	const vg_cpu_topo_t *ta = (const vg_cpu_topo_t *) a;
+	const vg_cpu_topo_t *tb = (const vg_cpu_topo_t *) b;
+
+	/* One thread per physical core first, then the SMT siblings */
+	if (ta->ct_sibling != tb->ct_sibling)
+		return ta->ct_sibling - tb->ct_sibling;
+	if (ta->ct_package != tb->ct_package)
+		return ta->ct_package - tb->ct_package;
+	if (ta->ct_core != tb->ct_core)
+		return ta->ct_core - tb->ct_core;
+	return ta->ct_cpu - tb->ct_cpu;
+}
+
+static int
+vg_cpu_topo_cmp_smt(const void *a, const void *b)
+{
+	const vg_cpu_topo_t *ta = (const vg_cpu_topo_t *) a;
+	const vg_cpu_topo_t *tb = (const vg_cpu_topo_t *) b;
+
+	/* The SMT siblings of each core next to each other */
+	if (ta->ct_package != tb->ct_package)
+		return ta->ct_package - tb->ct_package;
+	if (ta->ct_core != tb->ct_core)
+		return ta->ct_core - tb->ct_core;
+	return ta->ct_cpu - tb->ct_cpu;
+}
+
+static int
+vg_cpu_topology(int cpu, const char *name)
+{
+	char path[128];
+	long long val;
+
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+	if (vg_read_int_file(path, &val, NULL) != 1)
+		return -1;
+	return (int) val;
+}
+
+int
+vg_cpu_affinity_count(void)
+{
+	cpu_set_t set;
+
+	if (sched_getaffinity(0, sizeof(set), &set))
+		return -1;
+	return CPU_COUNT(&set);
+}
+
+int
+vg_cpu_pin_order(enum vg_cpu_pin mode, int **cpusp)
+{
+	cpu_set_t set;
+	vg_cpu_topo_t *topo;
+	int *cpus;
+	int i, j, k, n;
+
+	*cpusp = NULL;
+	if (sched_getaffinity(0, sizeof(set), &set))
+		return -1;
+	n = CPU_COUNT(&set);
+	topo = (vg_cpu_topo_t *) malloc(n * sizeof(*topo));
+	cpus = (int *) malloc(n * sizeof(*cpus));
+	if (!topo || !cpus) {
+		free(topo);
+		free(cpus);
+		return -1;
+	}
+
+	for (i = 0, j = 0; (i < CPU_SETSIZE) && (j < n); i++) {
+		if (!CPU_ISSET(i, &set))
+			continue;
+		topo[j].ct_cpu = i;
+		topo[j].ct_package = vg_cpu_topology(i, "physical_package_id");
+		topo[j].ct_core = vg_cpu_topology(i, "core_id");
+		if (topo[j].ct_core < 0)
+			topo[j].ct_core = i;
+		topo[j].ct_sibling = 0;
+		for (k = 0; k < j; k++) {
+			if ((topo[k].ct_package == topo[j].ct_package) &&
+			    (topo[k].ct_core == topo[j].ct_core))
+				topo[j].ct_sibling++;
+		}
+		j++;
+	}
+
+	qsort(topo, n, sizeof(*topo),
+	      (mode == VG_PIN_SMT) ?
+	      vg_cpu_topo_cmp_smt : vg_cpu_topo_cmp_core);
+	for (i = 0; i < n; i++)
+		cpus[i] = topo[i].ct_cpu;
+	free(topo);
+	*cpusp = cpus;
+	return n;
+}
+
+int
+vg_cpu_pin_attr(pthread_attr_t *attr, int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+}
+
+int
+vg_cpu_pin_self(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+int
+vg_numa_node_count(void)
+{
+	char path[64];
+	int i, count = 0;
+
+	for (i = 0; i < 64; i++) {
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/node/node%d", i);
+		if (!access(path, F_OK))
+			count++;
+	}
+	return count;
+}
+
+int
+vg_numa_node_self(void)
+{
+	unsigned int cpu, node;
+
+	if (syscall(SYS_getcpu, &cpu, &node, NULL))
+		return -1;
+	return (int) node;
+}
+
+#else /* !defined(__linux__) */
+
+int
+vg_cpu_affinity_count(void)
+{
+	return -1;
+}
+
+int
+vg_cpu_pin_order(enum vg_cpu_pin mode, int **cpusp)
+{
+	*cpusp = NULL;
+	return -1;
+}
+
+int
+vg_cpu_pin_attr(pthread_attr_t *attr, int cpu)
+{
+	return -1;
+}
+
+int
+vg_cpu_pin_self(int cpu)
+{
+	return -1;
+}
+
+int
+vg_numa_node_count(void)
+{
+	return 1;
+}
+
+int
+vg_numa_node_self(void)
+{
+	return -1;
+}
+
+#endif /* defined(__linux__) */
+
+
+VG_THREAD_LOCAL unsigned long long *vg_stage_ticks = NULL;
+
+/*
+ * Cheap timestamp for stage timing: the time stamp counter on x86,
+ * microseconds elsewhere
+ */
+unsigned long long
+vg_timestamp(void)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	unsigned int lo, hi;
+	__asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((unsigned long long) hi << 32) | lo;
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	return __rdtsc();
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec * 1000000ULL) + tv.tv_usec;
+#endif
+}
@@ -22,6 +22,8 @@
 #include <stdio.h>
 #include <stdint.h>
 
+#include <pthread.h>
+
 #include <openssl/bn.h>
 #include <openssl/ec.h>
 
@@ -37,9 +39,11 @@ extern void vg_b58_encode_check(void *buf, size_t len, char *result);
 extern int vg_b58_decode_check(const char *input, void *buf, size_t len);
 
 extern void vg_encode_address(const EC_POINT *ppoint, const EC_GROUP *pgroup,
-			      int addrtype, char *result);
+			      point_conversion_form_t form, int addrtype,
+			      char *result);
 extern void vg_encode_script_address(const EC_POINT *ppoint,
 				     const EC_GROUP *pgroup,
+				     point_conversion_form_t form,
 				     int addrtype, char *result);
 extern void vg_encode_privkey(const EC_KEY *pkey, int addrtype, char *result);
 extern int vg_set_privkey(const BIGNUM *bnpriv, EC_KEY *pkey);
@@ -74,5 +78,65 @@ extern int vg_read_password(char *buf, size_t size);
 extern int vg_check_password_complexity(const char *pass, int verbose);
 
 extern int vg_read_file(FILE *fp, char ***result, int *rescount);
+extern int vg_read_seed(const char *seed, const char *seedfile,
+			unsigned char *out);
+
+enum {
+	VG_CPU_SSSE3 = (1 << 0),
+	VG_CPU_SSE41 = (1 << 1),
+	VG_CPU_AVX = (1 << 2),
+	VG_CPU_AVX2 = (1 << 3),
+	VG_CPU_BMI2 = (1 << 4),
+	VG_CPU_SHA = (1 << 5),
+	VG_CPU_AVX512F = (1 << 6),
+	VG_CPU_AVX512IFMA = (1 << 7),
+	VG_CPU_AVX512BW = (1 << 8),
+};
+
+extern unsigned int vg_cpu_features(void);
+
+enum vg_cpu_pin {
+	VG_PIN_NONE,
+	VG_PIN_CORE,
+	VG_PIN_SMT,
+};
+
+extern int vg_cpu_quota(void);
+extern int vg_cpu_affinity_count(void);
+extern int vg_cpu_pin_order(enum vg_cpu_pin mode, int **cpusp);
+extern int vg_cpu_pin_attr(pthread_attr_t *attr, int cpu);
+extern int vg_cpu_pin_self(int cpu);
+extern int vg_numa_node_count(void);
+extern int vg_numa_node_self(void);
+
+/*
+ * Stage timing for benchmarks.  A thread that points vg_stage_ticks
+ * at VG_NSTAGES counters gets the vg_timestamp() ticks spent in each
+ * stage added to them.  The hot loops skip the timing otherwise.
+ */
+enum vg_stage {
+	VG_STAGE_STEP,
+	VG_STAGE_INVERT,
+	VG_STAGE_SERIALIZE,
+	VG_STAGE_SHA256,
+	VG_STAGE_RIPEMD160,
+	VG_STAGE_TEST,
+	VG_NSTAGES
+};
+
+#if defined(_MSC_VER)
+#define VG_THREAD_LOCAL __declspec(thread)
+#else
+#define VG_THREAD_LOCAL __thread
+#endif
+
+/* vg_timestamp() counts TSC cycles where it can, microseconds otherwise */
+#if (defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))) || \
+	(defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86)))
+#define VG_TIMESTAMP_CYCLES 1
+#endif
+
+extern VG_THREAD_LOCAL unsigned long long *vg_stage_ticks;
+extern unsigned long long vg_timestamp(void);
 
 #endif /* !defined (__VG_UTIL_H__) */
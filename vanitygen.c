@@ -20,20 +20,498 @@
 #include <string.h>
 #include <math.h>
 #include <assert.h>
+#include <signal.h>
 
 #include <pthread.h>
+#include <sched.h>
 
-#include <openssl/sha.h>
-#include <openssl/ripemd.h>
 #include <openssl/ec.h>
 #include <openssl/bn.h>
 #include <openssl/rand.h>
 
 #include "pattern.h"
 #include "util.h"
+#include "secp256k1.h"
+#include "hash.h"
 
 const char *version = VANITYGEN_VERSION;
 
+#define VG_BATCH_MIN 256
+#define VG_BATCH_MAX 8192
+
+/* Points per batched hash160 call, and the message slot size */
+#define VG_HASH_CHUNK 16
+#define VG_MSG_STRIDE 72
+#define VG_CHUNK_MSG (VG_HASH_CHUNK * 6 * VG_MSG_STRIDE)
+
+#define VG_STREAMS_MAX 4
+#define VG_RUN_NONE ((unsigned long long) -1)
+
+
+/*
+ * One of the independent key streams driven by a search thread.
+ * The thread switches between its streams after every batch.
+ */
+typedef struct _vg_stream_s {
+	EC_KEY		*vst_key;
+	int		vst_delta;
+	BN_ULONG	vst_npoints;
+	BN_ULONG	vst_rekey_at;
+	BN_ULONG	vst_nbatch;
+	vg_ge_t		*vst_ppnt;
+	vg_gej_t	*vst_pjpnt;
+	vg_fe_t		*vst_pscratch;
+	vg_ge_t		vst_center;
+	unsigned long long vst_keyrun;
+	unsigned long long vst_prevrun;
+	unsigned char	vst_privkey[32];
+	unsigned int	vst_run;
+} vg_stream_t;
+
+
+/*
+ * Layout of the serialized public keys of a chunk of points: which
+ * encodings are hashed, and where the key sits in each message
+ */
+typedef struct _vg_msg_fmt_s {
+	int		vmf_nvariants;
+	int		vmf_efirst;
+	int		vmf_elast;
+	int		vmf_eckey_off;
+	int		vmf_hash_len[2];
+} vg_msg_fmt_t;
+
+
+/*
+ * Pipelined search
+ *
+ * Stepping threads serialize chunks of points into records, and pass
+ * them through single-producer single-consumer rings to hashing
+ * threads, which hash and test them.  There are max(steppers, hashers)
+ * rings, ring r going from stepper r % nsteppers to hasher
+ * r % nhashers, so the two stages can be sized independently.
+ *
+ * A record carries the private key of the run it was stepped from,
+ * so the hasher can rebuild a matching key.  A match retires its run:
+ * the stepper rekeys the stream, and records of the run still in the
+ * rings are dropped.
+ */
+#define VG_RING_SLOTS 8
+
+typedef struct _vg_chunk_s {
+	unsigned char	vch_privkey[32];
+	unsigned int	vch_run;
+	unsigned long	vch_unit;
+	unsigned long long vch_keyrun;
+	int		vch_stream;
+	int		vch_delta;
+	int		vch_npoints;
+	unsigned char	vch_msg[2][VG_CHUNK_MSG];
+} vg_chunk_t;
+
+typedef struct _vg_ring_s {
+	unsigned int	vr_head;
+	char		vr_pad0[60];
+	unsigned int	vr_tail;
+	char		vr_pad1[60];
+	vg_chunk_t	vr_slots[VG_RING_SLOTS];
+} vg_ring_t;
+
+typedef struct _vg_pipeline_s {
+	vg_context_t	*vpl_vc;
+	int		vpl_nsteppers;
+	int		vpl_nhashers;
+	int		vpl_nrings;
+	vg_ring_t	*vpl_rings;
+	unsigned int	*vpl_retired;
+	int		vpl_nextstepper;
+	int		vpl_nexthasher;
+	pthread_mutex_t	vpl_lock;
+} vg_pipeline_t;
+
+static vg_pipeline_t *vg_pipeline = NULL;
+
+/*
+ * The producer publishes a slot by storing the ring head with
+ * release semantics, and the consumer frees it by storing the tail.
+ */
+#if defined(__GNUC__)
+#define vg_load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define vg_store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#else
+#define vg_load_acquire(p) (*(volatile unsigned int *) (p))
+#define vg_store_release(p, v) (*(volatile unsigned int *) (p) = (v))
+#endif
+
+vg_chunk_t *
+vg_ring_reserve(vg_ring_t *vrp)
+{
+	if ((vrp->vr_head - vg_load_acquire(&vrp->vr_tail)) == VG_RING_SLOTS)
+		return NULL;
+	return &vrp->vr_slots[vrp->vr_head % VG_RING_SLOTS];
+}
+
+void
+vg_ring_commit(vg_ring_t *vrp)
+{
+	vg_store_release(&vrp->vr_head, vrp->vr_head + 1);
+}
+
+vg_chunk_t *
+vg_ring_peek(vg_ring_t *vrp)
+{
+	if (vrp->vr_tail == vg_load_acquire(&vrp->vr_head))
+		return NULL;
+	return &vrp->vr_slots[vrp->vr_tail % VG_RING_SLOTS];
+}
+
+void
+vg_ring_release(vg_ring_t *vrp)
+{
+	vg_store_release(&vrp->vr_tail, vrp->vr_tail + 1);
+}
+
+/*
+ * Take the next thread index of a pipeline stage
+ */
+int
+vg_pipeline_join(vg_pipeline_t *vplp, int *nextp)
+{
+	int index;
+
+	pthread_mutex_lock(&vplp->vpl_lock);
+	index = (*nextp)++;
+	pthread_mutex_unlock(&vplp->vpl_lock);
+	return index;
+}
+
+
+void
+vg_msg_fmt_init(vg_context_t *vcp, vg_msg_fmt_t *fmtp)
+{
+	fmtp->vmf_nvariants = vcp->vc_variants;
+	fmtp->vmf_efirst = (vcp->vc_compression == VCC_COMPRESSED) ? 1 : 0;
+	fmtp->vmf_elast = (vcp->vc_compression == VCC_UNCOMPRESSED) ? 0 : 1;
+	if (vcp->vc_format == VCF_SCRIPT) {
+		fmtp->vmf_eckey_off = 2;
+		fmtp->vmf_hash_len[0] = 69;
+		fmtp->vmf_hash_len[1] = 37;
+	} else {
+		fmtp->vmf_eckey_off = 0;
+		fmtp->vmf_hash_len[0] = 65;
+		fmtp->vmf_hash_len[1] = 33;
+	}
+}
+
+/*
+ * msg[0] holds the uncompressed encodings of a chunk of points,
+ * msg[1] the compressed ones, VG_MSG_STRIDE bytes apart.  The script
+ * bytes around the keys are constant.
+ */
+void
+vg_msg_init(vg_context_t *vcp, unsigned char (*msg)[VG_CHUNK_MSG])
+{
+	int i;
+
+	for (i = 0; i < (VG_HASH_CHUNK * 6); i++) {
+		unsigned char *pmsg0 = msg[0] + (i * VG_MSG_STRIDE);
+		unsigned char *pmsg1 = msg[1] + (i * VG_MSG_STRIDE);
+		if (vcp->vc_format == VCF_SCRIPT) {
+			pmsg0[ 0] = 0x51;  // OP_1
+			pmsg0[ 1] = 0x41;  // pubkey length
+			// gap for pubkey
+			pmsg0[67] = 0x51;  // OP_1
+			pmsg0[68] = 0xae;  // OP_CHECKMULTISIG
+
+			pmsg1[ 0] = 0x51;  // OP_1
+			pmsg1[ 1] = 0x21;  // pubkey length
+			// gap for pubkey
+			pmsg1[35] = 0x51;  // OP_1
+			pmsg1[36] = 0xae;  // OP_CHECKMULTISIG
+		}
+	}
+}
+
+/*
+ * Serialize every variant and encoding of a chunk of points.
+ *
+ * Variant v of the point is (-1)^(v & 1) * lambda^(v >> 1) times it,
+ * see vg_exec_context_consolidate_key().
+ */
+void
+vg_msg_serialize(const vg_msg_fmt_t *fmtp, unsigned char (*msg)[VG_CHUNK_MSG],
+		 const vg_ge_t *ppnt, int npoints)
+{
+	vg_ge_t vpnt[2];
+	int j, k, v;
+
+	for (j = 0, k = 0; j < npoints; j++) {
+		vpnt[0] = ppnt[j];
+		for (v = 0; v < fmtp->vmf_nvariants; v++, k++) {
+			if (v & 1)
+				vg_ge_neg(&vpnt[1], &vpnt[0]);
+			else if (v)
+				vg_ge_mul_lambda(&vpnt[0], &vpnt[0]);
+			if (fmtp->vmf_efirst == 0)
+				vg_ge_get_pubkey(msg[0] + fmtp->vmf_eckey_off +
+						 (k * VG_MSG_STRIDE),
+						 &vpnt[v & 1]);
+			if (fmtp->vmf_elast == 1)
+				vg_ge_get_pubkey_compressed(
+					msg[1] + fmtp->vmf_eckey_off +
+					(k * VG_MSG_STRIDE),
+					&vpnt[v & 1]);
+		}
+	}
+}
+
+/*
+ * Hash a serialized chunk in one batch, then test the results of each
+ * encoding as a batch, the first point being delta steps from the
+ * context's key.  Returns the first nonzero test result, with the
+ * index of the point that produced it in *pj, or 0.
+ */
+int
+vg_msg_test(vg_exec_context_t *vxcp, const vg_msg_fmt_t *fmtp,
+	    unsigned char (*msg)[VG_CHUNK_MSG], int npoints, int delta,
+	    int *pj)
+{
+	unsigned char hash_out[2][VG_HASH_CHUNK * 6 * 20];
+	vg_test_batch_func_t test_batch = vxcp->vxc_vc->vc_test_batch;
+	unsigned long long t0 = 0;
+	int e, res;
+
+	for (e = fmtp->vmf_efirst; e <= fmtp->vmf_elast; e++)
+		vg_hash160_batch(hash_out[e], msg[e], VG_MSG_STRIDE,
+				 fmtp->vmf_hash_len[e],
+				 npoints * fmtp->vmf_nvariants);
+
+	if (vg_stage_ticks)
+		t0 = vg_timestamp();
+	res = 0;
+	for (e = fmtp->vmf_efirst; e <= fmtp->vmf_elast; e++) {
+		vxcp->vxc_compressed = e;
+		res = test_batch(vxcp, hash_out[e],
+				 npoints * fmtp->vmf_nvariants, delta);
+		if (res) {
+			*pj = vxcp->vxc_test_index / fmtp->vmf_nvariants;
+			break;
+		}
+	}
+	if (vg_stage_ticks)
+		vg_stage_ticks[VG_STAGE_TEST] += vg_timestamp() - t0;
+	return res;
+}
+
+
+vg_pipeline_t *
+vg_pipeline_new(vg_context_t *vcp, int nsteppers, int nhashers)
+{
+	vg_pipeline_t *vplp;
+	int i, j;
+
+	vplp = (vg_pipeline_t *) malloc(sizeof(*vplp));
+	if (!vplp)
+		return NULL;
+	memset(vplp, 0, sizeof(*vplp));
+	vplp->vpl_vc = vcp;
+	vplp->vpl_nsteppers = nsteppers;
+	vplp->vpl_nhashers = nhashers;
+	vplp->vpl_nrings = (nsteppers > nhashers) ? nsteppers : nhashers;
+	vplp->vpl_rings = (vg_ring_t *)
+		malloc(vplp->vpl_nrings * sizeof(*vplp->vpl_rings));
+	vplp->vpl_retired = (unsigned int *)
+		malloc(nsteppers * VG_STREAMS_MAX *
+		       sizeof(*vplp->vpl_retired));
+	if (!vplp->vpl_rings || !vplp->vpl_retired) {
+		if (vplp->vpl_rings)
+			free(vplp->vpl_rings);
+		if (vplp->vpl_retired)
+			free(vplp->vpl_retired);
+		free(vplp);
+		return NULL;
+	}
+	memset(vplp->vpl_rings, 0,
+	       vplp->vpl_nrings * sizeof(*vplp->vpl_rings));
+	memset(vplp->vpl_retired, 0,
+	       nsteppers * VG_STREAMS_MAX * sizeof(*vplp->vpl_retired));
+	for (i = 0; i < vplp->vpl_nrings; i++)
+		for (j = 0; j < VG_RING_SLOTS; j++)
+			vg_msg_init(vcp,
+				    vplp->vpl_rings[i].vr_slots[j].vch_msg);
+	pthread_mutex_init(&vplp->vpl_lock, NULL);
+	return vplp;
+}
+
+
+/*
+ * Benchmark mode
+ *
+ * Every search thread stops after its share of a fixed key count, and
+ * adds the time spent in each stage of the search loop to its own
+ * counters.  Stage times are vg_timestamp() ticks, converted to time
+ * with the tick rate measured over the whole run.
+ */
+typedef struct _vg_bench_thread_s {
+	unsigned long long	vbt_keys;
+	unsigned long long	vbt_ticks[VG_NSTAGES];
+	unsigned long long	vbt_tstart;
+	unsigned long long	vbt_tend;
+	struct timeval		vbt_start;
+	struct timeval		vbt_end;
+} vg_bench_thread_t;
+
+typedef struct _vg_bench_s {
+	unsigned long long	vb_keys;
+	int			vb_json;
+	int			vb_nthreads;
+	int			vb_next;
+	pthread_mutex_t		vb_lock;
+	vg_bench_thread_t	*vb_threads;
+	pthread_t		*vb_pthreads;
+} vg_bench_t;
+
+static vg_bench_t *vg_bench = NULL;
+
+static const char *vg_bench_stage_names[VG_NSTAGES] = {
+	"step", "invert", "serialize", "sha256", "ripemd160", "test",
+};
+
+/*
+ * Take the next thread slot, and start timing this thread's stages
+ */
+vg_bench_thread_t *
+vg_bench_join(vg_bench_t *vbp)
+{
+	vg_bench_thread_t *vbtp;
+
+	pthread_mutex_lock(&vbp->vb_lock);
+	vbtp = &vbp->vb_threads[vbp->vb_next++];
+	pthread_mutex_unlock(&vbp->vb_lock);
+
+	vg_stage_ticks = vbtp->vbt_ticks;
+	gettimeofday(&vbtp->vbt_start, NULL);
+	vbtp->vbt_tstart = vg_timestamp();
+	return vbtp;
+}
+
+void
+vg_bench_leave(vg_bench_thread_t *vbtp)
+{
+	vbtp->vbt_tend = vg_timestamp();
+	gettimeofday(&vbtp->vbt_end, NULL);
+	vg_stage_ticks = NULL;
+}
+
+static double
+vg_bench_seconds(const struct timeval *start, const struct timeval *end)
+{
+	return (end->tv_sec - start->tv_sec) +
+		((end->tv_usec - start->tv_usec) / 1000000.0);
+}
+
+void
+vg_bench_report(vg_bench_t *vbp, vg_context_t *vcp)
+{
+	vg_bench_thread_t *vbtp;
+	unsigned long long keys = 0, ticks = 0, stage[VG_NSTAGES + 1];
+	struct timeval start, end;
+	double busy = 0.0, wall, secs, ns_per_tick;
+	int i, j;
+
+	memset(stage, 0, sizeof(stage));
+	start = vbp->vb_threads[0].vbt_start;
+	end = vbp->vb_threads[0].vbt_end;
+	for (i = 0; i < vbp->vb_nthreads; i++) {
+		vbtp = &vbp->vb_threads[i];
+		keys += vbtp->vbt_keys;
+		ticks += vbtp->vbt_tend - vbtp->vbt_tstart;
+		busy += vg_bench_seconds(&vbtp->vbt_start, &vbtp->vbt_end);
+		for (j = 0; j < VG_NSTAGES; j++)
+			stage[j] += vbtp->vbt_ticks[j];
+		if (timercmp(&vbtp->vbt_start, &start, <))
+			start = vbtp->vbt_start;
+		if (timercmp(&vbtp->vbt_end, &end, >))
+			end = vbtp->vbt_end;
+	}
+	wall = vg_bench_seconds(&start, &end);
+	if (wall <= 0.0)
+		wall = 1e-6;
+	ns_per_tick = (ticks && (busy > 0.0)) ? ((busy * 1e9) / ticks) : 0.0;
+
+	/* Stepping is timed including its inversion, the rest is other */
+	stage[VG_STAGE_STEP] -= (stage[VG_STAGE_INVERT] <
+				 stage[VG_STAGE_STEP]) ?
+		stage[VG_STAGE_INVERT] : stage[VG_STAGE_STEP];
+	for (j = 0; j < VG_NSTAGES; j++)
+		stage[VG_NSTAGES] += stage[j];
+	stage[VG_NSTAGES] = (stage[VG_NSTAGES] < ticks) ?
+		(ticks - stage[VG_NSTAGES]) : 0;
+	if (!ticks)
+		ticks = 1;
+	if (!keys)
+		keys = 1;
+
+	if (vbp->vb_json) {
+		printf("{\"version\": \"%s\", \"threads\": %d, "
+		       "\"stepping\": \"%s\", \"batch\": %d, "
+		       "\"streams\": %d, \"field\": \"%s\", "
+		       "\"sha256\": \"%s\", \"ripemd160\": \"%s\", "
+		       "\"keys\": %llu, \"seconds\": %.6f, "
+		       "\"keys_per_second\": %.0f, \"per_thread\": [",
+		       version, vbp->vb_nthreads,
+		       (vcp->vc_stepping == VCS_SYMMETRIC) ? "symmetric" :
+		       (vcp->vc_stepping == VCS_AFFINE) ? "affine" : "jacobian",
+		       vcp->vc_batchsize, vcp->vc_streams,
+		       vg_fe_backend_name(), vg_hash_backend_name(),
+		       vg_hash_ripemd160_backend_name(),
+		       keys, wall, keys / wall);
+		for (i = 0; i < vbp->vb_nthreads; i++) {
+			vbtp = &vbp->vb_threads[i];
+			secs = vg_bench_seconds(&vbtp->vbt_start,
+						&vbtp->vbt_end);
+			printf("%s{\"keys\": %llu, \"seconds\": %.6f, "
+			       "\"keys_per_second\": %.0f}",
+			       i ? ", " : "", vbtp->vbt_keys, secs,
+			       (secs > 0.0) ? (vbtp->vbt_keys / secs) : 0.0);
+		}
+		printf("], \"stages\": {");
+		for (j = 0; j <= VG_NSTAGES; j++)
+			printf("%s\"%s\": {\"share\": %.4f, "
+			       "\"ns_per_key\": %.2f}",
+			       j ? ", " : "",
+			       (j < VG_NSTAGES) ? vg_bench_stage_names[j] :
+			       "other",
+			       (double) stage[j] / ticks,
+			       (stage[j] * ns_per_tick) / keys);
+		printf("}}\n");
+		return;
+	}
+
+	printf("Benchmark: %d thread(s), %s stepping, %d points per batch, "
+	       "%d stream(s)\n",
+	       vbp->vb_nthreads,
+	       (vcp->vc_stepping == VCS_SYMMETRIC) ? "symmetric" :
+	       (vcp->vc_stepping == VCS_AFFINE) ? "affine" : "jacobian",
+	       vcp->vc_batchsize, vcp->vc_streams);
+	printf("Keys: %llu in %.3fs, %.3f Mkey/s, %.3f Mkey/s per thread\n",
+	       keys, wall, keys / wall / 1e6,
+	       keys / wall / 1e6 / vbp->vb_nthreads);
+	for (i = 0; i < vbp->vb_nthreads; i++) {
+		vbtp = &vbp->vb_threads[i];
+		secs = vg_bench_seconds(&vbtp->vbt_start, &vbtp->vbt_end);
+		printf("  Thread %d: %llu keys in %.3fs, %.3f Mkey/s\n",
+		       i, vbtp->vbt_keys, secs,
+		       (secs > 0.0) ? (vbtp->vbt_keys / secs / 1e6) : 0.0);
+	}
+	printf("Stage        Share    ns/key\n");
+	for (j = 0; j <= VG_NSTAGES; j++)
+		printf("%-12s %5.1f%% %9.2f\n",
+		       (j < VG_NSTAGES) ? vg_bench_stage_names[j] : "other",
+		       (100.0 * stage[j]) / ticks,
+		       (stage[j] * ns_per_tick) / keys);
+}
+
 
 /*
  * Address search thread main loop
@@ -42,31 +520,34 @@ const char *version = VANITYGEN_VERSION;
 void *
 vg_thread_loop(void *arg)
 {
-	unsigned char hash_buf[128];
-	unsigned char *eckey_buf;
-	unsigned char hash1[32];
+	unsigned char msg_buf[2][VG_CHUNK_MSG];
+	vg_msg_fmt_t fmt;
 
-	int i, c, len, output_interval;
-	int hash_len;
+	int i, j, s, r, stepper;
+	int nchunk, delta, nstreams, nwork;
 
 	const BN_ULONG rekey_max = 10000000;
 	BN_ULONG npoints, rekey_at, nbatch;
+	unsigned long long resume, t0 = 0, *ticks = NULL;
 
 	vg_context_t *vcp = (vg_context_t *) arg;
 	EC_KEY *pkey = NULL;
 	const EC_GROUP *pgroup;
-	const EC_POINT *pgen;
-	const int ptarraysize = 256;
-	EC_POINT *ppnt[ptarraysize];
+	int ptarraysize, nhalf;
+	vg_ge_t *ppnt = NULL;
+	vg_gej_t *pjpnt = NULL;
+	vg_fe_t *pscratch = NULL;
+	vg_ge_t *ptable = NULL;
+	vg_ge_t gen, batchinc, pubkey_base, center;
 	EC_POINT *pbatchinc;
+	vg_stream_t streams[VG_STREAMS_MAX], *vstp;
+	vg_pipeline_t *vplp = vg_pipeline;
+	vg_chunk_t *chp;
+	vg_bench_thread_t *vbtp = NULL;
 
-	vg_test_func_t test_func = vcp->vc_test;
 	vg_exec_context_t ctx;
 	vg_exec_context_t *vxcp;
 
-	struct timeval tvstart;
-
-
 	memset(&ctx, 0, sizeof(ctx));
 	vxcp = &ctx;
 
@@ -74,17 +555,50 @@ vg_thread_loop(void *arg)
 
 	pkey = vxcp->vxc_key;
 	pgroup = EC_KEY_get0_group(pkey);
-	pgen = EC_GROUP_get0_generator(pgroup);
 
-	for (i = 0; i < ptarraysize; i++) {
-		ppnt[i] = EC_POINT_new(pgroup);
-		if (!ppnt[i]) {
+	/*
+	 * The points being stepped live in contiguous per-thread
+	 * arrays, and all of the stepping arithmetic is done with the
+	 * native secp256k1 code.  OpenSSL is only used to generate
+	 * the starting key of each run and to import it.
+	 *
+	 * Symmetric stepping covers 2*nhalf+1 keys per batch around
+	 * a moving center, using a table of G..nhalf*G.
+	 *
+	 * Each stream has its own key and point arrays, so the batch
+	 * inversion of one stream is independent of the hashing of
+	 * the stream before it.  The table is shared.
+	 */
+	ptarraysize = vcp->vc_batchsize;
+	nhalf = 0;
+	if (vcp->vc_stepping == VCS_SYMMETRIC) {
+		nhalf = ptarraysize / 2;
+		ptarraysize = (2 * nhalf) + 1;
+		ptable = (vg_ge_t *) malloc(nhalf * sizeof(*ptable));
+	}
+	nstreams = vcp->vc_streams;
+	for (s = 0; s < nstreams; s++) {
+		vstp = &streams[s];
+		memset(vstp, 0, sizeof(*vstp));
+		vstp->vst_keyrun = VG_RUN_NONE;
+		vstp->vst_prevrun = VG_RUN_NONE;
+		vstp->vst_key = s ? vg_exec_context_new_key() : pkey;
+		vstp->vst_ppnt = (vg_ge_t *)
+			malloc(ptarraysize * sizeof(*ppnt));
+		vstp->vst_pjpnt = (vg_gej_t *)
+			malloc(ptarraysize * sizeof(*pjpnt));
+		vstp->vst_pscratch = (vg_fe_t *)
+			malloc((ptarraysize + 8) * sizeof(*pscratch));
+		if (!vstp->vst_key || !vstp->vst_ppnt ||
+		    !vstp->vst_pjpnt || !vstp->vst_pscratch) {
 			fprintf(stderr, "ERROR: out of memory?\n");
 			exit(1);
 		}
 	}
+	pjpnt = streams[0].vst_pjpnt;
+	pscratch = streams[0].vst_pscratch;
 	pbatchinc = EC_POINT_new(pgroup);
-	if (!pbatchinc) {
+	if (!pbatchinc || (nhalf && !ptable)) {
 		fprintf(stderr, "ERROR: out of memory?\n");
 		exit(1);
 	}
@@ -92,38 +606,117 @@ vg_thread_loop(void *arg)
 	BN_set_word(&vxcp->vxc_bntmp, ptarraysize);
 	EC_POINT_mul(pgroup, pbatchinc, &vxcp->vxc_bntmp, NULL, NULL,
 		     vxcp->vxc_bnctx);
-	EC_POINT_make_affine(pgroup, pbatchinc, vxcp->vxc_bnctx);
+	vg_ge_set_ecpoint(&batchinc, pgroup, pbatchinc, vxcp->vxc_bnctx);
+	EC_POINT_free(pbatchinc);
+	vg_ge_set_generator(&gen);
+	if (vcp->vc_pubkey_base)
+		vg_ge_set_ecpoint(&pubkey_base, pgroup, vcp->vc_pubkey_base,
+				  vxcp->vxc_bnctx);
+
+	if (nhalf) {
+		vg_gej_set_ge(&pjpnt[0], &gen);
+		for (i = 1; i < nhalf; i++)
+			vg_gej_add_ge(&pjpnt[i], &pjpnt[i-1], &gen);
+		vg_ge_set_all_gej(ptable, pjpnt, nhalf, pscratch);
+	}
 
 	npoints = 0;
 	rekey_at = 0;
 	nbatch = 0;
-	vxcp->vxc_key = pkey;
+	s = nstreams - 1;
+	vstp = NULL;
 	vxcp->vxc_binres[0] = vcp->vc_addrtype;
-	c = 0;
-	output_interval = 1000;
-	gettimeofday(&tvstart, NULL);
 
-	if (vcp->vc_format == VCF_SCRIPT) {
-		hash_buf[ 0] = 0x51;  // OP_1
-		hash_buf[ 1] = 0x41;  // pubkey length
-		// gap for pubkey
-		hash_buf[67] = 0x51;  // OP_1
-		hash_buf[68] = 0xae;  // OP_CHECKMULTISIG
-		eckey_buf = hash_buf + 2;
-		hash_len = 69;
+	vg_msg_fmt_init(vcp, &fmt);
+	vg_msg_init(vcp, msg_buf);
+	nwork = fmt.vmf_nvariants * (fmt.vmf_elast - fmt.vmf_efirst + 1);
 
-	} else {
-		eckey_buf = hash_buf;
-		hash_len = 65;
+	/* In a pipeline, this thread feeds rings stepper, +nsteppers, ... */
+	stepper = r = 0;
+	if (vplp) {
+		stepper = vg_pipeline_join(vplp, &vplp->vpl_nextstepper);
+		r = stepper;
+	}
+
+	if (vg_bench) {
+		vbtp = vg_bench_join(vg_bench);
+		ticks = vbtp->vbt_ticks;
 	}
 
 	while (!vcp->vc_halt) {
+		if (ticks)
+			t0 = vg_timestamp();
+
+		/* Save the state of the last stream, and load the next */
+		if (vstp) {
+			vstp->vst_delta = vxcp->vxc_delta;
+			vstp->vst_keyrun = vxcp->vxc_run;
+			vstp->vst_npoints = npoints;
+			vstp->vst_rekey_at = rekey_at;
+			vstp->vst_nbatch = nbatch;
+			vstp->vst_center = center;
+		}
+		if (++s == nstreams)
+			s = 0;
+		vstp = &streams[s];
+		pkey = vstp->vst_key;
+		vxcp->vxc_key = pkey;
+		vxcp->vxc_delta = vstp->vst_delta;
+		vxcp->vxc_run = vstp->vst_keyrun;
+		npoints = vstp->vst_npoints;
+		rekey_at = vstp->vst_rekey_at;
+		nbatch = vstp->vst_nbatch;
+		center = vstp->vst_center;
+		ppnt = vstp->vst_ppnt;
+		pjpnt = vstp->vst_pjpnt;
+		pscratch = vstp->vst_pscratch;
+
+		/* A hashing thread found a match in this stream's run */
+		if (vplp &&
+		    (vg_load_acquire(&vplp->vpl_retired[(stepper *
+							 VG_STREAMS_MAX) + s])
+		     == vstp->vst_run)) {
+			npoints = 0;
+			rekey_at = 0;
+		}
+
 		if (++npoints >= rekey_at) {
-			vg_exec_context_upgrade_lock(vxcp);
-			/* Generate a new random private key */
-			EC_KEY_generate_key(pkey);
+			/*
+			 * Generate a new random private key, from the
+			 * context's own generator without taking the
+			 * exclusive lock
+			 */
+			vstp->vst_prevrun = vxcp->vxc_run;
+			vg_exec_context_generate_key(vxcp);
 			npoints = 0;
 
+			/*
+			 * A resumed search starts this unit over from the
+			 * oldest run any stream is still on.  Records of a
+			 * stream's previous run may still be in the rings.
+			 */
+			vstp->vst_keyrun = vxcp->vxc_run;
+			if (!vplp || (vstp->vst_prevrun == VG_RUN_NONE))
+				vstp->vst_prevrun = vxcp->vxc_run;
+			resume = vxcp->vxc_run;
+			for (i = 0; i < nstreams; i++) {
+				if (streams[i].vst_keyrun == VG_RUN_NONE)
+					continue;
+				if (streams[i].vst_prevrun < resume)
+					resume = streams[i].vst_prevrun;
+			}
+			vg_store_relaxed(&vxcp->vxc_resume_run, resume);
+			if (vplp) {
+				/* Records of the run carry its key */
+				memset(vstp->vst_privkey, 0, 32);
+				BN_bn2bin(EC_KEY_get0_private_key(pkey),
+					  vstp->vst_privkey + 32 -
+					  BN_num_bytes(
+						  EC_KEY_get0_private_key(pkey)));
+				if (!++vstp->vst_run)
+					vstp->vst_run++;
+			}
+
 			/* Determine rekey interval */
 			EC_GROUP_get_order(pgroup, &vxcp->vxc_bntmp,
 					   vxcp->vxc_bnctx);
@@ -135,107 +728,341 @@ vg_thread_loop(void *arg)
 				rekey_at = rekey_max;
 			assert(rekey_at > 0);
 
-			EC_POINT_copy(ppnt[0], EC_KEY_get0_public_key(pkey));
-			vg_exec_context_downgrade_lock(vxcp);
+			vg_ge_set_ecpoint(&ppnt[0], pgroup,
+					  EC_KEY_get0_public_key(pkey),
+					  vxcp->vxc_bnctx);
 
 			npoints++;
 			vxcp->vxc_delta = 0;
 
+			vg_gej_set_ge(&pjpnt[0], &ppnt[0]);
 			if (vcp->vc_pubkey_base)
-				EC_POINT_add(pgroup,
-					     ppnt[0],
-					     ppnt[0],
-					     vcp->vc_pubkey_base,
-					     vxcp->vxc_bnctx);
-
-			for (nbatch = 1;
-			     (nbatch < ptarraysize) && (npoints < rekey_at);
-			     nbatch++, npoints++) {
-				EC_POINT_add(pgroup,
-					     ppnt[nbatch],
-					     ppnt[nbatch-1],
-					     pgen, vxcp->vxc_bnctx);
+				vg_gej_add_ge(&pjpnt[0], &pjpnt[0],
+					      &pubkey_base);
+
+			if (vcp->vc_stepping == VCS_SYMMETRIC) {
+				/*
+				 * The new key is the first center, and
+				 * the first batch reaches nhalf keys
+				 * below it.
+				 */
+				if (!vg_ge_set_all_gej(&center, pjpnt, 1,
+						       pscratch)) {
+					npoints = 0;
+					rekey_at = 0;
+					continue;
+				}
+				npoints += nhalf;
+				vxcp->vxc_delta = -nhalf;
+			} else {
+				for (nbatch = 1;
+				     (nbatch < ptarraysize) &&
+					     (npoints < rekey_at);
+				     nbatch++, npoints++) {
+					vg_gej_add_ge(&pjpnt[nbatch],
+						      &pjpnt[nbatch-1],
+						      &gen);
+				}
+
+				if (!vg_ge_set_all_gej(ppnt, pjpnt, nbatch,
+						       pscratch)) {
+					/* Hit infinity, start over */
+					npoints = 0;
+					rekey_at = 0;
+					nbatch = ptarraysize;
+					continue;
+				}
 			}
 
+		} else if (vcp->vc_stepping == VCS_SYMMETRIC) {
+			/*
+			 * Keys past the group order are reduced by
+			 * vg_exec_context_consolidate_key(), so the
+			 * last batch may run over rekey_at.
+			 */
+			npoints += ptarraysize;
+
 		} else {
 			/*
 			 * Common case
 			 *
-			 * EC_POINT_add() can skip a few multiplies if
-			 * one or both inputs are affine (Z_is_one).
-			 * This is the case for every point in ppnt, as
-			 * well as pbatchinc.
+			 * Every point in ppnt is affine, as is batchinc.
 			 */
 			assert(nbatch == ptarraysize);
-			for (nbatch = 0;
-			     (nbatch < ptarraysize) && (npoints < rekey_at);
-			     nbatch++, npoints++) {
-				EC_POINT_add(pgroup,
-					     ppnt[nbatch],
-					     ppnt[nbatch],
-					     pbatchinc,
-					     vxcp->vxc_bnctx);
+			nbatch = rekey_at - npoints;
+			if (nbatch > ptarraysize)
+				nbatch = ptarraysize;
+			npoints += nbatch;
+
+			if (vcp->vc_stepping == VCS_AFFINE) {
+				/*
+				 * Add batchinc to the affine points directly.
+				 * The slope denominators of the whole batch
+				 * share one field inversion.
+				 */
+				if (!vg_ge_add_batch(ppnt, nbatch, &batchinc,
+						     pscratch)) {
+					/* Doubling or infinity, start over */
+					npoints = 0;
+					rekey_at = 0;
+					nbatch = ptarraysize;
+					continue;
+				}
+
+			} else {
+				/*
+				 * Jacobian mixed additions, then batched
+				 * conversion back to affine.  The most
+				 * expensive part of this is the modular
+				 * inversion of the Z coordinates, which
+				 * is done once for the whole array.
+				 */
+				for (i = 0; i < nbatch; i++) {
+					vg_gej_set_ge(&pjpnt[i], &ppnt[i]);
+					vg_gej_add_ge(&pjpnt[i], &pjpnt[i],
+						      &batchinc);
+				}
+				if (!vg_ge_set_all_gej(ppnt, pjpnt, nbatch,
+						       pscratch)) {
+					npoints = 0;
+					rekey_at = 0;
+					nbatch = ptarraysize;
+					continue;
+				}
 			}
 		}
 
+		if (vcp->vc_stepping == VCS_SYMMETRIC) {
+			/*
+			 * center + jG and center - jG share the slope
+			 * denominator (x_jG - x_center), and the step to
+			 * the next center is folded into the same batch
+			 * inversion.
+			 */
+			if (!vg_ge_add_batch_sym(ppnt, &center, ptable, nhalf,
+						 &batchinc, pscratch)) {
+				npoints = 0;
+				rekey_at = 0;
+				continue;
+			}
+			nbatch = ptarraysize;
+		}
+
 		/*
-		 * The single most expensive operation performed in this
-		 * loop is modular inversion of ppnt->Z.  There is an
-		 * algorithm implemented in OpenSSL to do batched inversion
-		 * that only does one actual BN_mod_inverse(), and saves
-		 * a _lot_ of time.
-		 *
-		 * To take advantage of this, we batch up a few points,
-		 * and feed them to EC_POINTs_make_affine() below.
+		 * Serialize every variant and encoding of a chunk of
+		 * points, hash the chunk in one batch, then test the
+		 * results in order.  A pipelined stepper hands the
+		 * serialized chunk to a hashing thread instead.
 		 */
+		if (ticks)
+			ticks[VG_STAGE_STEP] += vg_timestamp() - t0;
+
+		delta = vxcp->vxc_delta;
+		for (i = 0; i < nbatch; i += nchunk) {
+			nchunk = nbatch - i;
+			if (nchunk > VG_HASH_CHUNK)
+				nchunk = VG_HASH_CHUNK;
+
+			if (vplp) {
+				/* Use the first of this thread's rings with room */
+				while (!(chp = vg_ring_reserve(
+						 &vplp->vpl_rings[r]))) {
+					r += vplp->vpl_nsteppers;
+					if (r >= vplp->vpl_nrings) {
+						r = stepper;
+						if (vcp->vc_halt)
+							goto out;
+						sched_yield();
+					}
+				}
+				vg_msg_serialize(&fmt, chp->vch_msg,
+						 ppnt + i, nchunk);
+				memcpy(chp->vch_privkey, vstp->vst_privkey, 32);
+				chp->vch_run = vstp->vst_run;
+				chp->vch_unit = vxcp->vxc_unit;
+				chp->vch_keyrun = vxcp->vxc_run;
+				chp->vch_stream = (stepper * VG_STREAMS_MAX) + s;
+				chp->vch_delta = delta + i;
+				chp->vch_npoints = nchunk;
+				vg_ring_commit(&vplp->vpl_rings[r]);
+				continue;
+			}
 
-		EC_POINTs_make_affine(pgroup, nbatch, ppnt, vxcp->vxc_bnctx);
-
-		for (i = 0; i < nbatch; i++, vxcp->vxc_delta++) {
-			/* Hash the public key */
-			len = EC_POINT_point2oct(pgroup, ppnt[i],
-						 POINT_CONVERSION_UNCOMPRESSED,
-						 eckey_buf,
-						 65,
-						 vxcp->vxc_bnctx);
-			assert(len == 65);
-
-			SHA256(hash_buf, hash_len, hash1);
-			RIPEMD160(hash1, sizeof(hash1), &vxcp->vxc_binres[1]);
-
-			switch (test_func(vxcp)) {
+			if (ticks)
+				t0 = vg_timestamp();
+			vg_msg_serialize(&fmt, msg_buf, ppnt + i, nchunk);
+			if (ticks)
+				ticks[VG_STAGE_SERIALIZE] += vg_timestamp() - t0;
+			switch (vg_msg_test(vxcp, &fmt, msg_buf, nchunk,
+					    delta + i, &j)) {
 			case 1:
 				npoints = 0;
 				rekey_at = 0;
-				i = nbatch;
-				break;
+				i += j + 1;
+				goto rekey;
 			case 2:
 				goto out;
 			default:
 				break;
 			}
 		}
+		vxcp->vxc_delta = delta + nbatch;
 
-		c += i;
-		if (c >= output_interval) {
-			output_interval = vg_output_timing(vcp, c, &tvstart);
-			if (output_interval > 250000)
-				output_interval = 250000;
-			c = 0;
-		}
+	rekey:
+		vxcp->vxc_variant = 0;
 
+		/* Pipelined keys are counted by the hashing threads */
+		if (!vplp)
+			vg_exec_context_count(vxcp, i * nwork);
 		vg_exec_context_yield(vxcp);
+
+		/* A benchmarking thread stops after its share of the keys */
+		if (vbtp) {
+			vbtp->vbt_keys += i * nwork;
+			if (vbtp->vbt_keys >= vg_bench->vb_keys)
+				break;
+		}
 	}
 
 out:
+	if (vbtp)
+		vg_bench_leave(vbtp);
+	vxcp->vxc_key = streams[0].vst_key;
+	vg_exec_context_del(&ctx);
+
+	for (s = 0; s < nstreams; s++) {
+		OPENSSL_cleanse(streams[s].vst_privkey, 32);
+		if (s)
+			EC_KEY_free(streams[s].vst_key);
+		free(streams[s].vst_ppnt);
+		free(streams[s].vst_pjpnt);
+		free(streams[s].vst_pscratch);
+	}
+	if (ptable)
+		free(ptable);
+	return NULL;
+}
+
+/*
+ * Pipelined hashing thread main loop
+ *
+ * Hashes and tests the records of rings hasher, +nhashers, ...  The
+ * context's key is switched to a per-stream copy of the record's run
+ * key, which is only recomputed when the stream rekeys.
+ */
+void *
+vg_hash_loop(void *arg)
+{
+	vg_pipeline_t *vplp = (vg_pipeline_t *) arg;
+	vg_context_t *vcp = vplp->vpl_vc;
+	vg_exec_context_t ctx;
+	vg_exec_context_t *vxcp;
+	vg_msg_fmt_t fmt;
+	vg_ring_t *vrp;
+	vg_chunk_t *chp;
+	EC_KEY *pkey, **keys;
+	unsigned int *runs;
+	int hasher, r, nkeys, nwork, idle, j;
+
+	memset(&ctx, 0, sizeof(ctx));
+	vxcp = &ctx;
+
+	vg_exec_context_init(vcp, &ctx);
+	pkey = vxcp->vxc_key;
+	vxcp->vxc_binres[0] = vcp->vc_addrtype;
+
+	vg_msg_fmt_init(vcp, &fmt);
+	nwork = fmt.vmf_nvariants * (fmt.vmf_elast - fmt.vmf_efirst + 1);
+
+	nkeys = vplp->vpl_nsteppers * VG_STREAMS_MAX;
+	keys = (EC_KEY **) calloc(nkeys, sizeof(*keys));
+	runs = (unsigned int *) calloc(nkeys, sizeof(*runs));
+	if (!keys || !runs) {
+		fprintf(stderr, "ERROR: out of memory?\n");
+		exit(1);
+	}
+
+	hasher = vg_pipeline_join(vplp, &vplp->vpl_nexthasher);
+	r = hasher;
+	idle = 0;
+
+	while (!vcp->vc_halt) {
+		vrp = &vplp->vpl_rings[r];
+		chp = vg_ring_peek(vrp);
+		if (!chp) {
+			/* Try the next ring, back off once all are empty */
+			r += vplp->vpl_nhashers;
+			if (r >= vplp->vpl_nrings) {
+				r = hasher;
+				if (idle)
+					sched_yield();
+				idle = 1;
+			}
+			continue;
+		}
+		idle = 0;
+
+		/* Drop the rest of a run that already matched */
+		if (chp->vch_run ==
+		    vg_load_acquire(&vplp->vpl_retired[chp->vch_stream])) {
+			vg_ring_release(vrp);
+			continue;
+		}
+
+		if (runs[chp->vch_stream] != chp->vch_run) {
+			if (!keys[chp->vch_stream])
+				keys[chp->vch_stream] =
+					vg_exec_context_new_key();
+			if (!keys[chp->vch_stream] ||
+			    !BN_bin2bn(chp->vch_privkey, 32,
+				       &vxcp->vxc_bntmp2) ||
+			    !vg_ecmult_gen_key(keys[chp->vch_stream],
+					       &vxcp->vxc_bntmp2,
+					       vxcp->vxc_bnctx)) {
+				fprintf(stderr, "ERROR: could not load key\n");
+				exit(1);
+			}
+			BN_clear(&vxcp->vxc_bntmp2);
+			runs[chp->vch_stream] = chp->vch_run;
+		}
+		vxcp->vxc_key = keys[chp->vch_stream];
+		vxcp->vxc_unit = chp->vch_unit;
+		vxcp->vxc_run = chp->vch_keyrun;
+
+		j = chp->vch_npoints - 1;
+		switch (vg_msg_test(vxcp, &fmt, chp->vch_msg,
+				    chp->vch_npoints, chp->vch_delta, &j)) {
+		case 1:
+			/*
+			 * The key was consolidated into the match, and
+			 * the stepper must not continue the run
+			 */
+			runs[chp->vch_stream] = 0;
+			vg_store_release(&vplp->vpl_retired[chp->vch_stream],
+					 chp->vch_run);
+			break;
+		case 2:
+			vcp->vc_halt = 1;
+			break;
+		default:
+			break;
+		}
+		vg_ring_release(vrp);
+
+		vxcp->vxc_delta = 0;
+		vxcp->vxc_variant = 0;
+		vg_exec_context_count(vxcp, (j + 1) * nwork);
+		vg_exec_context_yield(vxcp);
+	}
+
+	vxcp->vxc_key = pkey;
 	vg_exec_context_del(&ctx);
-	vg_context_thread_exit(vcp);
 
-	for (i = 0; i < ptarraysize; i++)
-		if (ppnt[i])
-			EC_POINT_free(ppnt[i]);
-	if (pbatchinc)
-		EC_POINT_free(pbatchinc);
+	for (j = 0; j < nkeys; j++)
+		if (keys[j])
+			EC_KEY_free(keys[j]);
+	free(keys);
+	free(runs);
 	return NULL;
 }
 
@@ -246,25 +1073,116 @@ count_processors(void)
 {
 	FILE *fp;
 	char buf[512];
-	int count = 0;
+	int count, quota;
+
+	/* The CPUs this process may run on, or failing that all of them */
+	count = vg_cpu_affinity_count();
+	if (count <= 0) {
+		fp = fopen("/proc/cpuinfo", "r");
+		if (!fp)
+			return -1;
+
+		count = 0;
+		while (fgets(buf, sizeof(buf), fp)) {
+			if (!strncmp(buf, "processor\t", 10))
+				count += 1;
+		}
+		fclose(fp);
+	}
 
-	fp = fopen("/proc/cpuinfo", "r");
-	if (!fp)
-		return -1;
+	/* Don't oversubscribe the CPU quota of a container */
+	quota = vg_cpu_quota();
+	if ((quota > 0) && (quota < count))
+		count = quota;
+	return count;
+}
 
-	while (fgets(buf, sizeof(buf), fp)) {
-		if (!strncmp(buf, "processor\t", 10))
-			count += 1;
+int
+get_cache_size(int level)
+{
+	FILE *fp;
+	char path[128], buf[64];
+	int i, lvl, size;
+	char unit;
+
+	/* Look for a data or unified cache at the requested level */
+	for (i = 0; i < 16; i++) {
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/cpu/cpu0/cache/index%d/level", i);
+		fp = fopen(path, "r");
+		if (!fp)
+			break;
+		lvl = 0;
+		if (fscanf(fp, "%d", &lvl) != 1)
+			lvl = 0;
+		fclose(fp);
+		if (lvl != level)
+			continue;
+
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/cpu/cpu0/cache/index%d/type", i);
+		fp = fopen(path, "r");
+		if (!fp)
+			continue;
+		if (!fgets(buf, sizeof(buf), fp))
+			buf[0] = '\0';
+		fclose(fp);
+		if (!strncmp(buf, "Instruction", 11))
+			continue;
+
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/cpu/cpu0/cache/index%d/size", i);
+		fp = fopen(path, "r");
+		if (!fp)
+			continue;
+		size = 0;
+		unit = '\0';
+		if (fscanf(fp, "%d%c", &size, &unit) < 1)
+			size = 0;
+		fclose(fp);
+		if (unit == 'K')
+			size *= 1024;
+		else if (unit == 'M')
+			size *= 1024 * 1024;
+		return size;
 	}
-	fclose(fp);
-	return count;
+	return -1;
 }
 #endif
 
+/*
+ * Choose the number of points stepped per batch so that the point
+ * arrays and the inversion scratch space of all of a thread's
+ * streams stay resident in half of the L2 cache.
+ */
+int
+choose_batch_size(int nstreams)
+{
+	const int perpoint = sizeof(vg_ge_t) + sizeof(vg_fe_t);
+	int size, nbatch;
+
+	size = get_cache_size(2);
+	if (size <= 0)
+		size = 256 * 1024;
+	size /= nstreams;
+
+	for (nbatch = VG_BATCH_MIN;
+	     ((2 * nbatch) <= VG_BATCH_MAX) &&
+		     ((2 * nbatch * perpoint) <= (size / 2));
+	     nbatch *= 2);
+	return nbatch;
+}
+
 int
-start_threads(vg_context_t *vcp, int nthreads)
+start_threads(vg_context_t *vcp, int nthreads, int nhashers,
+	      enum vg_cpu_pin pinmode)
 {
 	pthread_t thread;
+	pthread_attr_t attr;
+	void *(*func)(void *) = vg_thread_loop;
+	void *arg = vcp;
+	int *cpus = NULL;
+	int ncpus = 0, nnodes = 1, nworkers, i, res;
 
 	if (nthreads <= 0) {
 		/* Determine the number of threads */
@@ -274,33 +1192,212 @@ start_threads(vg_context_t *vcp, int nthreads)
 				"ERROR: could not determine processor count\n");
 			nthreads = 1;
 		}
+		/* The hashing threads share the processors */
+		nthreads -= nhashers;
+		if (nthreads <= 0)
+			nthreads = 1;
+	}
+
+	if (vg_bench) {
+		vg_bench->vb_nthreads = nthreads;
+		vg_bench->vb_keys = (vg_bench->vb_keys + nthreads - 1) /
+			nthreads;
+		vg_bench->vb_threads = (vg_bench_thread_t *)
+			calloc(nthreads, sizeof(*vg_bench->vb_threads));
+		vg_bench->vb_pthreads = (pthread_t *)
+			calloc(nthreads, sizeof(*vg_bench->vb_pthreads));
+		if (!vg_bench->vb_threads || !vg_bench->vb_pthreads) {
+			fprintf(stderr, "ERROR: out of memory?\n");
+			return 0;
+		}
+		pthread_mutex_init(&vg_bench->vb_lock, NULL);
+	}
+
+	if (nhashers) {
+		vg_pipeline = vg_pipeline_new(vcp, nthreads, nhashers);
+		if (!vg_pipeline) {
+			fprintf(stderr, "ERROR: out of memory?\n");
+			return 0;
+		}
+	}
+
+	if (!vcp->vc_batchsize)
+		vcp->vc_batchsize = choose_batch_size(vcp->vc_streams);
+
+	vg_hash_init(NULL);
+	vg_fe_init(NULL);
+
+	if (pinmode != VG_PIN_NONE) {
+		ncpus = vg_cpu_pin_order(pinmode, &cpus);
+		if (ncpus <= 0) {
+			fprintf(stderr,
+				"WARNING: could not determine CPU topology, "
+				"threads will not be pinned\n");
+			ncpus = 0;
+		} else {
+			/*
+			 * Pinned threads on several NUMA nodes each read
+			 * a copy of the pattern store in local memory.
+			 * Their stepping tables are allocated after
+			 * pinning, so they are node-local already.
+			 */
+			nnodes = vg_numa_node_count();
+			if (nnodes > 1)
+				vcp->vc_numa_replicas = 1;
+		}
 	}
 
 	if (vcp->vc_verbose > 1) {
 		fprintf(stderr, "Using %d worker thread(s)\n", nthreads);
+		if (nhashers)
+			fprintf(stderr, "Pipelining to %d hashing thread(s)\n",
+				nhashers);
+		fprintf(stderr, "Using %s stepping, %d points per batch, "
+			"%d stream(s) per thread\n",
+			(vcp->vc_stepping == VCS_SYMMETRIC) ? "symmetric" :
+			(vcp->vc_stepping == VCS_AFFINE) ? "affine" : "jacobian",
+			vcp->vc_batchsize, vcp->vc_streams);
+		if (vcp->vc_stepping == VCS_SYMMETRIC)
+			fprintf(stderr, "Using %s field arithmetic\n",
+				vg_fe_backend_name());
+		fprintf(stderr, "Using %s SHA-256, %s RIPEMD-160 backends\n",
+			vg_hash_backend_name(),
+			vg_hash_ripemd160_backend_name());
+		if (ncpus)
+			fprintf(stderr,
+				"Pinning threads to %d CPU(s), %s first\n",
+				ncpus,
+				(pinmode == VG_PIN_SMT) ?
+				"SMT siblings" : "physical cores");
+		if (vcp->vc_numa_replicas)
+			fprintf(stderr,
+				"Replicating patterns on %d NUMA nodes\n",
+				nnodes);
 	}
 
-	while (--nthreads) {
-		if (pthread_create(&thread, NULL, vg_thread_loop, vcp))
+	/* A benchmark reports once, at the end */
+	if (!vg_bench && vg_context_start_timing(vcp)) {
+		if (cpus)
+			free(cpus);
+		return 0;
+	}
+
+	/*
+	 * Hashing threads follow the stepping threads in CPU order,
+	 * and this thread runs the last worker.
+	 */
+	nworkers = nthreads + nhashers;
+	for (i = 0; i < nworkers; i++) {
+		if (i < nthreads) {
+			func = vg_thread_loop;
+			arg = vcp;
+		} else {
+			func = vg_hash_loop;
+			arg = vg_pipeline;
+		}
+		if (i == (nworkers - 1))
+			break;
+		pthread_attr_init(&attr);
+		if (ncpus && vg_cpu_pin_attr(&attr, cpus[i % ncpus]))
+			fprintf(stderr,
+				"WARNING: could not pin thread to CPU %d\n",
+				cpus[i % ncpus]);
+		res = pthread_create(&thread, &attr, func, arg);
+		pthread_attr_destroy(&attr);
+		if (res) {
+			fprintf(stderr, "ERROR: could not start thread: %s\n",
+				strerror(res));
+			if (cpus)
+				free(cpus);
 			return 0;
+		}
+		if (vg_bench)
+			vg_bench->vb_pthreads[i] = thread;
 	}
 
-	vg_thread_loop(vcp);
+	if (ncpus && vg_cpu_pin_self(cpus[i % ncpus]))
+		fprintf(stderr, "WARNING: could not pin thread to CPU %d\n",
+			cpus[i % ncpus]);
+	if (cpus)
+		free(cpus);
+
+	func(arg);
+
+	if (vg_bench) {
+		for (i = 0; i < (nworkers - 1); i++)
+			pthread_join(vg_bench->vb_pthreads[i], NULL);
+		vg_bench_report(vg_bench, vcp);
+	}
 	return 1;
 }
 
 
+/*
+ * Synthetic benchmark patterns: 9 character prefixes, or suffixes, of
+ * the addresses of a fixed sequence of hashes, valid but all but
+ * impossible to match
+ */
+int
+vg_bench_patterns(vg_context_t *vcp, int npatterns, int regex, int suffix)
+{
+	unsigned long long x = 0x9e3779b97f4a7c15ULL;
+	unsigned char hash[21];
+	char addr[64], *buf, **patterns;
+	int i, j, res;
+
+	patterns = (char **) malloc(npatterns * sizeof(*patterns));
+	buf = (char *) malloc(npatterns * 12);
+	if (!patterns || !buf) {
+		fprintf(stderr, "ERROR: out of memory?\n");
+		return 0;
+	}
+	hash[0] = vcp->vc_addrtype;
+	for (i = 0; i < npatterns; i++) {
+		for (j = 1; j < 21; j++) {
+			x = (x * 6364136223846793005ULL) +
+				1442695040888963407ULL;
+			hash[j] = x >> 56;
+		}
+		vg_b58_encode_check(hash, sizeof(hash), addr);
+		patterns[i] = buf + (i * 12);
+		snprintf(patterns[i], 12, "%s%.9s", regex ? "^" : "",
+			 suffix ? (addr + strlen(addr) - 9) : addr);
+	}
+	res = vg_context_add_patterns(vcp, (const char ** const) patterns,
+				      npatterns);
+	free(patterns);
+	free(buf);
+	return res;
+}
+
+
+/*
+ * A first SIGINT or SIGTERM asks the reporter thread to write a
+ * checkpoint and stop the search, a second one kills the process.
+ */
+static vg_context_t *vg_signal_context = NULL;
+
+void
+vg_checkpoint_signal(int sig)
+{
+	vg_signal_context->vc_checkpoint_request = 1;
+	signal(sig, SIG_DFL);
+}
+
+
 void
 usage(const char *name)
 {
 	fprintf(stderr,
 "Vanitygen %s (" OPENSSL_VERSION_TEXT ")\n"
-"Usage: %s [-vqnrik1NT] [-t <threads>] [-f <filename>|-] [<pattern>...]\n"
+"Usage: %s [-vqnrzik1gcCNT] [-t <threads>] [-f <filename>|-] [<pattern>...]\n"
 "Generates a bitcoin receiving address matching <pattern>, and outputs the\n"
 "address and associated private key.  The private key may be stored in a safe\n"
 "location or imported into a bitcoin client to spend any balance received on\n"
 "the address.\n"
-"By default, <pattern> is interpreted as an exact prefix.\n"
+"By default, <pattern> is interpreted as an exact prefix, in which a\n"
+"[...] set of base58 characters and ranges such as [a-k] matches any\n"
+"one of them.\n"
 "\n"
 "Options:\n"
 "-v            Verbose output\n"
@@ -308,7 +1405,9 @@ usage(const char *name)
 "-n            Simulate\n"
 "-r            Use regular expression match instead of prefix\n"
 "              (Feasibility of expression is not checked)\n"
-"-i            Case-insensitive prefix search\n"
+"-z            Match patterns as suffixes of the address, of up to 10\n"
+"              characters, instead of prefixes\n"
+"-i            Case-insensitive prefix or suffix search\n"
 "-k            Keep pattern and continue search after finding a match\n"
 "-1            Stop after first match\n"
 "-N            Generate namecoin address\n"
@@ -316,13 +1415,39 @@ usage(const char *name)
 "-X <version>  Generate address with the given version\n"
 "-F <format>   Generate address with the given format (pubkey or script)\n"
 "-P <pubkey>   Specify base public key for piecewise key generation\n"
+"-D <seed>     Derive the key of every run from <seed>, so that matches can\n"
+"              be rebuilt from their origin.  Keys are only as strong as\n"
+"              <seed>, use \"-\" to read it from the -s file or stdin\n"
+"-W <worker>   Index of this process among those sharing a -D seed\n"
+"-R <origin>   Rebuild the key of a match from its origin, needs -D\n"
+"-K <file>     Write a checkpoint to <file> every minute, and on SIGINT or\n"
+"              SIGTERM before stopping\n"
+"-u            Resume the search from the -K checkpoint, with its patterns\n"
 "-e            Encrypt private keys, prompt for password\n"
 "-E <password> Encrypt private keys with <password> (UNSAFE)\n"
 "-t <threads>  Set number of worker threads (Default: number of CPUs)\n"
+"-H <threads>  Pipeline the search: the -t threads step points, and\n"
+"              <threads> more hash and test them (Default: off)\n"
+"-A <mode>     Pin worker threads to CPUs, one per physical core first\n"
+"              (core) or filling the SMT siblings of each core (smt)\n"
+"-m <mode>     Point stepping mode (symmetric, affine or jacobian,\n"
+"              Default: symmetric)\n"
+"-b <points>   Points per stepping batch, 256-8192 (Default: sized to L2)\n"
+"-S <streams>  Independent key streams interleaved by each thread, 1-4\n"
+"              (Default: 1)\n"
+"-c            Generate address from the compressed public key\n"
+"-C            Check both the compressed and uncompressed public key\n"
+"-g            Also check the negated and endomorphism images of each point\n"
+"              (six addresses per point, incompatible with -P)\n"
 "-f <file>     File containing list of patterns, one per line\n"
 "              (Use \"-\" as the file name for stdin)\n"
 "-o <file>     Write pattern matches to <file>\n"
-"-s <file>     Seed random number generator from <file>\n",
+"-s <file>     Seed random number generator from <file>\n"
+"-Z <file>     Cache the key generation table in <file>\n"
+"-B <keys>     Benchmark: search a synthetic pattern set until <keys> keys\n"
+"              are checked, then report the key rate and the time spent in\n"
+"              each stage of the search (Seeded randomly unless -D is given)\n"
+"-j            Report the benchmark in JSON\n",
 version, name);
 }
 
@@ -337,6 +1462,7 @@ main(int argc, char **argv)
 	int pubkeytype;
 	enum vg_format format = VCF_PUBKEY;
 	int regex = 0;
+	int suffix = 0;
 	int caseinsensitive = 0;
 	int verbose = 1;
 	int simulate = 0;
@@ -348,9 +1474,25 @@ main(int argc, char **argv)
 	char pwbuf[128];
 	const char *result_file = NULL;
 	const char *key_password = NULL;
+	const char *gen_table_file = NULL;
 	char **patterns;
 	int npatterns = 0;
 	int nthreads = 0;
+	enum vg_stepping stepping = VCS_SYMMETRIC;
+	enum vg_cpu_pin pinmode = VG_PIN_NONE;
+	int batchsize = 0;
+	int variants = 1;
+	int nstreams = 1;
+	int nhashers = 0;
+	const char *seed = NULL;
+	const char *replay = NULL;
+	unsigned long worker = 0;
+	const char *checkpoint_file = NULL;
+	int resume = 0;
+	unsigned long long bench_keys = 0;
+	int bench_json = 0;
+	vg_exec_context_t vxc;
+	enum vg_compression compression = VCC_UNCOMPRESSED;
 	vg_context_t *vcp = NULL;
 	EC_POINT *pubkey_base = NULL;
 
@@ -361,7 +1503,8 @@ main(int argc, char **argv)
 
 	int i;
 
-	while ((opt = getopt(argc, argv, "vqnrik1eE:P:NTX:F:t:h?f:o:s:")) != -1) {
+	while ((opt = getopt(argc, argv,
+			     "vqnrzik1eE:P:D:W:R:K:uNTX:F:t:H:A:m:b:S:gcCh?f:o:s:Z:B:j")) != -1) {
 		switch (opt) {
 		case 'v':
 			verbose = 2;
@@ -375,6 +1518,9 @@ main(int argc, char **argv)
 		case 'r':
 			regex = 1;
 			break;
+		case 'z':
+			suffix = 1;
+			break;
 		case 'i':
 			caseinsensitive = 1;
 			break;
@@ -442,6 +1588,65 @@ main(int argc, char **argv)
 				return 1;
 			}
 			break;
+		case 'H':
+			nhashers = atoi(optarg);
+			if (nhashers <= 0) {
+				fprintf(stderr,
+					"Invalid hashing thread count '%s'\n",
+					optarg);
+				return 1;
+			}
+			break;
+		case 'A':
+			if (!strcmp(optarg, "core"))
+				pinmode = VG_PIN_CORE;
+			else if (!strcmp(optarg, "smt"))
+				pinmode = VG_PIN_SMT;
+			else {
+				fprintf(stderr,
+					"Invalid pinning mode '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'm':
+			if (!strcmp(optarg, "symmetric"))
+				stepping = VCS_SYMMETRIC;
+			else if (!strcmp(optarg, "affine"))
+				stepping = VCS_AFFINE;
+			else if (!strcmp(optarg, "jacobian"))
+				stepping = VCS_JACOBIAN;
+			else {
+				fprintf(stderr,
+					"Invalid stepping mode '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'b':
+			batchsize = atoi(optarg);
+			if ((batchsize < VG_BATCH_MIN) ||
+			    (batchsize > VG_BATCH_MAX)) {
+				fprintf(stderr,
+					"Invalid batch size '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'S':
+			nstreams = atoi(optarg);
+			if ((nstreams < 1) || (nstreams > VG_STREAMS_MAX)) {
+				fprintf(stderr,
+					"Invalid stream count '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'g':
+			variants = 6;
+			break;
+		case 'c':
+			compression = VCC_COMPRESSED;
+			break;
+		case 'C':
+			compression = VCC_BOTH;
+			break;
 		case 'f':
 			if (npattfp >= MAX_FILE) {
 				fprintf(stderr,
@@ -454,6 +1659,7 @@ main(int argc, char **argv)
 						"specified multiple times\n");
 					return 1;
 				}
+				pattstdin = 1;
 				fp = stdin;
 			} else {
 				fp = fopen(optarg, "r");
@@ -476,6 +1682,36 @@ main(int argc, char **argv)
 			}
 			result_file = optarg;
 			break;
+		case 'Z':
+			gen_table_file = optarg;
+			break;
+		case 'D':
+			seed = optarg;
+			break;
+		case 'W':
+			worker = strtoul(optarg, NULL, 10);
+			break;
+		case 'R':
+			replay = optarg;
+			break;
+		case 'K':
+			checkpoint_file = optarg;
+			break;
+		case 'u':
+			resume = 1;
+			break;
+		case 'B':
+			bench_keys = strtoull(optarg, NULL, 10);
+			if (!bench_keys) {
+				fprintf(stderr,
+					"Invalid benchmark key count '%s'\n",
+					optarg);
+				return 1;
+			}
+			break;
+		case 'j':
+			bench_json = 1;
+			break;
 		case 's':
 			if (seedfile != NULL) {
 				fprintf(stderr,
@@ -499,6 +1735,35 @@ main(int argc, char **argv)
 	}
 #endif
 
+	if ((variants > 1) && pubkey_base) {
+		fprintf(stderr,
+			"Endomorphism checking (-g) is incompatible with "
+			"piecewise key generation (-P)\n");
+		return 1;
+	}
+
+	if ((compression != VCC_UNCOMPRESSED) &&
+	    (prompt_password || key_password)) {
+		fprintf(stderr,
+			"Compressed keys (-c/-C) cannot be password-protected, "
+			"the Protkey format does not record them\n");
+		return 1;
+	}
+
+	if (bench_keys && (nhashers || checkpoint_file || resume || replay)) {
+		fprintf(stderr,
+			"The benchmark (-B) cannot be combined with "
+			"-H, -K, -u or -R\n");
+		return 1;
+	}
+
+	if (suffix && regex) {
+		fprintf(stderr,
+			"Suffix (-z) and regular expression (-r) modes "
+			"cannot be combined\n");
+		return 1;
+	}
+
 	if (caseinsensitive && regex)
 		fprintf(stderr,
 			"WARNING: case insensitive mode incompatible with "
@@ -539,6 +1804,10 @@ main(int argc, char **argv)
 	if (regex) {
 		vcp = vg_regex_context_new(addrtype, privtype);
 
+	} else if (suffix) {
+		vcp = vg_suffix_context_new(addrtype, privtype,
+					    caseinsensitive);
+
 	} else {
 		vcp = vg_prefix_context_new(addrtype, privtype,
 					    caseinsensitive);
@@ -546,16 +1815,97 @@ main(int argc, char **argv)
 
 	vcp->vc_verbose = verbose;
 	vcp->vc_result_file = result_file;
-	vcp->vc_remove_on_match = remove_on_match;
+	vcp->vc_remove_on_match = bench_keys ? 0 : remove_on_match;
 	vcp->vc_only_one = only_one;
 	vcp->vc_format = format;
 	vcp->vc_pubkeytype = pubkeytype;
 	vcp->vc_pubkey_base = pubkey_base;
+	vcp->vc_stepping = stepping;
+	vcp->vc_batchsize = batchsize;
+	vcp->vc_variants = variants;
+	vcp->vc_streams = nstreams;
+	vcp->vc_compression = compression;
 
 	vcp->vc_output_match = vg_output_match_console;
 	vcp->vc_output_timing = vg_output_timing_console;
 
-	if (!npattfp) {
+	if (seed) {
+		if (!strcmp(seed, "-") && !seedfile && pattstdin) {
+			fprintf(stderr, "ERROR: stdin "
+				"specified multiple times\n");
+			return 1;
+		}
+		if (strcmp(seed, "-")) {
+			/*
+			 * A seed typed on the command line is a brain
+			 * wallet for every key of the search, and is
+			 * also left in the shell history.
+			 */
+			if (!vg_check_password_complexity(seed, 1))
+				fprintf(stderr,
+					"WARNING: Deriving keys from "
+					"weak seed\n");
+			fprintf(stderr,
+				"WARNING: Keys are only as strong as the -D "
+				"seed, use -D - to read it from the -s file "
+				"or stdin instead\n");
+		}
+		if (!vg_read_seed(seed, seedfile, vcp->vc_seed)) {
+			fprintf(stderr, "Could not read seed from %s\n",
+				seedfile ? seedfile : "stdin");
+			return 1;
+		}
+		vcp->vc_seeded = 1;
+		vcp->vc_worker = worker;
+	} else if (bench_keys) {
+		/*
+		 * Benchmarks run the seeded key schedule, but from a
+		 * random seed unless -D is given, since any matches are
+		 * still reported as usable keys.
+		 */
+		if (RAND_bytes(vcp->vc_seed, sizeof(vcp->vc_seed)) != 1) {
+			fprintf(stderr, "Could not generate benchmark seed\n");
+			return 1;
+		}
+		vcp->vc_seeded = 1;
+		vcp->vc_worker = worker;
+	}
+
+	if (replay) {
+		if (!vcp->vc_seeded) {
+			fprintf(stderr, "Rebuilding a match needs its seed\n");
+			return 1;
+		}
+		vg_exec_context_init(vcp, &vxc);
+		if (!vg_exec_context_replay(&vxc, replay)) {
+			fprintf(stderr, "Invalid match origin '%s'\n", replay);
+			return 1;
+		}
+		strncpy(vcp->vc_match_origin, replay,
+			sizeof(vcp->vc_match_origin) - 1);
+		vcp->vc_output_match(vcp, vxc.vxc_key, "(rebuilt)");
+		vg_exec_context_del(&vxc);
+		return 0;
+	}
+
+	if (resume) {
+		if (!checkpoint_file) {
+			fprintf(stderr, "Resuming needs the checkpoint (-K)\n");
+			return 1;
+		}
+		if (npattfp || (optind < argc)) {
+			fprintf(stderr, "The patterns of a resumed search "
+				"come from its checkpoint\n");
+			return 1;
+		}
+		if (!vg_context_resume(vcp, checkpoint_file))
+			return 1;
+
+	} else if (!npattfp && bench_keys && (optind >= argc)) {
+		if (!vg_bench_patterns(vcp, 1024, regex, suffix))
+			return 1;
+
+	} else if (!npattfp) {
 		if (optind >= argc) {
 			usage(argv[0]);
 			return 1;
@@ -578,7 +1928,9 @@ main(int argc, char **argv)
 		if (fp != stdin)
 			fclose(fp);
 
-		if (!regex)
+		if (suffix)
+			vg_suffix_context_set_case_insensitive(vcp, pattfpi[i]);
+		else if (!regex)
 			vg_prefix_context_set_case_insensitive(vcp, pattfpi[i]);
 
 		if (!vg_context_add_patterns(vcp,
@@ -598,6 +1950,7 @@ main(int argc, char **argv)
 		key_password = pwbuf;
 	}
 	vcp->vc_key_protect_pass = key_password;
+	vcp->vc_gen_table_file = gen_table_file;
 	if (key_password) {
 		if (!vg_check_password_complexity(key_password, verbose))
 			fprintf(stderr,
@@ -612,7 +1965,24 @@ main(int argc, char **argv)
 	if (simulate)
 		return 0;
 
-	if (!start_threads(vcp, nthreads))
+	if (checkpoint_file) {
+		vcp->vc_checkpoint_file = checkpoint_file;
+		vg_signal_context = vcp;
+		signal(SIGINT, vg_checkpoint_signal);
+		signal(SIGTERM, vg_checkpoint_signal);
+	}
+
+	if (bench_keys) {
+		vg_bench = (vg_bench_t *) calloc(1, sizeof(*vg_bench));
+		if (!vg_bench) {
+			fprintf(stderr, "ERROR: out of memory?\n");
+			return 1;
+		}
+		vg_bench->vb_keys = bench_keys;
+		vg_bench->vb_json = bench_json;
+	}
+
+	if (!start_threads(vcp, nthreads, nhashers, pinmode))
 		return 1;
 	return 0;
 }
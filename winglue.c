@@ -68,6 +68,50 @@ count_processors(void)
 	return count;
 }
 
+int
+get_cache_size(int level)
+{
+	typedef BOOL (WINAPI *LPFN_GLPI)(
+		PSYSTEM_LOGICAL_PROCESSOR_INFORMATION, PDWORD);
+	LPFN_GLPI glpi;
+	PSYSTEM_LOGICAL_PROCESSOR_INFORMATION buffer = NULL, ptr;
+	DWORD size = 0, pos = 0, ret;
+	int result = -1;
+
+	glpi = (LPFN_GLPI) GetProcAddress(GetModuleHandle(TEXT("kernel32")),
+					  "GetLogicalProcessorInformation");
+	if (!glpi)
+		return -1;
+
+	while (1) {
+		ret = glpi(buffer, &size);
+		if (ret)
+			break;
+		if (buffer)
+			free(buffer);
+		if (GetLastError() != ERROR_INSUFFICIENT_BUFFER)
+			return -1;
+		buffer = (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION) malloc(size);
+		if (!buffer)
+			return -1;
+	}
+
+	for (ptr = buffer;
+	     (pos + sizeof(*ptr)) <= size;
+	     ptr++, pos += sizeof(*ptr)) {
+		if ((ptr->Relationship == RelationCache) &&
+		    (ptr->Cache.Level == level) &&
+		    (ptr->Cache.Type != CacheInstruction)) {
+			result = ptr->Cache.Size;
+			break;
+		}
+	}
+
+	if (buffer)
+		free(buffer);
+	return result;
+}
+
 
 /*
  * struct timeval compatibility for Win32
@@ -40,6 +40,7 @@ extern int optind;
 extern int getopt(int argc, TCHAR *argv[], TCHAR *optstring);
 
 extern int count_processors(void);
+extern int get_cache_size(int level);
 
 #define PRSIZET "I"
 